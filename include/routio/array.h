@@ -14,10 +14,22 @@ using namespace routio;
 
 namespace routio {
 
-enum DataType { UINT8 = 1, UINT16 = 2, UINT32 = 3, INT8 = 4, INT16 = 5, INT32 = 6, FLOAT32 = 10, FLOAT64 = 11 };
+enum DataType { UINT8 = 1, UINT16 = 2, UINT32 = 3, INT8 = 4, INT16 = 5, INT32 = 6, FLOAT32 = 10, FLOAT64 = 11, FLOAT16 = 12, BFLOAT16 = 13 };
 
 class ArrayBuffer;
 
+/**
+ * Conversion between single precision numbers and half precision (IEEE 754 binary16) or bfloat16
+ * numbers, both stored as 16 bit values. Vector instructions are used if the processor supports them.
+ */
+void float32_to_float16(const float* source, uint16_t* destination, size_t count);
+
+void float16_to_float32(const uint16_t* source, float* destination, size_t count);
+
+void float32_to_bfloat16(const float* source, uint16_t* destination, size_t count);
+
+void bfloat16_to_float32(const uint16_t* source, float* destination, size_t count);
+
 typedef std::function<void()> DescructorCallback;
 
 class Array {
@@ -30,13 +42,47 @@ public:
     virtual ~Array();
 
     virtual size_t get_size() const;
+
+    /**
+     * Returns the data for writing. A read-only array is detached first, so that the shared
+     * memory is never modified. As detaching replaces the data, arrays that are read by other
+     * threads have to be detached explicitly before, use get_const_data to read them in place.
+     */
     uchar* get_data() const;
 
+    /**
+     * Returns the data for reading without copying, also of read-only arrays.
+     */
+    const uchar* get_const_data() const;
+
+    /**
+     * Read-only arrays reference data that may be shared with others, e.g. a received message.
+     */
+    bool is_readonly() const;
+    void set_readonly(bool readonly);
+
+    /**
+     * Replaces the data of a read-only array with a private copy that can be modified, other
+     * arrays are left as they are. Must not be called while other threads read the array.
+     */
+    void detach();
+
 protected:
 
+    /**
+     * Copies the shared data. The shared data is only released together with the array, as
+     * it may still be referenced by others.
+     */
+    virtual void copy_shared();
+
     size_t size;
     uchar* data;
     DescructorCallback callback;
+    std::atomic<bool> readonly;
+
+private:
+
+    std::recursive_mutex detaching;
 
 };
 
@@ -53,6 +99,23 @@ public:
 
     Tensor(routio::any_container<size_t> dimensions, DataType dtype, uchar* data, DescructorCallback callback);
 
+    /**
+     * Creates a tensor over existing data with strides given in bytes, for example a view
+     * of a region of a larger tensor.
+     */
+    Tensor(routio::any_container<size_t> dimensions, DataType dtype, routio::any_container<ssize_t> strides, uchar* data, DescructorCallback callback);
+
+    /**
+     * Returns a view of a region of the parent tensor that shares its memory and keeps it alive.
+     */
+    static shared_ptr<Tensor> crop(shared_ptr<Tensor> parent, routio::any_container<size_t> offset, routio::any_container<size_t> dimensions);
+
+    /**
+     * Returns a contiguous copy of the tensor converted to a different floating point type, e.g. to
+     * send FLOAT32 data as FLOAT16. The tensor itself is returned if it already has the given type.
+     */
+    static shared_ptr<Tensor> convert(shared_ptr<Tensor> source, DataType dtype);
+
 #ifdef __ROUTIO_HAS_OPENCV
     static DataType decode_ocvtype(int cvtype);
 
@@ -61,13 +124,10 @@ public:
     Tensor(cv::Mat source);
 
     template<typename T, int m, int n> Tensor(const cv::Matx<T, m, n>& source) : Tensor({source.rows, source.cols}, decode_ocvtype(cv::DataType<T>::depth)) {
-        
-        T* ptr = (T*) get_data();
 
         for (int i = 0; i < m; i++) {
             for (int j = 0; j < n; j++) {
-                ptr[0] = source(i, j);
-                ptr++;
+                *((T*) (get_data() + i * stride(0) + j * stride(1))) = source(i, j);
             }
         }
 
@@ -79,16 +139,12 @@ public:
 
         assert(ndims() == 2 && m == shape(0) && n == shape(1) && encode_ocvtype(dtype) == reftype);
 
-        T* ptr = (T*) get_data();
-
         cv::Matx<T, m, n> dst;
 
-        size_t k = 0;
-
+        // Elements are addressed with strides, the tensor may be a view
         for (int i = 0; i < m; i++) {
             for (int j = 0; j < n; j++) {
-                dst(i, j) = data[k];
-                k++;
+                dst(i, j) = *((const T*) (get_const_data() + i * stride(0) + j * stride(1)));
             }
         }
 
@@ -110,21 +166,62 @@ public:
 
     uchar ndims() const;
 
+    ssize_t stride(size_t i) const;
+
+    const std::vector<ssize_t> get_strides() const;
+
+    bool is_contiguous() const;
+
     uchar get_bytes();
 
     static size_t get_type_bytes(DataType dtype);
 
 protected:
 
+    virtual void copy_shared();
+
     vector<size_t> dimensions;
 
+    vector<ssize_t> strides;
+
     DataType dtype;
 
 };
 
 typedef shared_ptr<Tensor> SharedTensor;
 
-template <> inline string get_type_identifier<SharedTensor>() { return string("tensor"); }
+// Set in the header of tensors that are encoded with aligned data, the number of dimensions is then
+// stored in the second byte and followed by a zero byte, which older readers reject as data type
+#define TENSOR_ENCODING_ALIGNED ((size_t) 1 << 63)
+
+/**
+ * Hands out tensors with recycled buffers. Buffers of released tensors are kept for tensors
+ * of the same shape and type, a buffer is released when the last reference to its tensor is,
+ * including messages that are still waiting to be sent.
+ */
+class TensorPool {
+public:
+
+    TensorPool(size_t capacity = 4);
+
+    ~TensorPool();
+
+    SharedTensor allocate(routio::any_container<size_t> dimensions, DataType dtype = UINT8);
+
+    size_t get_available() const;
+
+    void clear();
+
+private:
+
+    class Storage;
+
+    shared_ptr<Storage> storage;
+
+};
+
+// Channels of tensors encoded with aligned data are not shared with older clients
+template <> inline string get_type_identifier<SharedTensor>() { return string("tensor/aligned"); }
 
 class ArrayBuffer : public Buffer {
 public:
@@ -136,6 +233,8 @@ public:
 
     virtual size_t copy_data(size_t position, uchar* buffer, size_t length) const;
 
+    virtual const uchar* get_contiguous(size_t position, size_t length) const;
+
 private:
 
     const SharedArray array;
@@ -143,10 +242,55 @@ private:
 
 };
 
+/**
+ * Serializes tensors with non-contiguous data directly from their memory, the data is
+ * gathered from segments that are contiguous, e.g. rows of a cropped image.
+ */
+class TensorBuffer : public Buffer {
+public:
+    TensorBuffer(SharedTensor tensor);
+
+    virtual ~TensorBuffer();
+
+    virtual size_t get_length() const;
+
+    virtual size_t copy_data(size_t position, uchar* buffer, size_t length) const;
+
+    virtual const uchar* get_contiguous(size_t position, size_t length) const;
+
+    size_t get_segments() const;
+
+    size_t get_segment_length() const;
+
+    const uchar* get_segment(size_t index) const;
+
+private:
+
+    const SharedTensor tensor;
+
+    size_t segment_length;
+
+    size_t segments;
+
+    // Dimensions that are not merged into segments
+    size_t outer;
+
+};
+
 template<> inline void read(MessageReader& reader, SharedArray& dst) {
 
     int size = reader.read<size_t>(); 
 
+    // Received data is used in place, the array keeps the message alive
+    const uchar* view = reader.view_data(size);
+
+    if (view) {
+        SharedMessage message = reader.get_message();
+        dst = make_shared<Array>(size, (uchar*) view, [message]() {});
+        dst->set_readonly(true);
+        return;
+    }
+
     dst = make_shared<Array>(size);
 
     reader.copy_data(dst->get_data(), size);
@@ -157,13 +301,56 @@ template<> inline void write(MessageWriter& writer, const SharedArray& src) {
     
     writer.write<size_t>(src->get_size());
 
-    writer.write_buffer(src->get_data(), src->get_size());
+    // Tensor views passed as arrays are gathered in order of their elements
+    SharedTensor tensor = std::dynamic_pointer_cast<Tensor>(src);
+
+    if (tensor && !tensor->is_contiguous()) {
+
+        TensorBuffer buffer(tensor);
+
+        for (size_t i = 0; i < buffer.get_segments(); i++) {
+            writer.write_buffer(buffer.get_segment(i), buffer.get_segment_length());
+        }
+
+        return;
+    }
+
+    writer.write_buffer(src->get_const_data(), src->get_size());
+
+}
+
+inline void write_tensor_header(MessageWriter& writer, const SharedTensor& src) {
+
+    writer.write<size_t>(((size_t) src->ndims() << 8) | TENSOR_ENCODING_ALIGNED);
+    writer.write<uint8_t>(0);
+
+    for (size_t i = 0; i < src->ndims(); i++) {
+        writer.write<size_t>(src->shape(i));
+    }
+
+    writer.write<uint8_t>((uint8_t) src->get_type());
+
+    // Padding places tensor data at an aligned position relative to the start of the message
+    size_t position = writer.get_length() + sizeof(uint8_t);
+    uint8_t padding = (ROUTIO_ALIGNMENT - position % ROUTIO_ALIGNMENT) % ROUTIO_ALIGNMENT;
+
+    uchar zeros[ROUTIO_ALIGNMENT] = {0};
+
+    writer.write<uint8_t>(padding);
+    writer.write_buffer(zeros, padding);
 
 }
 
 template<> inline void read(MessageReader& reader, SharedTensor& dst) {
 
-    uint8_t ndim = reader.read<size_t>(); 
+    size_t header = reader.read<size_t>();
+
+    uint8_t ndim = header;
+
+    if (header & TENSOR_ENCODING_ALIGNED) {
+        ndim = header >> 8;
+        if (reader.read<uint8_t>() != 0) throw ParseException();
+    }
 
     std::vector<size_t> dimensions;
 
@@ -173,6 +360,31 @@ template<> inline void read(MessageReader& reader, SharedTensor& dst) {
 
     DataType type = (DataType) reader.read<uint8_t>(); 
 
+    // Tensors encoded without alignment have no padding
+    if (header & TENSOR_ENCODING_ALIGNED) {
+        uchar padding[ROUTIO_ALIGNMENT];
+        uint8_t length = reader.read<uint8_t>();
+        if (length > ROUTIO_ALIGNMENT) throw runtime_error("Illegal tensor padding");
+        if (length > 0) reader.copy_data(padding, length);
+    }
+
+    size_t size = Tensor::get_type_bytes(type);
+    for (auto d : dimensions) {
+        // Dimensions come from the sender, a size that wraps around would not cover the tensor
+        if (__builtin_mul_overflow(size, d, &size)) throw ParseException();
+    }
+    if (dimensions.empty()) size = 0;
+
+    // Received data is used in place, the tensor keeps the message alive
+    const uchar* view = reader.view_data(size);
+
+    if (view) {
+        SharedMessage message = reader.get_message();
+        dst = make_shared<Tensor>(dimensions, type, (uchar*) view, [message]() {});
+        dst->set_readonly(true);
+        return;
+    }
+
     dst = make_shared<Tensor>(dimensions, type);
 
     reader.copy_data(dst->get_data(), dst->get_size());
@@ -181,15 +393,18 @@ template<> inline void read(MessageReader& reader, SharedTensor& dst) {
 
 template<> inline void write(MessageWriter& writer, const SharedTensor& src) {
     
-    writer.write<size_t>((size_t) src->ndims());
+    write_tensor_header(writer, src);
 
-    for (size_t i = 0; i < src->ndims(); i++) {
-        writer.write<size_t>(src->shape(i));
+    if (src->is_contiguous()) {
+        writer.write_buffer(src->get_const_data(), src->get_size());
+        return;
     }
 
-    writer.write<uint8_t>((uint8_t) src->get_type());
+    TensorBuffer buffer(src);
 
-    writer.write_buffer(src->get_data(), src->get_size());
+    for (size_t i = 0; i < buffer.get_segments(); i++) {
+        writer.write_buffer(buffer.get_segment(i), buffer.get_segment_length());
+    }
 
 }
 
@@ -233,10 +448,13 @@ inline shared_ptr<SharedTensor> Message::unpack(SharedMessage message) {
 template<>
 inline shared_ptr<Message> Message::pack(const SharedTensor &data) {
 
+    MessageWriter header;
+
+    write_tensor_header(header, data);
+
     return make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{
-        ListBuffer<size_t>::wrap(data->dims()),
-        PrimitiveBuffer<uchar>::wrap(data->get_type()),
-        make_shared<ArrayBuffer>(data)
+        make_shared<BufferedMessage>(header),
+        data->is_contiguous() ? SharedBuffer(make_shared<ArrayBuffer>(data)) : SharedBuffer(make_shared<TensorBuffer>(data))
     });
 
 }
@@ -9,7 +9,13 @@
 #include <functional>
 #include <utility>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <span>
 #include <type_traits>
+#include <typeinfo>
+#include <typeindex>
+#include <vector>
 
 #include "loop.h"
 #include "message.h"
@@ -74,6 +80,9 @@ namespace routio
 {
 
     class Client;
+    class Multiplexer;
+    class Node;
+    class Executor;
     class Subscriber;
     class Publisher;
     class Watcher;
@@ -81,9 +90,26 @@ namespace routio
     typedef std::shared_ptr<Publisher> SharedPublisher;
     typedef std::shared_ptr<Watcher> SharedWatcher;
     typedef std::shared_ptr<Client> SharedClient;
+    typedef std::shared_ptr<Multiplexer> SharedMultiplexer;
+    typedef std::shared_ptr<Node> SharedNode;
+    typedef std::shared_ptr<Executor> SharedExecutor;
 
     typedef std::shared_ptr<std::function<void(SharedDictionary)>> WatchCallback;
     typedef std::shared_ptr<std::function<void(SharedMessage)>> DataCallback;
+    typedef std::shared_ptr<std::function<void(SharedMessage, size_t, size_t)>> StreamCallback;
+    typedef std::shared_ptr<std::function<void(std::shared_ptr<const void>)>> ObjectCallback;
+    typedef std::shared_ptr<std::function<void(span<SharedMessage>)>> BatchCallback;
+    typedef std::shared_ptr<std::function<void()>> FlushCallback;
+
+    /**
+     * Shared by callbacks bound to an object that may be released while they are pending. Callbacks
+     * hold the mutex while they run and do nothing once the object is no longer alive.
+     */
+    typedef struct Liveness
+    {
+        std::recursive_mutex mutex;
+        bool alive = false;
+    } Liveness;
 
     template <class F>
     DataCallback create_data_callback(F f)
@@ -97,14 +123,55 @@ namespace routio
         return WatchCallback(new std::function<void(SharedDictionary)>(f));
     }
 
+    template <class F>
+    StreamCallback create_stream_callback(F f)
+    {
+        return StreamCallback(new std::function<void(SharedMessage, size_t, size_t)>(f));
+    }
+
+    template <class F>
+    ObjectCallback create_object_callback(F f)
+    {
+        return ObjectCallback(new std::function<void(std::shared_ptr<const void>)>(f));
+    }
+
+    template <class F>
+    BatchCallback create_batch_callback(F f)
+    {
+        return BatchCallback(new std::function<void(span<SharedMessage>)>(f));
+    }
+
+    template <class F>
+    FlushCallback create_flush_callback(F f)
+    {
+        return FlushCallback(new std::function<void()>(f));
+    }
+
     class Client : public IOBase
     {
         friend Subscriber;
         friend Publisher;
         friend Watcher;
+        friend Multiplexer;
+        friend class ChannelLookup;
+        friend class Service;
+        friend class ServiceClient;
+        friend class StateChannel;
 
     public:
         Client(const string &name = "", const string &address = "");
+
+        /**
+         * Creates a client in the same process as the router that exchanges messages with it through
+         * the given queues of incoming and outgoing messages, see Server::connect_local.
+         */
+        Client(const string &name, pair<SharedMessageQueue, SharedMessageQueue> queues);
+
+        /**
+         * Creates a logical client that shares the connection of the multiplexer with other
+         * clients, see Multiplexer::connect.
+         */
+        Client(const string &name, SharedMultiplexer multiplexer, int logical_id);
         virtual ~Client();
 
         virtual bool handle_input();
@@ -119,13 +186,60 @@ namespace routio
 
         virtual int get_file_descriptor();
 
+        /**
+         * Logical clients are handled by the loop of their multiplexer.
+         */
+        virtual SharedIOLoop get_loop();
+
+        /**
+         * Runs subscription callbacks on the executor instead of the loop. Messages of a channel are
+         * queued in a bounded mailbox with the given capacity and queue policy (see NODE_QUEUE_DROP)
+         * and processed in order, different channels are processed in parallel. Releasing a subscriber
+         * waits until its callback returns, messages that are still queued are discarded. An empty
+         * executor restores delivery from the loop.
+         */
+        void set_executor(SharedExecutor executor, size_t capacity = 16, int policy = 0);
+
     protected:
-        bool unsubscribe(int channel, const DataCallback &callback);
-        bool subscribe(int channel, const DataCallback &callback);
+        /**
+         * Options with a service role subscribe or unsubscribe the role even if the client has
+         * other subscriptions to the channel.
+         */
+        bool unsubscribe(int channel, const DataCallback &callback, const SharedDictionary options = SharedDictionary());
+        bool subscribe(int channel, const DataCallback &callback, const SharedDictionary options = SharedDictionary());
         bool watch(int channel, const WatchCallback &callback);
         bool unwatch(int channel, const WatchCallback &callback);
-        void send(int channel, SharedMessage message, MessageCallback callback = NULL, int priority = 0);
+        void send(int channel, SharedMessage message, MessageCallback callback = NULL, int priority = 0, int target = -1);
         void lookup_channel(const string &alias, const string &type, function<void(SharedDictionary)> callback, bool create = true);
+        void configure(int channel, const SharedDictionary options);
+
+        /**
+         * Registers a callback that receives objects of the given type published on the channel
+         * by publishers of this client directly, without serialization. The data callback is the
+         * subscription that would otherwise receive the same messages through the router.
+         */
+        bool subscribe_object(int channel, const std::type_info &type, const ObjectCallback &callback, const DataCallback &data);
+        bool unsubscribe_object(int channel, const ObjectCallback &callback);
+
+        /**
+         * Finds object callbacks of the given type on the channel and data callbacks that are not
+         * covered by them. Returns false if the number of subscribers in the router is not known yet,
+         * otherwise sets remote to the number of subscribers that are not this client.
+         */
+        bool find_local(int channel, const std::type_info &type, vector<ObjectCallback> &objects, vector<DataCallback> &others, int &remote);
+
+        /**
+         * Delivers an object to object callbacks and its frame to other callbacks of this client, through
+         * the mailbox of the channel if messages are handled by an executor. The frame may be empty.
+         */
+        void deliver_local(int channel, const vector<ObjectCallback> &objects, shared_ptr<const void> object, const vector<DataCallback> &others, SharedMessage frame);
+
+        /**
+         * Registers a callback that is called after all messages of the channel that were available
+         * when reading from the connection were delivered.
+         */
+        bool subscribe_flush(int channel, const FlushCallback &callback);
+        bool unsubscribe_flush(int channel, const FlushCallback &callback);
 
     private:
         static const int TYPE_LOCAL;
@@ -135,26 +249,139 @@ namespace routio
 
         void send_command(SharedDictionary command, function<bool(SharedDictionary, SharedDictionary)> callback = NULL);
 
+        SharedDictionary lookup_command(const string &alias, const string &type, bool create);
+
         bool handle_subscribe_response(SharedDictionary sent, SharedDictionary received);
+        void handle_frame(SharedMessage frame);
         void handle_message(int channel, SharedMessage &message);
+        // Called with the lock held, returns latched frames that the new callback has to receive in replay
+        bool subscribe_locked(int channel, const DataCallback &callback, const SharedDictionary options, vector<SharedMessage> &replay);
+        void dispatch(int channel, const set<DataCallback> &callbacks, SharedMessage message);
+        void dispatch_local(int channel, const vector<ObjectCallback> &objects, shared_ptr<const void> object, const vector<DataCallback> &others, SharedMessage frame);
+        SharedNode get_mailbox(int channel);
+        // Runs the task like a callback of the channel, in its mailbox if an executor is used
+        void dispatch_task(int channel, function<void()> task);
+        // Sampling interval the router confirmed for the subscription to the channel
+        int get_sample(int channel);
+        void end_input();
+        void complete_sent();
 
         int fd;
         bool connected;
-        StreamWriter writer;
-        StreamReader reader;
+        // Only allocated for socket connections
+        unique_ptr<StreamWriter> writer;
+        unique_ptr<StreamReader> reader;
+
+        SharedMessageQueue incoming;
+        SharedMessageQueue outgoing;
+
+        // Send callbacks of local connections, reported by the router thread and called from the loop of the client
+        std::mutex sent_mutex;
+        vector<function<void()>> sent;
+
+        SharedMultiplexer multiplexer;
+        int logical_id;
 
         int next_request_key;
 
+        // Identifiers of service calls, unique for all service clients of the connection
+        std::atomic<int64_t> next_call;
+
         map<int, pair<SharedDictionary, function<bool(SharedDictionary, SharedDictionary)>>> requests;
 
         map<int, set<DataCallback>> subscriptions;
+        // Channels with a subscription confirmed by the router, these are counted in the number of subscribers
+        set<int> confirmed;
+        // Sampling intervals of confirmed subscriptions, the router applies them to all subscribers of the connection
+        map<int, int> samples;
+        map<int, map<ObjectCallback, pair<std::type_index, DataCallback>>> objects;
+        // Last message on latched channels, replayed to local subscribers that join later
+        map<int, MessageCache> latched;
+        map<int, set<FlushCallback>> flushes;
+        // Channels with flush callbacks that received messages since the last flush
+        set<int> received;
         map<int, set<WatchCallback>> watches;
+        // Last event received for each watched channel, replayed to watchers that join later
+        map<int, SharedDictionary> watch_state;
 
         map<string, string> mappings;
+
+        SharedExecutor executor;
+        size_t mailbox_capacity;
+        int mailbox_policy;
+        // Serializes callbacks of each channel when an executor is used
+        map<int, SharedNode> mailboxes;
     };
 
     SharedClient connect(const string &socket = string(), const string &name = string(), SharedIOLoop loop = default_loop());
 
+    /**
+     * Single connection to the router shared by many logical clients of a process. Each logical
+     * client has its own name, subscriptions and channels in the router, but they share socket
+     * buffers and the registration in the loop, where only the multiplexer is added. Callbacks of
+     * all logical clients are called from the loop of the multiplexer.
+     */
+    class Multiplexer : public IOBase
+    {
+        friend Client;
+
+    public:
+        Multiplexer(const string &address = "");
+        virtual ~Multiplexer();
+
+        /**
+         * Creates a new logical client, it is disconnected when released or when the
+         * multiplexer is disconnected.
+         */
+        SharedClient connect(const string &name = string());
+
+        virtual bool handle_input();
+
+        virtual bool handle_output();
+
+        bool is_connected();
+
+        virtual void disconnect();
+
+        int get_queue_size();
+
+        virtual int get_file_descriptor();
+
+    private:
+        // Sends a message of a logical client, an empty message closes the logical connection
+        void send(int logical_id, SharedMessage message, MessageCallback callback = NULL, int priority = 0);
+
+        void detach(int logical_id);
+
+        int fd;
+        bool connected;
+        StreamWriter writer;
+        StreamReader reader;
+
+        int next_logical_id;
+
+        map<int, weak_ptr<Client>> clients;
+    };
+
+    SharedMultiplexer multiplex(const string &socket = string(), SharedIOLoop loop = default_loop());
+
+// Upper bound for memory reserved by partially received chunked messages
+#define DEFAULT_PENDING_LIMIT 1024 * 1024 * 256
+// Time in milliseconds after which an incomplete chunked message is discarded
+#define DEFAULT_PENDING_TIMEOUT 5000
+// Largest chunked message that is accepted, its buffer is allocated when the first chunk arrives
+#define DEFAULT_MESSAGE_LIMIT 1024 * 1024 * 1024
+
+    typedef struct SubscriberStatistics {
+        uint64_t messages_received;
+        // Messages missing from the channel sequence, dropped by the router or never received
+        uint64_t messages_lost;
+        // Chunked messages that were discarded before they were complete
+        uint64_t messages_dropped;
+        uint64_t messages_reordered;
+        uint64_t gaps;
+    } SubscriberStatistics;
+
     class Subscriber
     {
         friend Client;
@@ -172,9 +399,99 @@ namespace routio
 
         bool unsubscribe();
 
+        /**
+         * Requests delivery of messages kept in the channel history before live messages,
+         * either the last count messages or all messages with sequence number greater than
+         * the given one. Only applies to subscriptions made after the call and only if this
+         * client is not already subscribed to the channel.
+         */
+        void request_history(size_t count);
+
+        void request_history_since(int64_t sequence);
+
+        /**
+         * Requests only the first bytes of each message, the router delivers at most the first chunk
+         * of chunked messages. Useful for monitoring rate and bandwidth of channels with large messages
+         * without transferring them. The original length is available through get_message_length.
+         * Like history, the request only applies to the first subscription to a channel on a connection.
+         */
+        void request_truncated(size_t bytes);
+
+        /**
+         * Requests only every n-th message of the channel, other messages are not counted as lost.
+         * Like history, the request only applies to the first subscription to a channel on a connection,
+         * messages are counted as lost according to the interval the router confirmed.
+         */
+        void request_sampled(int interval);
+
+        /**
+         * Returns the channel sequence number of the message that is being delivered, valid during
+         * on_message, or -1 if the message is not part of the sequence (e.g. directed messages).
+         */
+        int64_t get_sequence() const;
+
+        /**
+         * Returns the sequence number of the last message received in the channel sequence, can be
+         * used to request the missed messages from the channel history after subscribing again.
+         */
+        int64_t get_last_sequence() const;
+
+        /**
+         * Returns the length of the message that is being delivered as it was sent by the publisher,
+         * this is larger than the received message if the subscription is truncated.
+         */
+        size_t get_message_length() const;
+
+        /**
+         * Sets the largest length of a chunked message, longer messages are dropped before their
+         * buffer is allocated. Zero disables the check.
+         */
+        void set_message_limit(size_t limit);
+
+        /**
+         * Sets the largest number of bytes reserved by chunked messages that are not complete yet,
+         * the least recently updated ones are dropped to make room. Zero disables the check.
+         */
+        void set_pending_limit(size_t limit);
+
+        SubscriberStatistics get_statistics() const;
+
     protected:
         virtual void on_ready();
 
+        virtual void data_callback(SharedMessage message);
+
+        // Records the arrival of the first frame of a message and updates gap statistics
+        void track_sequence(int64_t sequence);
+
+        /**
+         * Enables direct delivery of objects of the given type from publishers of the same client,
+         * these messages are then not received through the router.
+         */
+        void set_object_callback(const std::type_info &type, ObjectCallback callback);
+
+        /**
+         * Sets a callback that is called once all messages available on the connection were delivered.
+         */
+        void set_flush_callback(FlushCallback callback);
+
+        /**
+         * Runs the task in the same way as the callbacks of the subscription, i.e. on the executor of
+         * the client if it has one and only while the subscriber is subscribed.
+         */
+        void dispatch_task(function<void()> task);
+
+        SubscriberStatistics statistics;
+
+        // Sequence number and original length of the message that is being delivered
+        int64_t sequence = -1;
+
+        size_t message_length = 0;
+
+        // Callbacks may still be queued in a mailbox of an executor when the subscriber is released,
+        // they only run while the subscriber is subscribed and unsubscribing waits for a running one
+        shared_ptr<Liveness> liveness;
+
     private:
         DataCallback internal_callback;
 
@@ -182,31 +499,172 @@ namespace routio
 
         void lookup_callback(SharedDictionary lookup);
 
-        void data_callback(SharedMessage message);
-
         SharedClient client;
         int id = -1;
 
-        class ChunkList : public vector<SharedMessage>
+        SharedDictionary options;
+
+        int64_t last_sequence = -1;
+
+        const std::type_info *object_type = NULL;
+
+        ObjectCallback object_callback;
+
+        FlushCallback flush_callback;
+
+        /**
+         * Reassembles a chunked message in a single contiguous buffer that is allocated
+         * when the first chunk arrives. Chunks are copied into place as they are received
+         * so that the original frames can be released immediately.
+         */
+        class ChunkBuffer
         {
         public:
-            ChunkList(int length, int chunk_size);
+            ChunkBuffer(size_t length, size_t chunk_size, int64_t sequence = -1);
 
-            virtual ~ChunkList();
+            virtual ~ChunkBuffer();
 
-            bool set_chunk(int index, SharedMessage &message);
+            bool set_chunk(int index, SharedMessage &chunk);
 
             bool is_complete() const;
 
-            int chunks() const;
+            size_t get_length() const;
+
+            std::chrono::steady_clock::time_point get_updated() const;
+
+            SharedMessage get_message() const;
+
+            int64_t get_sequence() const;
 
         private:
-            int chunk_size;
+            shared_ptr<BufferedMessage> message;
+            int64_t sequence;
+            size_t chunk_size;
+            int chunks;
+            int next;
+            std::chrono::steady_clock::time_point updated;
         };
 
+        void evict_pending(size_t required);
+
+        // Drops messages that did not progress in time and waits for the next one to time out
+        void expire_pending();
+
         int pending_capacity;
 
-        map<int64_t, shared_ptr<ChunkList>> pending;
+        size_t pending_limit = DEFAULT_PENDING_LIMIT;
+
+        // Created with the first chunked message, incomplete messages time out without further traffic
+        SharedTimer pending_timer;
+
+        size_t pending_size = 0;
+
+        size_t message_limit = DEFAULT_MESSAGE_LIMIT;
+
+        map<int64_t, shared_ptr<ChunkBuffer>> pending;
+    };
+
+    /**
+     * Subscriber that hands over chunks of a message in order as they arrive instead of
+     * reassembling the whole message first. Each chunk is reported together with its offset
+     * and the total length of the message, messages sent in one piece arrive as a single chunk.
+     */
+    class StreamSubscriber : public Subscriber
+    {
+    public:
+        StreamSubscriber(SharedClient client, const string &alias, const string &type = string(), StreamCallback callback = NULL);
+
+        virtual ~StreamSubscriber();
+
+        virtual void on_chunk(SharedMessage chunk, size_t offset, size_t length);
+
+    protected:
+        virtual void data_callback(SharedMessage message);
+
+    private:
+        typedef struct StreamState
+        {
+            size_t length;
+            size_t chunk_size;
+            int next;
+            size_t offset;
+            int64_t sequence;
+            std::chrono::steady_clock::time_point updated;
+        } StreamState;
+
+        StreamCallback stream_callback;
+
+        map<int64_t, StreamState> streams;
+    };
+
+    /**
+     * Subscriber that delivers messages in batches. A batch contains the messages that were received
+     * in one read from the connection, at most batch_size of them. If max_wait is given, messages are
+     * collected over several reads until the batch is full or the first message has waited max_wait
+     * milliseconds. The loop is used to wait for the timeout.
+     */
+    class BatchSubscriber : public Subscriber
+    {
+    public:
+        BatchSubscriber(SharedClient client, const string &alias, const string &type = string(), BatchCallback callback = NULL,
+                        size_t batch_size = 64, int64_t max_wait = 0, SharedIOLoop loop = default_loop());
+
+        virtual ~BatchSubscriber();
+
+        virtual void on_message(SharedMessage message);
+
+        virtual void on_batch(span<SharedMessage> messages);
+
+        /**
+         * Delivers the messages collected so far.
+         */
+        void flush();
+
+        bool unsubscribe();
+
+    private:
+        BatchCallback callback;
+
+        size_t batch_size;
+
+        int64_t max_wait;
+
+        vector<SharedMessage> batch;
+
+        std::recursive_mutex batch_mutex;
+
+        SharedIOLoop loop;
+
+        SharedTimer timer;
+    };
+
+    /**
+     * Subscriber that does not call callbacks but keeps the latest received message, which other
+     * threads, e.g. a control loop running at its own rate, can read at any time without waiting
+     * for the loop. The message is kept in a std::atomic<shared_ptr>, which common standard
+     * libraries (e.g. libstdc++) protect with a short internal lock, so reading is not wait-free,
+     * and a reader that holds the last reference to a message releases it on its own thread.
+     */
+    class LatestSubscriber : public Subscriber
+    {
+    public:
+        LatestSubscriber(SharedClient client, const string &alias, const string &type = string());
+
+        virtual ~LatestSubscriber();
+
+        virtual void on_message(SharedMessage message);
+
+        SharedMessage get_latest() const;
+
+        /**
+         * Number of messages received so far, changes whenever the latest message does.
+         */
+        uint64_t get_received() const;
+
+    private:
+        std::atomic<SharedMessage> latest;
+
+        std::atomic<uint64_t> received;
     };
 
     class Watcher
@@ -237,6 +695,26 @@ namespace routio
     };
 
 #define DEFAULT_CHUNK_SIZE 1024 * 128
+// Default bounds for adaptive chunk size, chunks have to fit into MESSAGE_MAX_SIZE together with headers
+#define DEFAULT_MIN_CHUNK_SIZE 1024 * 16
+#define DEFAULT_MAX_CHUNK_SIZE 1024 * 768
+#define MAX_CHUNK_SIZE (MESSAGE_MAX_SIZE - 1024)
+// Time in microseconds that sending a single chunk should take at the observed throughput
+#define DEFAULT_CHUNK_TARGET_TIME 2000
+// Chunks of a streamed message that may wait to be sent before write() stops accepting data
+#define DEFAULT_STREAM_WINDOW 8
+
+    typedef struct PublisherStatistics {
+        uint64_t messages_sent;
+        uint64_t chunks_sent;
+        uint64_t data_sent;
+        uint64_t data_dropped;
+        size_t chunk_size;
+        // Estimated throughput in bytes per second
+        double throughput;
+        // Average time in seconds between queueing a chunk and writing it to the socket
+        double latency;
+    } PublisherStatistics;
 
     class Publisher
     {
@@ -251,9 +729,98 @@ namespace routio
 
         bool send_message(MessageWriter &writer);
 
+        /**
+         * Sends a message only to a single subscriber of the channel, identified by the
+         * subscriber field of the watch events.
+         */
+        bool send_message_to(int subscriber, MessageWriter &writer);
+
+        /**
+         * Starts a message of a known total length that is provided incrementally with write().
+         * Data is sent in chunks as soon as each chunk is filled, so the whole message is never
+         * held in memory. The message is complete once end() is called after exactly the
+         * announced number of bytes has been written.
+         */
+        bool begin_stream(size_t length);
+
+        /**
+         * Returns the number of bytes accepted. Fewer bytes are accepted if too many chunks of the
+         * stream are still waiting to be sent, the rest can be written after waiting on the loop.
+         * Nothing is accepted once a chunk of the stream was dropped, see is_stream_dropped.
+         */
+        size_t write(const uchar *data, size_t length);
+
+        size_t write(std::span<const uchar> data) { return write(data.data(), data.size()); }
+
+        /**
+         * Completes the stream, returns false if the stream is incomplete or any of its chunks was dropped.
+         */
+        bool end();
+
+        /**
+         * Sets the number of chunks of a streamed message that may wait to be sent.
+         */
+        void set_stream_window(int chunks);
+
+        bool is_streaming() const;
+
+        /**
+         * Whether a chunk of the current stream was dropped, e.g. because the outgoing queue overflowed.
+         * The stream cannot be completed then, writing more data is pointless.
+         */
+        bool is_stream_dropped() const;
+
+        /**
+         * Sets bounds for the chunk size. Within these bounds the chunk size is adapted to the
+         * observed send throughput so that writing a single chunk takes roughly the same time.
+         * Setting both bounds to the same value disables adaptation, which is the default, e.g.
+         * DEFAULT_MIN_CHUNK_SIZE and DEFAULT_MAX_CHUNK_SIZE enable it.
+         */
+        bool set_chunk_bounds(size_t minimum, size_t maximum);
+
+        size_t get_chunk_size() const;
+
+        PublisherStatistics get_statistics() const;
+
+        /**
+         * Number of subscribers on the channel as reported by the router, the publisher
+         * watches its own channel so this is kept up to date automatically.
+         */
+        int get_subscribers() const;
+
+        /**
+         * Sends a message produced by the given function only if there is demand for it, i.e.
+         * the channel has subscribers and the outgoing queue has room. Otherwise the function
+         * is not called at all, so expensive conversion or encoding is skipped.
+         */
+        bool send_lazy(function<SharedMessage()> producer);
+
+        /**
+         * Marks the channel as latched, the router then keeps the last message sent to it and
+         * delivers it to every new subscriber when it subscribes.
+         */
+        void set_latched(bool latched);
+
+        /**
+         * Enables a bounded history of messages on the channel in the router, limited by the
+         * number of messages, total size in bytes and age in milliseconds. A limit of zero is
+         * not enforced. Subscribers can request messages from the history when subscribing.
+         */
+        void set_history(size_t count, size_t bytes = 0, int64_t time = 0);
+
     protected:
         virtual void on_ready();
 
+        /**
+         * Called when a message has left the outgoing queue of the publisher, either sent or dropped.
+         */
+        virtual void on_sent();
+
+        /**
+         * Returns true if the outgoing queue of the publisher has room for another message.
+         */
+        bool has_credit() const;
+
         int get_channel_id();
 
         template <typename T>
@@ -266,18 +833,50 @@ namespace routio
             return send_message_internal(Message::pack<T>(data), get_channel_id());
         }
 
-        virtual bool send_message_internal(SharedMessage message, int channel);
+        template <typename T>
+        bool send_message_to(int subscriber, const T &data)
+        {
+
+            if (get_channel_id() <= 0 || subscriber < 0)
+                return false;
+
+            return send_message_internal(Message::pack<T>(data), get_channel_id(), subscriber);
+        }
+
+        virtual bool send_message_internal(SharedMessage message, int channel, int target = -1);
+
+        /**
+         * Sends an object, subscribers of the same client that accept objects of this type receive it
+         * directly. The message is serialized only if other subscribers need it and is only sent to the
+         * router if there are subscribers in other clients or the channel keeps messages.
+         */
+        bool send_object(const std::type_info &type, function<shared_ptr<const void>()> object, function<SharedMessage()> serialize);
 
     private:
         void lookup_callback(const string alias, SharedDictionary lookup);
 
-        void send_callback(const SharedMessage message, int state);
+        void watch_callback(SharedDictionary event);
+
+        void send_callback(const SharedMessage message, int state, std::chrono::steady_clock::time_point queued, bool last, int64_t stream = -1);
+
+        // Callback for a message that is queued now, it does nothing once the publisher is released
+        MessageCallback create_send_callback(bool last, int64_t stream = -1);
+
+        // Lookup, watch and send callbacks may arrive after the publisher is released
+        shared_ptr<Liveness> liveness;
 
         SharedClient client;
-        int id = -1;
+        std::atomic<int> id{-1};
         int queue;
 
-        int pending = 0;
+        // Credits are checked from other threads than the loop, e.g. by coroutines
+        std::atomic<int> pending{0};
+
+        std::atomic<int> subscribers{0};
+
+        SharedDictionary configuration;
+
+        WatchCallback demand_callback;
 
         class ProxyBuffer : public Buffer
         {
@@ -296,9 +895,31 @@ namespace routio
             size_t length;
         };
 
-        size_t chunk_size;
+        void send_chunk(int index, int64_t identifier, size_t length, size_t chunk_size, SharedBuffer data, bool last, int target = -1, bool stream = false);
+
+        bool flush_stream(bool force);
+
+        // Adapted on the loop thread and read by senders, bounds and statistics are guarded by the liveness mutex
+        std::atomic<size_t> chunk_size;
+        size_t min_chunk_size;
+        size_t max_chunk_size;
+
+        std::chrono::steady_clock::time_point last_sent;
+        PublisherStatistics statistics;
 
         function<int64_t()> identifier_generator;
+
+        bool streaming = false;
+        int64_t stream_identifier;
+        size_t stream_length;
+        size_t stream_position;
+        int stream_index;
+        size_t stream_chunk_size;
+        size_t stream_fill;
+        shared_ptr<MemoryBuffer> stream_buffer;
+        int stream_window = DEFAULT_STREAM_WINDOW;
+        std::atomic<int> stream_chunks{0};
+        std::atomic<bool> stream_dropped{false};
     };
 
     class SubscriptionWatcher : public Watcher
@@ -0,0 +1,403 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef ROUTIO_COROUTINE_HPP_
+#define ROUTIO_COROUTINE_HPP_
+
+#include <coroutine>
+#include <optional>
+#include <exception>
+#include <deque>
+
+#include <routio/client.h>
+#include <routio/datatypes.h>
+
+namespace routio {
+
+template <typename T = void> class Task;
+
+namespace detail {
+
+class TaskPromiseBase {
+public:
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    class FinalAwaiter {
+    public:
+        bool await_ready() noexcept { return false; }
+
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept {
+            TaskPromiseBase &promise = handle.promise();
+            if (promise.continuation)
+                return promise.continuation;
+            // Nobody owns a detached task, it releases itself when done
+            if (promise.detached)
+                handle.destroy();
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    std::coroutine_handle<> continuation;
+
+    std::exception_ptr exception;
+
+    bool detached = false;
+};
+
+template <typename T>
+class TaskResult : public TaskPromiseBase {
+public:
+    void return_value(T v) { value.emplace(std::move(v)); }
+
+    T result() {
+        if (exception)
+            std::rethrow_exception(exception);
+        return std::move(*value);
+    }
+
+private:
+    std::optional<T> value;
+};
+
+template <>
+class TaskResult<void> : public TaskPromiseBase {
+public:
+    void return_void() {}
+
+    void result() {
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+};
+
+}
+
+/**
+ * Coroutine that starts when it is awaited or when it is passed to spawn. Coroutines are resumed
+ * by the thread that completes the awaited operation, usually the one waiting on the loop.
+ */
+template <typename T>
+class Task {
+public:
+    class promise_type : public detail::TaskResult<T> {
+    public:
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    };
+
+    Task(Task &&other) : handle(other.handle) { other.handle = nullptr; }
+
+    Task(const Task &) = delete;
+
+    ~Task() {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool await_ready() const { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+        handle.promise().continuation = caller;
+        return handle;
+    }
+
+    T await_resume() { return handle.promise().result(); }
+
+    /**
+     * Starts the coroutine without waiting for its result, the coroutine is released when it
+     * finishes. Exceptions thrown by detached coroutines are ignored.
+     */
+    void detach() {
+        std::coroutine_handle<promise_type> h = handle;
+        handle = nullptr;
+        h.promise().detached = true;
+        h.resume();
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+template <typename T>
+void spawn(Task<T> task) {
+
+    task.detach();
+
+}
+
+/**
+ * Awaitable lookup of a channel, results in the response of the router which contains the
+ * channel identifier or an error.
+ */
+class ChannelLookup {
+public:
+    ChannelLookup(SharedClient client, const string &alias, const string &type = string(), bool create = true);
+
+    bool await_ready() const { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle);
+
+    SharedDictionary await_resume() { return result; }
+
+private:
+    SharedClient client;
+    string alias;
+    string type;
+    bool create;
+
+    std::coroutine_handle<> waiting;
+    SharedDictionary result;
+};
+
+inline ChannelLookup lookup(SharedClient client, const string &alias, const string &type = string(), bool create = true) {
+
+    return ChannelLookup(client, alias, type, create);
+
+}
+
+/**
+ * Subscriber for coroutines, messages are kept in a bounded queue until they are awaited with
+ * next(), the oldest ones are dropped when the queue is full. Only one coroutine can wait at a time.
+ */
+template <typename T>
+class AwaitableSubscriber {
+public:
+    AwaitableSubscriber(SharedClient client, const string &alias, size_t capacity = 16) : capacity(max<size_t>(capacity, 1)),
+        subscriber(client, alias, [this](shared_ptr<T> value) { receive(value); }) {
+
+    }
+
+    virtual ~AwaitableSubscriber() {}
+
+    class NextAwaiter {
+    public:
+        NextAwaiter(AwaitableSubscriber *subscriber) : subscriber(subscriber) {}
+
+        bool await_ready() {
+            std::lock_guard<std::mutex> lock(subscriber->mutex);
+            if (subscriber->messages.empty())
+                return false;
+            value = subscriber->messages.front();
+            subscriber->messages.pop_front();
+            return true;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            std::lock_guard<std::mutex> lock(subscriber->mutex);
+            // A message may have arrived in the meantime
+            if (!subscriber->messages.empty()) {
+                value = subscriber->messages.front();
+                subscriber->messages.pop_front();
+                return false;
+            }
+            subscriber->waiting = handle;
+            subscriber->waiter = this;
+            return true;
+        }
+
+        shared_ptr<T> await_resume() { return value; }
+
+    private:
+        friend AwaitableSubscriber;
+
+        AwaitableSubscriber *subscriber;
+        shared_ptr<T> value;
+    };
+
+    NextAwaiter next() { return NextAwaiter(this); }
+
+    size_t get_dropped() const { return dropped; }
+
+private:
+    void receive(shared_ptr<T> value) {
+
+        std::coroutine_handle<> handle;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (!waiting) {
+                if (messages.size() >= capacity) {
+                    messages.pop_front();
+                    dropped++;
+                }
+                messages.push_back(value);
+                return;
+            }
+
+            handle = waiting;
+            waiter->value = value;
+            waiting = nullptr;
+            waiter = NULL;
+        }
+
+        handle.resume();
+
+    }
+
+    size_t capacity;
+
+    size_t dropped = 0;
+
+    std::mutex mutex;
+
+    deque<shared_ptr<T>> messages;
+
+    std::coroutine_handle<> waiting;
+
+    NextAwaiter *waiter = NULL;
+
+    TypedSubscriber<T> subscriber;
+};
+
+/**
+ * Publisher for coroutines. Each message takes one credit from the outgoing queue of the
+ * publisher, sending suspends until a credit is returned when a previous message leaves the queue.
+ */
+template <typename T>
+class AwaitablePublisher : public Publisher {
+public:
+    AwaitablePublisher(SharedClient client, const string &alias, int credits = 1) : Publisher(client, alias, get_type_identifier<T>(), max(credits, 1)) {
+
+    }
+
+    virtual ~AwaitablePublisher() {}
+
+    class ReadyAwaiter {
+    public:
+        ReadyAwaiter(AwaitablePublisher *publisher) : publisher(publisher) {}
+
+        bool await_ready() const { return publisher->get_channel_id() > 0; }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            std::lock_guard<std::recursive_mutex> lock(publisher->waiting_mutex);
+            // The channel may have become known in the meantime
+            if (publisher->get_channel_id() > 0)
+                return false;
+            publisher->waiting_ready = handle;
+            return true;
+        }
+
+        void await_resume() const {}
+
+    private:
+        AwaitablePublisher *publisher;
+    };
+
+    class SendAwaiter {
+    public:
+        SendAwaiter(AwaitablePublisher *publisher, const T &value) : publisher(publisher), value(value), result(false) {}
+
+        bool await_ready() {
+            // Messages cannot be sent before the channel is known
+            if (publisher->get_channel_id() <= 0)
+                return true;
+            if (!publisher->has_credit())
+                return false;
+            result = publisher->send_value(value);
+            return true;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            {
+                std::lock_guard<std::recursive_mutex> lock(publisher->waiting_mutex);
+                // A credit may have been returned in the meantime
+                if (!publisher->has_credit()) {
+                    publisher->waiting_send = handle;
+                    publisher->sender = this;
+                    return true;
+                }
+            }
+            result = publisher->send_value(value);
+            return false;
+        }
+
+        bool await_resume() const { return result; }
+
+    private:
+        friend AwaitablePublisher;
+
+        AwaitablePublisher *publisher;
+        const T &value;
+        bool result;
+    };
+
+    /**
+     * Waits until the channel is known and messages can be sent.
+     */
+    ReadyAwaiter ready() { return ReadyAwaiter(this); }
+
+    SendAwaiter send(const T &value) { return SendAwaiter(this, value); }
+
+    using Publisher::get_subscribers;
+
+    using Publisher::get_statistics;
+
+protected:
+    virtual void on_ready() {
+
+        std::coroutine_handle<> handle;
+
+        {
+            std::lock_guard<std::recursive_mutex> lock(waiting_mutex);
+
+            if (!waiting_ready)
+                return;
+
+            handle = waiting_ready;
+            waiting_ready = nullptr;
+        }
+
+        handle.resume();
+
+    }
+
+    virtual void on_sent() {
+
+        std::coroutine_handle<> handle;
+        SendAwaiter *awaiter;
+
+        {
+            std::lock_guard<std::recursive_mutex> lock(waiting_mutex);
+
+            if (!waiting_send || !has_credit())
+                return;
+
+            handle = waiting_send;
+            awaiter = sender;
+            waiting_send = nullptr;
+            sender = NULL;
+        }
+
+        awaiter->result = send_value(awaiter->value);
+        handle.resume();
+
+    }
+
+private:
+    bool send_value(const T &value) {
+
+        return Publisher::send_object(typeid(T), [&value]() { return make_shared<const T>(value); }, [&value]() { return Message::pack<T>(value); });
+
+    }
+
+    // Guards the waiting coroutines, which are resumed from the loop
+    std::recursive_mutex waiting_mutex;
+
+    std::coroutine_handle<> waiting_ready;
+
+    std::coroutine_handle<> waiting_send;
+
+    SendAwaiter *sender = NULL;
+};
+
+}
+
+#endif
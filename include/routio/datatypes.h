@@ -4,6 +4,9 @@
 #define ROUTIO_DATATYPES_HPP_
 
 #include <chrono>
+#include <cstring>
+#include <type_traits>
+#include <variant>
 
 #include <routio/client.h>
 #include <routio/message.h>
@@ -15,12 +18,37 @@ template<typename T> string get_type_identifier();
 template <typename T>
 class TypedSubscriber : Subscriber {
   public:
-    TypedSubscriber(SharedClient client, const string &alias, function<void(shared_ptr<T>)> callback) : Subscriber(client, alias, get_type_identifier<T>()), callback(callback) {
+    /**
+     * Callbacks that accept shared_ptr<const T> share objects sent by publishers of the same client
+     * with the publisher and other subscribers, callbacks that accept shared_ptr<T> receive a copy.
+     */
+    template <typename F>
+    TypedSubscriber(SharedClient client, const string &alias, F callback) : Subscriber(client, alias, get_type_identifier<T>()) {
+
+        if constexpr (std::is_invocable_v<F, shared_ptr<const T>>) {
+
+            this->shared = callback;
+
+            Subscriber::set_object_callback(typeid(T), create_object_callback([this](shared_ptr<const void> object) {
+                this->shared(static_pointer_cast<const T>(object));
+            }));
+
+        } else {
+
+            this->callback = callback;
+
+            Subscriber::set_object_callback(typeid(T), create_object_callback([this](shared_ptr<const void> object) {
+                this->callback(make_shared<T>(*static_pointer_cast<const T>(object)));
+            }));
+
+        }
 
     }
 
     virtual ~TypedSubscriber() {
 
+        Subscriber::unsubscribe();
+
     }
 
     virtual void on_message(SharedMessage message) {
@@ -29,7 +57,10 @@ class TypedSubscriber : Subscriber {
 
             shared_ptr<T> data = Message::unpack<T>(message);
 
-            callback(data);
+            if (shared)
+                shared(data);
+            else
+                callback(data);
 
         } catch (routio::ParseException &e) {
             Subscriber::on_error(e);
@@ -37,9 +68,188 @@ class TypedSubscriber : Subscriber {
 
     };
 
+    using Subscriber::request_history;
+
+    using Subscriber::request_history_since;
+
   private:
     function<void(shared_ptr<T>)> callback;
 
+    function<void(shared_ptr<const T>)> shared;
+
+};
+
+/**
+ * Typed variant of BatchSubscriber, messages that cannot be decoded are reported to on_error and
+ * left out of the batch.
+ */
+template <typename T>
+class TypedBatchSubscriber : BatchSubscriber {
+  public:
+    TypedBatchSubscriber(SharedClient client, const string &alias, function<void(vector<shared_ptr<T>>&)> callback, size_t batch_size = 64, int64_t max_wait = 0, SharedIOLoop loop = default_loop()) :
+        BatchSubscriber(client, alias, get_type_identifier<T>(), NULL, batch_size, max_wait, loop), callback(callback) {
+
+    }
+
+    virtual ~TypedBatchSubscriber() {
+
+        BatchSubscriber::unsubscribe();
+
+    }
+
+    virtual void on_batch(span<SharedMessage> messages) {
+
+        vector<shared_ptr<T>> data;
+        data.reserve(messages.size());
+
+        for (auto message : messages) {
+            try {
+                data.push_back(Message::unpack<T>(message));
+            } catch (routio::ParseException &e) {
+                Subscriber::on_error(e);
+            }
+        }
+
+        if (!data.empty())
+            callback(data);
+
+    }
+
+    using BatchSubscriber::flush;
+
+  private:
+    function<void(vector<shared_ptr<T>>&)> callback;
+
+};
+
+/**
+ * Slot with a single writer that readers copy a value from without locks, a reader retries if the
+ * value is overwritten while it is copied. Only used for trivially copyable values.
+ */
+template <typename T>
+class LatestSlot {
+    static_assert(std::is_trivially_copyable<T>::value, "Values in a slot have to be trivially copyable");
+  public:
+    void write(const T &value) {
+
+        uint64_t sequence = this->sequence.load(std::memory_order_relaxed);
+
+        this->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        memcpy(data, &value, sizeof(T));
+
+        this->sequence.store(sequence + 2, std::memory_order_release);
+
+    }
+
+    bool read(T &value) const {
+
+        while (true) {
+
+            uint64_t before = sequence.load(std::memory_order_acquire);
+
+            if (before == 0)
+                return false;
+
+            if (before & 1)
+                continue;
+
+            memcpy(&value, data, sizeof(T));
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (sequence.load(std::memory_order_relaxed) == before)
+                return true;
+
+        }
+
+    }
+
+  private:
+    // Odd while the value is being written
+    std::atomic<uint64_t> sequence{0};
+
+    alignas(T) uchar data[sizeof(T)];
+};
+
+/**
+ * Typed variant of LatestSubscriber, messages are decoded on the loop so that readers only
+ * take the latest object. Objects are shared between readers and must not be modified.
+ * Values of trivially copyable types can also be copied with read, which does not touch the
+ * shared object at all, see LatestSubscriber for the limitations of get_latest.
+ */
+template <typename T>
+class TypedLatestSubscriber : Subscriber {
+  public:
+    TypedLatestSubscriber(SharedClient client, const string &alias) : Subscriber(client, alias, get_type_identifier<T>()), received(0) {
+
+        Subscriber::set_object_callback(typeid(T), create_object_callback([this](shared_ptr<const void> object) {
+            store(static_pointer_cast<const T>(object));
+        }));
+
+    }
+
+    virtual ~TypedLatestSubscriber() {
+
+        Subscriber::unsubscribe();
+
+    }
+
+    virtual void on_message(SharedMessage message) {
+
+        try {
+
+            store(Message::unpack<T>(message));
+
+        } catch (routio::ParseException &e) {
+            Subscriber::on_error(e);
+        }
+
+    }
+
+    shared_ptr<const T> get_latest() const {
+
+        return latest.load(std::memory_order_acquire);
+
+    }
+
+    /**
+     * Copies the latest value, returns false if nothing was received yet. Never waits for the loop
+     * and never releases an object, only available for trivially copyable types.
+     */
+    bool read(T &value) const {
+
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be read");
+
+        return slot.read(value);
+
+    }
+
+    uint64_t get_received() const {
+
+        return received.load(std::memory_order_acquire);
+
+    }
+
+  private:
+    void store(shared_ptr<const T> value) {
+
+        if constexpr (std::is_trivially_copyable<T>::value)
+            slot.write(*value);
+
+        latest.store(value, std::memory_order_release);
+        received.fetch_add(1, std::memory_order_release);
+
+    }
+
+    std::atomic<shared_ptr<const T>> latest;
+
+    // Copy of the value for readers that must not wait, only kept for trivially copyable types
+    std::conditional_t<std::is_trivially_copyable<T>::value, LatestSlot<T>, std::monostate> slot;
+
+    std::atomic<uint64_t> received;
+
 };
 
 template <typename T>
@@ -55,7 +265,56 @@ class TypedPublisher : Publisher {
 
     bool send(const T &data) {
 
-        return Publisher::send_message<T>(data);
+        if (get_channel_id() <= 0)
+            return false;
+
+        return Publisher::send_object(typeid(T), [&data]() { return make_shared<const T>(data); }, [&data]() { return Message::pack<T>(data); });
+
+    }
+
+    /**
+     * Sends a shared object, subscribers of the same client receive it without a copy.
+     */
+    bool send(shared_ptr<const T> data) {
+
+        if (get_channel_id() <= 0 || !data)
+            return false;
+
+        return Publisher::send_object(typeid(T), [data]() { return data; }, [data]() { return Message::pack<T>(*data); });
+
+    }
+
+    bool send_to(int subscriber, const T &data) {
+
+        return Publisher::send_message_to<T>(subscriber, data);
+
+    }
+
+    bool send_lazy(function<T()> producer) {
+
+        return Publisher::send_lazy([&producer]() { return Message::pack<T>(producer()); });
+
+    }
+
+    using Publisher::get_subscribers;
+
+    using Publisher::get_statistics;
+
+    using Publisher::set_latched;
+
+    using Publisher::set_history;
+
+  protected:
+    TypedPublisher(SharedClient client, const string &alias, const string &type, int queue) : Publisher(client, alias, type, queue) {
+
+    }
+
+    bool send_raw(SharedMessage message, int subscriber = -1) {
+
+        if (get_channel_id() <= 0)
+            return false;
+
+        return Publisher::send_message_internal(message, get_channel_id(), subscriber);
 
     }
 
@@ -111,7 +370,7 @@ inline void write(MessageWriter& writer, const Header& header) {
 
 
 
-template <> inline string get_type_identifier<Dictionary>();
+template <> string get_type_identifier<Dictionary>();
 
 template<> shared_ptr<Message> Message::pack(const Dictionary&);
 template<> shared_ptr<Message> Message::pack(const Header&);
@@ -8,11 +8,12 @@
 
 namespace routio {
 
-template<typename T> class StaticPublisher: public TypedPublisher<T>, public Watcher, public std::enable_shared_from_this<StaticPublisher<T> > {
+template<typename T> class StaticPublisher: public TypedPublisher<T>, public std::enable_shared_from_this<StaticPublisher<T> > {
 public:
-    StaticPublisher(SharedClient client, const string &alias, T& value) : TypedPublisher<T>(client, alias), Watcher(client, alias), value(value) {
+    StaticPublisher(SharedClient client, const string &alias, T& value) : TypedPublisher<T>(client, alias), value(value) {
 
-        subscribers = 0;
+        // The router keeps the value and delivers it to every new subscriber
+        TypedPublisher<T>::set_latched(true);
 
     }
 
@@ -20,32 +21,58 @@ public:
 
     virtual ~StaticPublisher() {}
 
-    virtual void on_event(SharedDictionary message) {
-        string type = message->get<string>("type", "");
+protected:
+
+    virtual void on_ready() {
+
+        send(value);
 
-        if (type == "subscribe" || type == "unsubscribe" || type == "summary") {
-            int s = message->get<int>("subscribers", 0);
-            if (s > subscribers) {
-                send(value);
-            }
-            subscribers = s;
-        }
     }
 
 private:
 
-    int subscribers;
-
     T value;
 
 };
 
+// Suffix of the channel type for objects published incrementally
+#define OBJECT_DELTA_TYPE " delta"
+// Number of patches after which a full snapshot is sent again
+#define OBJECT_KEYFRAME_INTERVAL 100
+
+#define OBJECT_SNAPSHOT 0
+#define OBJECT_PATCH 1
+
+/**
+ * Encodes the difference between two serialized versions of an object as a list of replaced
+ * byte ranges. Buffers of equal length are compared byte by byte so that scattered changes in
+ * fixed size structures are encoded separately, otherwise the changed range between the common
+ * prefix and suffix is replaced.
+ */
+void write_patch(MessageWriter &writer, const vector<uchar> &previous, const vector<uchar> &current);
+
+/**
+ * Applies a patch written by write_patch to the buffer, returns false if the patch is malformed.
+ */
+bool read_patch(MessageReader &reader, vector<uchar> &buffer);
+
+vector<uchar> serialize_message(const SharedMessage message);
+
 template<typename T> class ObjectPublisher: public TypedPublisher<T>, public Watcher, public std::enable_shared_from_this<ObjectPublisher<T> > {
 public:
-    ObjectPublisher(SharedClient client, const string &alias, T& value) : TypedPublisher<T>(client, alias), Watcher(client, alias), value(value) {
+    /**
+     * In incremental mode new subscribers receive a snapshot of the object and updates are sent
+     * as binary patches against the previous version, ObjectSubscriber reconstructs the object.
+     */
+    ObjectPublisher(SharedClient client, const string &alias, T& value, bool incremental = false) :
+        TypedPublisher<T>(client, alias, get_type_identifier<T>() + (incremental ? OBJECT_DELTA_TYPE : ""), -1), Watcher(client, alias),
+        value(value), incremental(incremental), version(0), patches(0) {
 
         subscribers = 0;
 
+        if (incremental)
+            state = serialize_message(Message::pack<T>(value));
+
     }
 
     using TypedPublisher<T>::send;
@@ -56,9 +83,21 @@ public:
         string type = message->get<string>("type", "");
 
         if (type == "subscribe" || type == "unsubscribe" || type == "summary") {
+            // Events arrive on the loop thread while the object may be updated on another one
+            SYNCHRONIZED(mutex);
             int s = message->get<int>("subscribers", 0);
-            if (s > subscribers) {
-                send(value);
+            int subscriber = message->get<int>("subscriber", -1);
+            if (type == "subscribe" && subscriber >= 0) {
+                // Only the new subscriber needs the current value
+                if (incremental)
+                    send_snapshot(subscriber);
+                else
+                    TypedPublisher<T>::send_to(subscriber, value);
+            } else if (s > subscribers) {
+                if (incremental)
+                    send_snapshot();
+                else
+                    send(value);
             }
             subscribers = s;
         }
@@ -66,18 +105,132 @@ public:
 
     void update(T& new_value) {
 
+        SYNCHRONIZED(mutex);
+
         value = new_value;
 
-        send(value);
+        if (!incremental) {
+            send(value);
+            return;
+        }
+
+        vector<uchar> current = serialize_message(Message::pack<T>(value));
+
+        version++;
+
+        MessageWriter writer;
+        writer.write_char(OBJECT_PATCH);
+        writer.write_long(version);
+        write_patch(writer, state, current);
+
+        state.swap(current);
+
+        // Patches are only useful if they are smaller than the object
+        if (++patches >= OBJECT_KEYFRAME_INTERVAL || writer.get_length() >= state.size()) {
+            send_snapshot();
+            return;
+        }
+
+        TypedPublisher<T>::send_raw(make_shared<BufferedMessage>(writer));
 
     }
 
 private:
 
+    // Called with the mutex held, so that the version matches the state and the patches that follow
+    void send_snapshot(int subscriber = -1) {
+
+        MessageWriter writer(state.size() + sizeof(char) + sizeof(int64_t));
+        writer.write_char(OBJECT_SNAPSHOT);
+        writer.write_long(version);
+        writer.write_buffer(state.data(), state.size());
+
+        if (subscriber < 0)
+            patches = 0;
+
+        TypedPublisher<T>::send_raw(make_shared<BufferedMessage>(writer), subscriber);
+
+    }
+
     int subscribers;
 
     T value;
 
+    bool incremental;
+
+    int64_t version;
+
+    int patches;
+
+    vector<uchar> state;
+
+    std::recursive_mutex mutex;
+
+};
+
+/**
+ * Receives objects published by an incremental ObjectPublisher, keeps the current serialized
+ * state and applies patches to it. Patches that do not follow the current version are ignored
+ * until the next snapshot arrives.
+ */
+template<typename T> class ObjectSubscriber : public Subscriber {
+public:
+    ObjectSubscriber(SharedClient client, const string &alias, function<void(shared_ptr<T>)> callback) :
+        Subscriber(client, alias, get_type_identifier<T>() + OBJECT_DELTA_TYPE), callback(callback), version(-1) {
+
+    }
+
+    virtual ~ObjectSubscriber() {}
+
+    virtual void on_message(SharedMessage message) {
+
+        try {
+
+            MessageReader reader(message);
+
+            char kind = reader.read_char();
+            int64_t v = reader.read_long();
+
+            if (kind == OBJECT_SNAPSHOT) {
+                state.resize(message->get_length() - reader.get_position());
+                reader.copy_data(state.data(), state.size());
+            } else if (kind == OBJECT_PATCH) {
+                if (version < 0 || v != version + 1)
+                    return;
+                if (!read_patch(reader, state)) {
+                    version = -1;
+                    return;
+                }
+            } else return;
+
+            version = v;
+
+            // Copy the state so that the unpacked object does not depend on it
+            shared_ptr<BufferedMessage> copy = make_shared<BufferedMessage>(state.size());
+            memcpy(copy->get_buffer(), state.data(), state.size());
+
+            callback(Message::unpack<T>(copy));
+
+        } catch (routio::ParseException &e) {
+            Subscriber::on_error(e);
+        } catch (routio::EndOfBufferException &e) {
+            Subscriber::on_error(e);
+        }
+
+    }
+
+    int64_t get_version() const {
+        return version;
+    }
+
+private:
+
+    function<void(shared_ptr<T>)> callback;
+
+    int64_t version;
+
+    vector<uchar> state;
+
 };
 
 }
@@ -9,6 +9,9 @@
 #include <utility>
 #include <memory>
 #include <mutex>
+#include <functional>
+#include <chrono>
+#include <coroutine>
 
 #include <routio/message.h>
 
@@ -21,6 +24,8 @@ namespace routio {
 class IOBase;
 typedef shared_ptr<IOBase> SharedIOBase;
 
+class IOLoop;
+
 class IOBaseObserver {
 public:
 
@@ -59,6 +64,11 @@ public:
     bool observe(SharedIOBaseObserver observer);
     bool unobserve(SharedIOBaseObserver observer);
 
+	/**
+	 * Returns the loop that handles the object, the default loop if it was not added to one.
+	 */
+	virtual shared_ptr<IOLoop> get_loop();
+
 protected:
 
 	void notify_output();
@@ -66,7 +76,12 @@ protected:
     std::recursive_mutex mutex;
 
 private:
+    friend IOLoop;
+
     vector<SharedIOBaseObserver> observers;
+
+    // Loop the object was last added to
+    std::weak_ptr<IOLoop> owner;
 };
 
 
@@ -88,6 +103,40 @@ private:
 };
 */
 
+/**
+ * Calls a function from the loop once the timeout set with start has passed.
+ */
+class Timer : public IOBase {
+public:
+	Timer(function<void()> callback);
+
+	virtual ~Timer();
+
+	/**
+	 * Starts or restarts the timer, the timeout is given in milliseconds.
+	 */
+	void start(int64_t timeout);
+
+	void stop();
+
+	virtual int get_file_descriptor();
+
+	virtual bool handle_input();
+
+	virtual bool handle_output();
+
+	virtual void disconnect();
+
+private:
+
+	int fd;
+
+	function<void()> callback;
+
+};
+
+typedef shared_ptr<Timer> SharedTimer;
+
 class IOLoop;
 typedef shared_ptr<IOLoop> SharedIOLoop;
 
@@ -102,6 +151,39 @@ public:
 
 	virtual bool wait(int64_t timeout = -1);
 
+	/**
+	 * Runs the task on the thread waiting on the loop while no handler of the loop is active,
+	 * can be used to modify handlers from another thread. The task is queued, it runs the next
+	 * time the loop is waited on.
+	 */
+	void execute(function<void()> task);
+
+	class SleepAwaiter {
+	public:
+		SleepAwaiter(IOLoop *loop, std::chrono::steady_clock::time_point deadline) : loop(loop), deadline(deadline) {}
+
+		bool await_ready() const { return std::chrono::steady_clock::now() >= deadline; }
+
+		void await_suspend(std::coroutine_handle<> handle) { loop->resume_at(deadline, handle); }
+
+		void await_resume() const {}
+
+	private:
+		IOLoop *loop;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
+	/**
+	 * Suspends the awaiting coroutine for the given number of milliseconds, it is resumed by the
+	 * thread waiting on the loop.
+	 */
+	SleepAwaiter sleep(int64_t timeout);
+
+	/**
+	 * Resumes the coroutine from the loop once the deadline has passed.
+	 */
+	void resume_at(std::chrono::steady_clock::time_point deadline, std::coroutine_handle<> handle);
+
 private:
 
 	class IOLoopWriteObserver: public IOBaseObserver {
@@ -126,8 +208,19 @@ private:
 
 	map<int, std::shared_ptr<IOLoopWriteObserver> > observers;
 
+	// Coroutines that are resumed once their deadline has passed
+	multimap<std::chrono::steady_clock::time_point, std::coroutine_handle<> > sleeping;
+
+	// Tasks waiting to be run by the thread waiting on the loop
+	vector<function<void()> > tasks;
+
 	int efd;
 
+	// Event descriptor that interrupts waiting
+	int wfd;
+
+	std::recursive_mutex mutex;
+
 };
 
 SharedIOLoop default_loop();
@@ -8,18 +8,39 @@
 #include <cstring>
 #include <sstream>
 #include <map>
+#include <vector>
+#include <deque>
 #include <queue>
+#include <chrono>
 #include <memory>
 #include <exception>
 #include <functional>
 #include <iostream>
 #include <type_traits>
 #include <cinttypes>
+#include <mutex>
 
 using namespace std;
 
 #define ROUTIO_CONTROL_CHANNEL 0
 
+// Target of a message that is distributed to all subscribers except its sender
+#define ROUTIO_TARGET_OTHERS -2
+
+// Index of a frame without data that tells a subscribed sender of a message sent to ROUTIO_TARGET_OTHERS
+// which sequence number the message took in the channel
+#define ROUTIO_INDEX_SEQUENCE -3
+
+// Target of a message that is distributed to all providers of a service channel
+#define ROUTIO_TARGET_PROVIDERS -3
+
+// Sequence of requests that are returned to the caller because the service has no providers,
+// requests delivered to a provider carry the identifier of the caller instead of the sequence
+#define ROUTIO_SEQUENCE_RETURNED -2
+
+// Prefix of frames of logical clients that share a connection, followed by the logical client id
+#define ROUTIO_LOGICAL_FRAME INT32_MIN
+
 // TODO: change this to strings
 #define ROUTIO_COMMAND_UNKNOWN -4
 #define ROUTIO_COMMAND_EVENT -3
@@ -37,12 +58,17 @@ using namespace std;
 #define ROUTIO_COMMAND_SET_NAME 9
 #define ROUTIO_COMMAND_GET_NAME 10
 #define ROUTIO_COMMAND_CREATE_SERVICE 11
+#define ROUTIO_COMMAND_CONFIGURE 12
+#define ROUTIO_COMMAND_STATE 13
 
 // TODO: move buffer size from a define to a variable that the user can change, since it has an effect on performance
 #define BUFFER_SIZE 1024 * 1024 * 2
 #define MESSAGE_MAX_SIZE 1024 * 1024
 #define MESSAGE_MAX_QUEUE 5000
 
+// Alignment of message memory, suitable for vectorized access to received data
+#define ROUTIO_ALIGNMENT 64
+
 namespace routio
 {
 
@@ -100,6 +126,11 @@ namespace routio
 
     typedef unsigned char uchar;
 
+    /**
+     * Allocates memory aligned to ROUTIO_ALIGNMENT, the memory is released with free.
+     */
+    uchar *allocate_aligned(size_t length);
+
     class MessageReader;
     class MessageWriter;
 
@@ -114,6 +145,19 @@ namespace routio
 
         virtual size_t copy_data(size_t position, uchar *buffer, size_t length) const = 0;
 
+        /**
+         * Returns a pointer to the data at the position if the given number of bytes is stored
+         * contiguously in memory, NULL otherwise. The pointer is valid as long as the buffer is.
+         */
+        virtual const uchar *get_contiguous(size_t position, size_t length) const;
+
+        /**
+         * Like get_contiguous, but only for data that the buffer owns and that nobody else can
+         * change, e.g. a received message. Data referenced from elsewhere, like the tensor of a
+         * publisher, is not returned.
+         */
+        virtual const uchar *get_owned(size_t position, size_t length) const;
+
         virtual void inspect_data(ostream& output) const;
     };
 
@@ -130,6 +174,10 @@ namespace routio
 
         virtual size_t copy_data(size_t position, uchar *buffer, size_t length) const;
 
+        virtual const uchar *get_contiguous(size_t position, size_t length) const;
+
+        virtual const uchar *get_owned(size_t position, size_t length) const;
+
         uchar *get_buffer() const;
 
     protected:
@@ -177,7 +225,7 @@ namespace routio
 
         BufferedMessage(MessageWriter &writer);
 
-        BufferedMessage(int length);
+        BufferedMessage(size_t length);
 
         virtual ~BufferedMessage();
 
@@ -205,6 +253,10 @@ namespace routio
 
         virtual size_t copy_data(size_t position, uchar *buffer, size_t length) const;
 
+        virtual const uchar *get_contiguous(size_t position, size_t length) const;
+
+        virtual const uchar *get_owned(size_t position, size_t length) const;
+
     private:
         void rebuild();
 
@@ -310,6 +362,10 @@ namespace routio
 
         virtual size_t copy_data(size_t position, uchar *buffer, size_t length) const;
 
+        virtual const uchar *get_contiguous(size_t position, size_t length) const;
+
+        virtual const uchar *get_owned(size_t position, size_t length) const;
+
     private:
         SharedBuffer buffer;
         size_t offset;
@@ -389,6 +445,15 @@ namespace routio
 
         void copy_data(uchar *buffer, size_t length = 0);
 
+        /**
+         * Skips the next length bytes and returns a pointer to them if they are contiguous in memory
+         * and owned by the message (see Buffer::get_owned), otherwise returns NULL and stays at the
+         * same position.
+         */
+        const uchar *view_data(size_t length);
+
+        SharedMessage get_message() const;
+
         void debug_peek(size_t position, size_t length) const;
 
     private:
@@ -591,10 +656,78 @@ namespace routio
         return command;
     }
 
+// Maximum number of chunked messages in progress that are tracked per channel
+#define MESSAGE_CACHE_PARTIALS 16
+
+    /**
+     * Follows the chunk envelope of messages published on a channel, assigns each message a
+     * sequence number and keeps the frames of a bounded number of recent complete messages.
+     * Retention is limited by message count, total bytes and age, a limit of zero means that
+     * the limit is not used and retention is disabled if all of them are zero. Frames of
+     * messages that are still being received are kept as well so that a replay never starts
+     * in the middle of a message.
+     */
+    class MessageCache
+    {
+    public:
+        MessageCache(size_t count = 0, size_t bytes = 0, int64_t time = 0);
+        ~MessageCache();
+
+        void set_limits(size_t count, size_t bytes = 0, int64_t time = 0);
+
+        /**
+         * Adds a frame and returns the sequence number of the message it belongs to, or -1 if
+         * the frame cannot be assigned to a message.
+         */
+        int64_t push(SharedMessage frame);
+
+        /**
+         * Returns frames of the retained messages together with the sequence number of their
+         * message, either the last count messages or, if since is not negative, all messages with
+         * sequence number greater than since. Frames of messages in progress are appended at the end.
+         */
+        vector<pair<int64_t, SharedMessage>> get_frames(size_t count, int64_t since = -1) const;
+
+        int64_t get_sequence() const;
+
+        void clear();
+
+    private:
+        typedef struct Entry
+        {
+            int64_t sequence;
+            std::chrono::steady_clock::time_point time;
+            size_t bytes;
+            int64_t remaining;
+            int chunks;
+            vector<SharedMessage> frames;
+        } Entry;
+
+        bool is_retaining() const;
+
+        void complete(Entry &entry);
+
+        void evict();
+
+        size_t limit_count;
+        size_t limit_bytes;
+        int64_t limit_time;
+
+        int64_t sequence;
+        size_t bytes;
+
+        deque<Entry> messages;
+        map<int64_t, Entry> partial;
+    };
+
     class StreamReader
     {
     public:
-        StreamReader(int fd);
+        /**
+         * Received frames are placed in memory so that the data at the given offset
+         * in a frame is aligned to ROUTIO_ALIGNMENT.
+         */
+        StreamReader(int fd, size_t offset = 0);
         ~StreamReader();
 
         SharedMessage read_message();
@@ -616,6 +749,7 @@ namespace routio
         int header_value;
 
         uchar *data;
+        size_t data_padding;
         size_t data_length;
         size_t data_current;
         uint64_t data_read_counter;
@@ -704,6 +838,66 @@ namespace routio
         uint64_t total_data_dropped;
     };
 
+    /**
+     * Queue of messages between two endpoints in the same process, used instead of a socket
+     * by in-process connections. Messages are passed by reference without being serialized.
+     * The queue has an event file descriptor that is readable while messages are available so
+     * that it can be used with an IOLoop. When the queue is full the oldest message is dropped.
+     */
+    class MessageQueue
+    {
+    public:
+        MessageQueue(std::size_t size = MESSAGE_MAX_QUEUE);
+        ~MessageQueue();
+
+        bool push(const SharedMessage message, MessageCallback callback = NULL);
+
+        /**
+         * Takes the oldest message from the queue, its callback is notified that the message was sent.
+         */
+        SharedMessage pop();
+
+        /**
+         * Wakes up the reader of the queue without adding a message.
+         */
+        void notify();
+
+        void close();
+
+        bool is_closed() const;
+
+        int get_file_descriptor() const;
+
+        int get_size() const;
+
+        unsigned long get_transferred_data() const;
+
+        unsigned long get_dropped_data() const;
+
+    private:
+        int fd;
+
+        std::size_t limit;
+
+        bool closed;
+
+        typedef struct QueuedMessage
+        {
+            SharedMessage message;
+            MessageCallback callback;
+            bool control;
+        } QueuedMessage;
+
+        deque<QueuedMessage> messages;
+
+        mutable std::mutex mutex;
+
+        uint64_t total_data_transferred;
+        uint64_t total_data_dropped;
+    };
+
+    typedef shared_ptr<MessageQueue> SharedMessageQueue;
+
     template <class T>
     string Dictionary::T_as_string(const T &t)
     {
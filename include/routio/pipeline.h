@@ -0,0 +1,154 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef ROUTIO_PIPELINE_HPP_
+#define ROUTIO_PIPELINE_HPP_
+
+#include <deque>
+#include <thread>
+#include <condition_variable>
+
+#include <routio/client.h>
+#include <routio/datatypes.h>
+
+namespace routio {
+
+// Queue policies of node inputs
+// Oldest queued message is dropped when the queue is full
+#define NODE_QUEUE_DROP 0
+// Only the latest message is kept, regardless of the capacity
+#define NODE_QUEUE_LATEST 1
+// Nodes running on the executor wait for room in the queue, messages from the loop or from the node
+// itself drop the oldest
+#define NODE_QUEUE_BLOCK 2
+
+typedef struct NodeStatistics {
+    uint64_t messages_processed;
+    uint64_t messages_dropped;
+    uint64_t errors;
+} NodeStatistics;
+
+/**
+ * Processing stage of a pipeline. Messages received on inputs of a node are queued and processed
+ * by the executor, one at a time, so callbacks of a node do not have to be thread safe but are not
+ * called from the loop. Inputs and outputs that use the same client hand objects over directly.
+ * Nodes have to be created as shared objects, queued messages are processed once the node is
+ * added to an executor.
+ */
+class Node : public std::enable_shared_from_this<Node> {
+    friend Executor;
+    friend Client;
+    friend class Service;
+public:
+    Node(const string &name = string());
+
+    virtual ~Node();
+
+    template <typename T>
+    void add_input(SharedClient client, const string &alias, function<void(shared_ptr<T>)> callback, size_t capacity = 1, int policy = NODE_QUEUE_DROP) {
+
+        size_t index = add_queue(capacity, policy);
+
+        inputs.push_back(make_shared<TypedSubscriber<T>>(client, alias, [this, index, callback](shared_ptr<T> value) {
+            push(index, [callback, value]() { callback(value); });
+        }));
+
+    }
+
+    template <typename T>
+    SharedTypedPublisher<T> add_output(SharedClient client, const string &alias, int queue = -1) {
+
+        SharedTypedPublisher<T> publisher = make_shared<TypedPublisher<T>>(client, alias, queue);
+
+        outputs.push_back(publisher);
+
+        return publisher;
+
+    }
+
+    string get_name() const;
+
+    NodeStatistics get_statistics();
+
+protected:
+
+    virtual void on_error(const std::exception &error);
+
+private:
+    typedef struct NodeQueue {
+        deque<function<void()>> tasks;
+        size_t capacity;
+        int policy;
+    } NodeQueue;
+
+    size_t add_queue(size_t capacity, int policy);
+
+    void push(size_t index, function<void()> task);
+
+    // Processes one queued message, returns false if there was nothing to process
+    bool step();
+
+    void schedule();
+
+    string name;
+
+    std::mutex mutex;
+
+    std::condition_variable space;
+
+    vector<NodeQueue> queues;
+
+    // Queue that is checked first on the next step, so that inputs are served in turn
+    size_t next;
+
+    bool scheduled;
+    bool running;
+
+    NodeStatistics statistics;
+
+    std::weak_ptr<Executor> executor;
+
+    vector<shared_ptr<void>> inputs;
+    vector<shared_ptr<void>> outputs;
+};
+
+/**
+ * Runs nodes on a pool of threads, so that slow nodes do not block the loop or each other.
+ */
+class Executor : public std::enable_shared_from_this<Executor> {
+    friend Node;
+public:
+    Executor(size_t threads = std::thread::hardware_concurrency());
+
+    virtual ~Executor();
+
+    void add(SharedNode node);
+
+    void remove(SharedNode node);
+
+    /**
+     * Stops worker threads, messages that are still queued are not processed.
+     */
+    void stop();
+
+private:
+
+    void schedule(SharedNode node);
+
+    void run();
+
+    std::mutex mutex;
+
+    std::condition_variable ready_condition;
+
+    deque<SharedNode> ready;
+
+    set<SharedNode> nodes;
+
+    vector<std::thread> workers;
+
+    bool running;
+};
+
+}
+
+#endif
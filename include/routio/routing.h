@@ -5,9 +5,15 @@
 
 #include <routio/message.h>
 #include <routio/server.h>
+#include <routio/client.h>
 #include <map>
 #include <vector>
 #include <set>
+#include <thread>
+#include <atomic>
+
+// Largest shared memory segment of a state channel that clients may request by default
+#define DEFAULT_STATE_LIMIT (64 * 1024 * 1024)
 
 using namespace std;
 
@@ -21,28 +27,95 @@ namespace routio
     Channel(int identifier, SharedClientConnection owner, const string &type = string());
     ~Channel();
 
-    bool publish(SharedClientConnection client, SharedMessage message);
+    bool publish(SharedClientConnection client, SharedMessage message, bool echo = true);
+    bool publish_to(SharedClientConnection client, int target, SharedMessage message);
+
+    /**
+     * Delivers a request to the provider of the service with the fewest outstanding requests,
+     * or to all providers. Requests that cannot be delivered are returned to the caller.
+     */
+    bool request(SharedClientConnection client, SharedMessage message, bool all = false);
 
-    bool subscribe(SharedClientConnection client);
+    bool subscribe(SharedClientConnection client, size_t truncate = 0, int sample = 1);
     bool unsubscribe(SharedClientConnection client);
 
+    bool provide(SharedClientConnection client);
+    bool withdraw(SharedClientConnection client);
+
     bool watch(SharedClientConnection client);
     bool unwatch(SharedClientConnection client);
 
     bool is_subscribed(SharedClientConnection client);
     bool is_watching(SharedClientConnection client);
+    bool is_providing(SharedClientConnection client);
+
+    bool is_service() const;
+    void set_service(bool service);
+
+    void replay(SharedClientConnection client, size_t count = 0, int64_t since = -1);
 
     string get_type() const;
     bool set_type(const string &type);
     int get_identifier() const;
 
+    bool is_latched() const;
+    void set_latched(bool latched);
+
+    void set_history(size_t count, size_t bytes = 0, int64_t time = 0);
+    int64_t get_sequence() const;
+
+    /**
+     * Name of the shared memory segment of a state channel, the segment is created on first
+     * use. Returns an empty string if the segment cannot be created or has a different size.
+     */
+    string get_segment(size_t size);
+
   private:
+    void update_limits();
+
+    void deliver(SharedClientConnection client, int64_t sequence, SharedMessage frame);
+
+    // Tells the sender of a message that is not echoed which sequence number it took
+    void deliver_sequence(SharedClientConnection client, int64_t sequence, SharedMessage frame);
+
+    // Subscriptions that only receive the beginning of each message or every n-th message
+    typedef struct SubscriptionFilter
+    {
+      size_t truncate;
+      int sample;
+    } SubscriptionFilter;
+
+    map<SharedClientConnection, SubscriptionFilter> filters;
+
     int identifier;
     string type;
 
+    bool latched;
+    size_t history_count;
+    size_t history_bytes;
+    int64_t history_time;
+    MessageCache cache;
+
     SharedClientConnection owner;
     set<SharedClientConnection> subscribers;
     set<SharedClientConnection> watchers;
+
+    // Providers of a service with the number of requests they have not answered yet
+    typedef struct ServiceProvider
+    {
+      SharedClientConnection client;
+      int outstanding;
+    } ServiceProvider;
+
+    vector<ServiceProvider> providers;
+
+    // Provider that is preferred when several have the same load
+    size_t next_provider;
+
+    bool service;
+
+    string segment;
+    size_t segment_size;
   };
 
   typedef std::shared_ptr<Channel> SharedChannel;
@@ -54,13 +127,23 @@ namespace routio
     friend ClientConnection;
 
   public:
-    Router(SharedIOLoop loop, const std::string &address = std::string());
+    Router(SharedIOLoop loop, const std::string &address = std::string(), bool listen = true);
     ~Router();
 
     void print_statistics() const;
 
+    /**
+     * Disconnects all clients and releases all channels.
+     */
+    void shutdown();
+
     static bool comparator(const SharedClientConnection &lhs, const SharedClientConnection &rhs);
 
+    /**
+     * Sets the largest shared memory segment that clients may request for a state channel.
+     */
+    void set_state_limit(size_t limit);
+
   private:
     virtual void handle_message(SharedClientConnection client, SharedMessage message);
 
@@ -83,6 +166,34 @@ namespace routio
     ClientSet clients;
 
     int64_t received_messages_size;
+
+    // Set from the application thread while the router runs on its own
+    std::atomic<size_t> state_limit;
+  };
+
+  /**
+   * Router that runs on its own thread inside an application. Clients in the same process are
+   * connected to it through message queues, so messages are passed without being serialized.
+   * If an address is given the router also listens on it for clients in other processes.
+   */
+  class EmbeddedRouter
+  {
+  public:
+    EmbeddedRouter(const std::string &address = std::string());
+    ~EmbeddedRouter();
+
+    SharedClient connect(const string &name = string(), SharedIOLoop loop = default_loop());
+
+    shared_ptr<Router> get_router() const;
+
+  private:
+    SharedIOLoop loop;
+
+    shared_ptr<Router> router;
+
+    std::atomic<bool> running;
+
+    std::thread thread;
   };
 
 }
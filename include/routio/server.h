@@ -33,6 +33,18 @@ friend Server;
 public:
 
     ClientConnection(int sfd, SharedServer server);
+
+    /**
+     * Creates a connection to a client in the same process that exchanges messages with the
+     * server through a pair of message queues instead of a socket.
+     */
+    ClientConnection(SharedMessageQueue incoming, SharedMessageQueue outgoing, SharedServer server);
+
+    /**
+     * Creates a logical connection of a client that shares the physical connection of its parent
+     * with other clients of the same process. Its messages are wrapped in logical frames.
+     */
+    ClientConnection(SharedClientConnection parent, int logical_id, SharedServer server);
     virtual ~ClientConnection();
 
     SharedMessage read();
@@ -47,6 +59,12 @@ public:
 
 	virtual int get_file_descriptor();
 
+    /**
+     * Returns an identifier that is unique among connections of the server, unlike the
+     * file descriptor it also distinguishes logical connections.
+     */
+    int get_identifier() const;
+
     void send(const SharedMessage message);
 
     bool write();
@@ -57,6 +75,12 @@ public:
 
     int get_group() const;
 
+    /**
+     * Whether the client runs on the same host, i.e. it is connected over a Unix socket or from
+     * the same process, and can therefore map shared memory of the router.
+     */
+    bool is_local() const;
+
     ClientStatistics get_statistics() const;
 
 	static bool comparator(const SharedClientConnection &lhs, const SharedClientConnection &rhs);
@@ -69,13 +93,25 @@ private:
 
     int fd;
 
+    int identifier;
+
     string name;
 
-    StreamReader reader;
-    StreamWriter writer;
+    // Only allocated for socket connections
+    unique_ptr<StreamReader> reader;
+    unique_ptr<StreamWriter> writer;
+
+    SharedMessageQueue incoming;
+    SharedMessageQueue outgoing;
+
+    SharedClientConnection parent;
+    int logical_id;
+    map<int, SharedClientConnection> logical;
 
     bool connected;
 
+    bool local;
+
     int process_id;
     int user_id;
     int group_id;
@@ -87,7 +123,7 @@ private:
 class Server : public IOBase {
 friend ClientConnection;
 public:
-	Server(SharedIOLoop loop, const std::string& address = std::string());
+	Server(SharedIOLoop loop, const std::string& address = std::string(), bool listen = true);
 
 	virtual ~Server();
 
@@ -99,6 +135,12 @@ public:
 
 	virtual void disconnect();
 
+	/**
+	 * Connects a client in the same process, returns the queue of messages for the client and
+	 * the queue of messages from the client. Can be called from any thread.
+	 */
+	pair<SharedMessageQueue, SharedMessageQueue> connect_local();
+
 protected:
 
     virtual void handle_message(SharedClientConnection client, SharedMessage message) = 0;
@@ -107,12 +149,14 @@ protected:
 
     virtual void handle_connect(SharedClientConnection client) = 0;
 
-private:
-
 	SharedIOLoop loop;
 
+private:
+
 	int fd;
 
+	int next_identifier = 1;
+
 };
 
 }
@@ -1,39 +1,281 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
 
-#pragma once
+#ifndef ROUTIO_SERVICE_HPP_
+#define ROUTIO_SERVICE_HPP_
 
-#include <routio/message.h>
-#include <routio/server.h>
-#include <map>
-#include <vector>
-#include <set>
+#include <atomic>
+#include <condition_variable>
+
+#include <routio/client.h>
+#include <routio/datatypes.h>
+#include <routio/pipeline.h>
 
 namespace routio {
 
-  class Service : public Server
-  {
-    friend ClientConnection;
+// Kinds of messages sent to providers
+#define SERVICE_REQUEST 0
+#define SERVICE_CANCEL 1
+
+// Status of a call, passed to the callback together with the reply
+#define SERVICE_OK 0
+// Handler has thrown an exception, the reply contains its description as a string
+#define SERVICE_ERROR 1
+// Deadline of the call has passed before a reply was received
+#define SERVICE_TIMEOUT 2
+#define SERVICE_CANCELLED 3
+// No provider of the service is connected
+#define SERVICE_UNAVAILABLE 4
+// Provider has rejected the request because its queue is full
+#define SERVICE_BUSY 5
+
+class ServiceRequest;
+typedef std::shared_ptr<ServiceRequest> SharedServiceRequest;
+
+typedef std::function<SharedMessage(SharedServiceRequest)> ServiceHandler;
+typedef std::function<void(int, SharedMessage)> ServiceCallback;
+
+/**
+ * Request received by a service provider. Handlers that take long should check whether the request
+ * has been cancelled or its deadline has passed, the caller is no longer waiting for the reply then.
+ */
+class ServiceRequest {
+    friend class Service;
+public:
+    ServiceRequest(int64_t identifier, int caller, SharedMessage message, int64_t timeout = 0);
+
+    int64_t get_identifier() const;
+
+    /**
+     * Identifier of the calling client in the router.
+     */
+    int get_caller() const;
+
+    SharedMessage get_message() const;
+
+    bool is_cancelled() const;
+
+    bool is_expired() const;
+
+    std::chrono::steady_clock::time_point get_deadline() const;
+
+private:
+    int64_t identifier;
+    int caller;
+    SharedMessage message;
+
+    std::chrono::steady_clock::time_point deadline;
+
+    std::atomic<bool> cancelled;
+};
+
+typedef struct ServiceStatistics {
+    uint64_t requests_received;
+    uint64_t requests_completed;
+    uint64_t requests_rejected;
+    uint64_t requests_expired;
+    uint64_t requests_cancelled;
+    uint64_t errors;
+} ServiceStatistics;
+
+/**
+ * Provider of a named service. Requests are distributed by the router among all providers of the
+ * service, preferring the one with the fewest unanswered requests. Without an executor requests are
+ * handled on the loop one at a time, otherwise at most the given number of requests is handled
+ * concurrently by the executor and up to queue requests wait for a free worker, the rest are rejected.
+ */
+class Service {
+public:
+    Service(SharedClient client, const string &name, ServiceHandler handler = NULL, SharedExecutor executor = SharedExecutor(),
+            size_t concurrency = 1, size_t queue = 64, const string &type = string());
+
+    virtual ~Service();
+
+    /**
+     * Stops accepting requests and waits for the ones that are being handled, queued requests
+     * are answered as unavailable.
+     */
+    void stop();
+
+    ServiceStatistics get_statistics();
+
+protected:
+    virtual SharedMessage on_request(SharedServiceRequest request);
+
+    virtual void on_error(const std::exception &error);
+
+private:
+    void lookup_callback(SharedDictionary lookup);
+
+    void data_callback(SharedMessage message);
+
+    void cancel(int64_t identifier, int caller);
+
+    // Handles the request on a worker and hands the worker the next queued request
+    void process(size_t worker, SharedServiceRequest request);
+
+    // Hands a request to a worker that has already been reserved for it, called with the mutex held
+    void assign(size_t worker, SharedServiceRequest request);
+
+    void handle(SharedServiceRequest request);
+
+    void reply(SharedServiceRequest request, int status, SharedMessage message = SharedMessage());
+
+    shared_ptr<Liveness> liveness;
+
+    SharedClient client;
+
+    ServiceHandler handler;
+
+    SharedExecutor executor;
+
+    size_t queue;
+
+    // Replies are sent from executor workers while the service is stopped on another thread
+    std::atomic<int> id{-1};
+
+    DataCallback callback;
+
+    std::mutex mutex;
+
+    std::condition_variable idle;
+
+    bool stopped = false;
+
+    deque<SharedServiceRequest> pending;
+
+    // Requests that are being handled, by worker
+    vector<SharedServiceRequest> active;
+
+    // Requests handed to workers that have not finished yet
+    size_t scheduled = 0;
+
+    vector<SharedNode> workers;
+
+    ServiceStatistics statistics;
+};
+
+/**
+ * Calls a named service. Calls are identified by the returned request identifier and may be
+ * issued before the service channel is known or while other calls are in flight. The callback of
+ * each call is called exactly once with the status of the call and the reply, from the loop when
+ * the reply arrives or the call times out. Calls that end otherwise are completed on the calling
+ * thread: by cancel, by call if the service does not exist and by the destructor, which cancels
+ * calls that are still pending.
+ */
+class ServiceClient {
+public:
+    ServiceClient(SharedClient client, const string &name, const string &type = string(), SharedIOLoop loop = default_loop());
+
+    virtual ~ServiceClient();
+
+    /**
+     * Calls the service, the timeout in milliseconds is also passed to the provider as the deadline
+     * of the request. Returns the identifier of the request.
+     */
+    int64_t call(SharedMessage request, ServiceCallback callback, int64_t timeout = 0);
+
+    template <typename Q, typename R>
+    int64_t call(const Q &request, function<void(int, shared_ptr<R>)> callback, int64_t timeout = 0) {
+
+        return call(Message::pack<Q>(request), [callback](int status, SharedMessage reply) {
+
+            shared_ptr<R> value;
+
+            if (status == SERVICE_OK) {
+                try {
+                    value = Message::unpack<R>(reply);
+                } catch (routio::ParseException &e) {
+                    status = SERVICE_ERROR;
+                }
+            }
+
+            callback(status, value);
+
+        }, timeout);
+
+    }
+
+    /**
+     * Cancels a call, its callback is called with the cancelled status. Returns false if the call
+     * has already completed.
+     */
+    bool cancel(int64_t request);
+
+    size_t get_pending();
+
+private:
+    typedef struct PendingCall {
+        SharedMessage message;
+        ServiceCallback callback;
+        int64_t timeout;
+        std::chrono::steady_clock::time_point deadline;
+    } PendingCall;
+
+    void lookup_callback(SharedDictionary lookup);
+
+    void data_callback(SharedMessage message);
+
+    void send_request(int64_t identifier, const PendingCall &call);
+
+    void complete(int64_t identifier, int status, SharedMessage reply = SharedMessage());
+
+    void expire();
+
+    // Starts the timer for the earliest deadline
+    void update_timer();
+
+    shared_ptr<Liveness> liveness;
+
+    SharedClient client;
+
+    SharedIOLoop loop;
+
+    int id = -1;
+
+    bool failed = false;
+
+    DataCallback callback;
+
+    std::recursive_mutex mutex;
+
+    map<int64_t, PendingCall> calls;
+
+    set<pair<std::chrono::steady_clock::time_point, int64_t>> deadlines;
+
+    SharedTimer timer;
+};
 
-  public:
-    Service(SharedIOLoop loop, const std::string &address = std::string());
-    ~Service();
+/**
+ * Service with typed requests and replies, the handler returns the reply object.
+ */
+template <typename Q, typename R>
+class TypedService : public Service {
+public:
+    TypedService(SharedClient client, const string &name, function<R(shared_ptr<Q>, SharedServiceRequest)> handler,
+                 SharedExecutor executor = SharedExecutor(), size_t concurrency = 1, size_t queue = 64) :
+        Service(client, name, NULL, executor, concurrency, queue, get_type_identifier<Q>()), handler(handler) {
 
-    static bool comparator(const SharedClientConnection &lhs, const SharedClientConnection &rhs);
+    }
 
-  private:
-    virtual void handle_message(SharedClientConnection client, SharedMessage message);
+    virtual ~TypedService() {
 
-    virtual void handle_disconnect(SharedClientConnection client);
+        Service::stop();
 
-    virtual void handle_connect(SharedClientConnection client);
+    }
 
-    SharedClientConnection find(int fid);
+protected:
+    virtual SharedMessage on_request(SharedServiceRequest request) {
 
-    ClientSet clients;
+        shared_ptr<Q> value = Message::unpack<Q>(request->get_message());
 
-    int64_t received_messages_size;
+        return Message::pack<R>(handler(value, request));
 
-  };
+    }
 
+private:
+    function<R(shared_ptr<Q>, SharedServiceRequest)> handler;
+};
 
 }
 
+#endif
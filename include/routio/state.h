@@ -0,0 +1,197 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
+
+#ifndef ROUTIO_STATE_HPP_
+#define ROUTIO_STATE_HPP_
+
+#include <atomic>
+#include <type_traits>
+
+#include <routio/client.h>
+
+namespace routio {
+
+// Size of the header of a state segment, the value starts at the next cache line
+#define ROUTIO_STATE_HEADER_SIZE 64
+#define ROUTIO_STATE_MAGIC 0x52535453
+// Time in microseconds to wait for a write in progress, e.g. of a writer that died while writing
+#define ROUTIO_STATE_TIMEOUT 100000
+
+typedef struct StateSegmentHeader {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t capacity;
+    // Odd while the value is being written, the number of writes is half of it
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> length;
+} StateSegmentHeader;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "State segments require lock-free 64 bit atomics");
+static_assert(sizeof(StateSegmentHeader) <= ROUTIO_STATE_HEADER_SIZE, "State segment header is too large");
+
+/**
+ * Shared memory slot that holds a single value protected by a sequence lock. Writers overwrite the
+ * value, readers copy it and retry if it was changed in the meantime, neither of them takes a lock.
+ */
+class StateSegment {
+public:
+    /**
+     * Maps the named segment, creating it if requested. Throws runtime_error if the segment cannot
+     * be mapped or does not have the given capacity.
+     */
+    StateSegment(const string &name, size_t capacity, bool create = false);
+
+    ~StateSegment();
+
+    /**
+     * Replaces the value, returns false if it is larger than the capacity. A write that does not
+     * complete within ROUTIO_STATE_TIMEOUT, e.g. of a writer that died, is taken over, the write
+     * that was taken over then returns false.
+     */
+    bool write(const void *data, size_t length);
+
+    /**
+     * Copies a consistent snapshot of the value, at most capacity bytes, and sets length to its
+     * size. Returns the number of writes of the copied value, zero if nothing was written yet or if
+     * a write does not complete within ROUTIO_STATE_TIMEOUT. Once a write did not complete, reads
+     * return zero without waiting until another write takes it over.
+     */
+    uint64_t read(void *data, size_t capacity, size_t &length) const;
+
+    /**
+     * Number of writes so far, changes whenever the value does.
+     */
+    uint64_t get_version() const;
+
+    size_t get_capacity() const;
+
+    string get_name() const;
+
+    static void remove(const string &name);
+
+private:
+    string name;
+
+    size_t mapped;
+
+    // Capacity of the mapping, the one in the header can be changed by other processes
+    size_t capacity;
+
+    // Odd sequence of a write that did not complete in time
+    mutable std::atomic<uint64_t> stalled;
+
+    StateSegmentHeader *header;
+
+    uchar *data;
+};
+
+/**
+ * State channel, a value kept in a shared memory segment instead of being sent as messages. The
+ * router only creates the segment and tells clients its name, clients on the same host then read
+ * and write the value directly. All clients of a channel have to use the same size.
+ */
+class StateChannel {
+public:
+    StateChannel(SharedClient client, const string &alias, size_t size, const string &type = string());
+
+    virtual ~StateChannel();
+
+    /**
+     * Whether the segment is mapped, before that writes are ignored and nothing can be read.
+     */
+    bool is_ready() const;
+
+    size_t get_size() const;
+
+protected:
+    virtual void on_ready();
+
+    virtual void on_error(const std::exception &error);
+
+    // Segment once it is mapped, it is not replaced afterwards so readers do not need to hold it
+    std::atomic<StateSegment *> segment;
+
+private:
+    void lookup_callback(SharedDictionary lookup);
+
+    bool broker_callback(SharedDictionary response);
+
+    // Lookup and command responses may arrive after the channel is released
+    shared_ptr<Liveness> liveness;
+
+    SharedClient client;
+
+    size_t size;
+
+    unique_ptr<StateSegment> mapping;
+};
+
+class StateWriter : public StateChannel {
+public:
+    StateWriter(SharedClient client, const string &alias, size_t size, const string &type = string());
+
+    virtual ~StateWriter();
+
+    bool write(const void *data, size_t length);
+};
+
+class StateReader : public StateChannel {
+public:
+    StateReader(SharedClient client, const string &alias, size_t size, const string &type = string());
+
+    virtual ~StateReader();
+
+    /**
+     * Copies the latest value, see StateSegment::read. Returns zero if the channel is not ready.
+     */
+    uint64_t read(void *data, size_t capacity, size_t &length) const;
+
+    uint64_t get_version() const;
+};
+
+/**
+ * State writer for values that can be copied as bytes, e.g. structures of numbers.
+ */
+template <typename T>
+class TypedStateWriter : StateWriter {
+    static_assert(std::is_trivially_copyable<T>::value, "State values have to be trivially copyable");
+public:
+    TypedStateWriter(SharedClient client, const string &alias) : StateWriter(client, alias, sizeof(T)) {}
+
+    virtual ~TypedStateWriter() {}
+
+    bool write(const T &value) {
+
+        return StateWriter::write(&value, sizeof(T));
+
+    }
+
+    using StateWriter::is_ready;
+};
+
+template <typename T>
+class TypedStateReader : StateReader {
+    static_assert(std::is_trivially_copyable<T>::value, "State values have to be trivially copyable");
+public:
+    TypedStateReader(SharedClient client, const string &alias) : StateReader(client, alias, sizeof(T)) {}
+
+    virtual ~TypedStateReader() {}
+
+    /**
+     * Copies the latest value, returns its version or zero if there is no value yet.
+     */
+    uint64_t read(T &value) const {
+
+        size_t length = 0;
+
+        return StateReader::read(&value, sizeof(T), length);
+
+    }
+
+    using StateReader::get_version;
+
+    using StateReader::is_ready;
+};
+
+}
+
+#endif
@@ -34,12 +34,12 @@ class TensorSubscriber(_wrapper.Subscriber):
             reader = _wrapper.MessageReader(message)
             return _wrapper.readTensor(reader)
 
-        super().__init__(client, alias, "tensor", lambda x: callback(_read(x)))
+        super().__init__(client, alias, "tensor/aligned", lambda x: callback(_read(x)))
 
 class TensorPublisher(_wrapper.Publisher):
 
     def __init__(self, client, alias):
-        super().__init__(client, alias, "tensor")
+        super().__init__(client, alias, "tensor/aligned")
 
     def send(self, obj):
         writer = _wrapper.MessageWriter()
@@ -27,7 +27,10 @@ int main(int argc, char** argv) {
     SharedClient client = routio::connect(string(), "cameraserver");
 
     VideoCapture device;
-    Mat image, image_rgb;
+    Mat image;
+
+    // Frame buffers are reused once the previous frames are sent
+    TensorPool pool;
 
     device.open(cameraid);
 
@@ -62,8 +65,6 @@ int main(int argc, char** argv) {
 
     SharedTypedPublisher<Frame> frame_publisher = make_shared<TypedPublisher<Frame> >(client, "camera", 1);
 
-    SubscriptionWatcher watcher(client, "camera");
-
     StaticPublisher<CameraIntrinsics> intrinsics_publisher = StaticPublisher<CameraIntrinsics>(client, "intrinsics", parameters);
 
     double fps = 30;
@@ -84,12 +85,13 @@ int main(int argc, char** argv) {
 
         if (image.empty()) return -1;
 
-        cv::cvtColor(image, image_rgb, COLOR_BGR2RGB);
-
-        if (watcher.get_subscribers() > 0) {
-            Frame frame{Header("camera", a), make_shared<Tensor>(image_rgb)};
-            frame_publisher->send(frame);
-        }
+        // Conversion is skipped when nobody is listening
+        frame_publisher->send_lazy([&]() {
+            SharedTensor frame = pool.allocate({(size_t) image.rows, (size_t) image.cols, 3}, UINT8);
+            cv::Mat target = frame->asMat();
+            cv::cvtColor(image, target, COLOR_BGR2RGB);
+            return Frame{Header("camera", a), frame};
+        });
 
         std::chrono::duration<double, std::milli> delta_ms(max(0.0, 1000.0 / fps - (double)work_time.count()));
         
@@ -52,21 +52,16 @@ int main(int argc, char** argv) {
 
     SharedTypedPublisher<Frame> frame_publisher = make_shared<TypedPublisher<Frame> >(client, "camera", 1);
 
-    SubscriptionWatcher watcher(client, "camera");
-
     StaticPublisher<CameraIntrinsics> intrinsics_publisher = StaticPublisher<CameraIntrinsics>(client, "intrinsics", parameters);
 
     cv::cvtColor(image, image_rgb, COLOR_BGR2RGB);
 
     while (true) {
         
-        if (watcher.get_subscribers() > 0) {
-            
-            Frame frame{Header("image"), make_shared<Tensor>(image_rgb)};
-
-            frame_publisher->send(frame);
+        frame_publisher->send_lazy([&]() {
+            return Frame{Header("image"), make_shared<Tensor>(image_rgb)};
+        });
 
-        }
         if (!routio::wait(30)) break;
     }
 
@@ -1,6 +1,7 @@
 /* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4; tab-width: 4 -*- */
 
 #include <stdlib.h>
+#include <signal.h>
 
 #include "debug.h"
 #include <routio/loop.h>
@@ -11,6 +12,13 @@ using namespace std;
 
 // https://stackoverflow.com/questions/8104904/identify-program-that-connects-to-a-unix-domain-socket
 
+static volatile sig_atomic_t running = 1;
+
+// Stopping the loop releases the router, which removes shared memory segments of state channels
+void handle_signal(int) {
+    running = 0;
+}
+
 int main(int argc, char *argv[]) {
 
     SharedIOLoop loop = make_shared<IOLoop>();
@@ -23,9 +31,16 @@ int main(int argc, char *argv[]) {
     shared_ptr<Router> router = make_shared<Router>(loop, address);
     loop->add_handler(router);
 
-    while (true) {
+    if (getenv("ROUTIO_STATE_LIMIT") != NULL) {
+        router->set_state_limit((size_t) atoll(getenv("ROUTIO_STATE_LIMIT")));
+    }
 
-        loop->wait(5000);
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    while (running) {
+
+        loop->wait(1000);
 
         DEBUGGING {
             cout << " --------------------------- Daemon statistics --------------------------------- " <<  endl;
@@ -34,5 +49,7 @@ int main(int argc, char *argv[]) {
 
     }
 
+    router->shutdown();
+
     return EXIT_SUCCESS;
 }
@@ -24,7 +24,10 @@ int main(int argc, char** argv) {
 
     SharedClient client = routio::connect(string(), "videoserver");
 
-    Mat image, image_rgb;
+    Mat image;
+
+    // Frame buffers are reused once the previous frames are sent
+    TensorPool pool;
 
     VideoCapture video(filename);
 
@@ -57,8 +60,6 @@ int main(int argc, char** argv) {
 
     SharedTypedPublisher<Frame> frame_publisher = make_shared<TypedPublisher<Frame> >(client, "camera", 1);
 
-    SubscriptionWatcher watcher(client, "camera");
-
     StaticPublisher<CameraIntrinsics> intrinsics_publisher = StaticPublisher<CameraIntrinsics>(client, "intrinsics", parameters);
 
     while (true) {
@@ -69,15 +70,16 @@ int main(int argc, char** argv) {
             continue;
         }
 
-        cv::cvtColor(image, image_rgb, COLOR_BGR2RGB);
-
         std::chrono::system_clock::time_point a = std::chrono::system_clock::now();
 
-        if (watcher.get_subscribers() > 0) {
-            Frame frame{Header("video", a), make_shared<Tensor>(image_rgb)};
+        // Conversion is skipped when nobody is listening
+        frame_publisher->send_lazy([&]() {
+            SharedTensor frame = pool.allocate({(size_t) image.rows, (size_t) image.cols, 3}, UINT8);
+            cv::Mat target = frame->asMat();
+            cv::cvtColor(image, target, COLOR_BGR2RGB);
+            return Frame{Header("video", a), frame};
+        });
 
-            frame_publisher->send(frame);
-        }
         if (!routio::wait(30)) break;
     }
 
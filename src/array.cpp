@@ -5,11 +5,17 @@
 #include <fstream>
 #include <cmath>
 #include <type_traits>
+#include <sys/mman.h>
 
 #ifdef BUILD_OPENCV
 #include <opencv2/opencv.hpp>
 #endif
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ROUTIO_X86_SIMD 1
+#endif
+
 #include "debug.h"
 #include <routio/array.h>
 
@@ -20,11 +26,11 @@ namespace routio {
 
 Array::Array(): Array(0) {}
 
-Array::Array(size_t size): size(size), data((uchar*) malloc(size)), callback(nullptr) {
+Array::Array(size_t size): size(size), data(allocate_aligned(size)), callback(nullptr), readonly(false) {
 
 }
 
-Array::Array(size_t size, uchar* data, DescructorCallback callback): size(size), data(data), callback(callback) {
+Array::Array(size_t size, uchar* data, DescructorCallback callback): size(size), data(data), callback(callback), readonly(false) {
 
 }
 
@@ -44,9 +50,56 @@ size_t Array::get_size() const {
 }
 
 uchar* Array::get_data() const {
+
+    if (readonly)
+        const_cast<Array*>(this)->detach();
+
+    return data;
+}
+
+void Array::detach() {
+
+    SYNCHRONIZED(detaching);
+
+    if (!readonly)
+        return;
+
+    copy_shared();
+
+    readonly = false;
+
+}
+
+void Array::copy_shared() {
+
+    uchar* copy = allocate_aligned(size);
+    if (size > 0) memcpy(copy, data, size);
+
+    uchar* previous = data;
+    DescructorCallback release = callback;
+
+    callback = [copy, previous, release]() {
+        free(copy);
+        if (release) release();
+        else if (previous) free(previous);
+    };
+
+    data = copy;
+
+}
+
+const uchar* Array::get_const_data() const {
     return data;
 }
 
+bool Array::is_readonly() const {
+    return readonly;
+}
+
+void Array::set_readonly(bool readonly) {
+    this->readonly = readonly;
+}
+
 size_t multiply_dimensions(routio::any_container<size_t> dims) {
 
     if (dims->size() == 0) return 0;
@@ -81,6 +134,10 @@ size_t Tensor::get_type_bytes(DataType dtype) {
         case FLOAT64: {
             return 8;
         }
+        case FLOAT16:
+        case BFLOAT16: {
+            return 2;
+        }
     }
 
     throw runtime_error("Unsupported data type");
@@ -89,19 +146,93 @@ size_t Tensor::get_type_bytes(DataType dtype) {
 
 Tensor::Tensor() : Tensor({}, UINT8) {}
 
+static vector<ssize_t> contiguous_strides(const vector<size_t>& dimensions, DataType dtype) {
+
+    vector<ssize_t> strides(dimensions.size());
+
+    ssize_t stride = Tensor::get_type_bytes(dtype);
+
+    for (ssize_t i = (ssize_t) dimensions.size() - 1; i >= 0; i--) {
+        strides[i] = stride;
+        stride *= dimensions[i];
+    }
+
+    return strides;
+}
+
 Tensor::Tensor(routio::any_container<size_t> dims, DataType dtype) : Array(multiply_dimensions(dims) * Tensor::get_type_bytes(dtype)), dimensions(dims->begin(), dims->end()), dtype(dtype)  {
 
+    strides = contiguous_strides(dimensions, dtype);
+
 }
 
 
 Tensor::Tensor(routio::any_container<size_t> dims, DataType dtype, uchar* data, DescructorCallback callback) : Array(multiply_dimensions(dims) * Tensor::get_type_bytes(dtype), data, callback), dimensions(dims->begin(), dims->end()), dtype(dtype) {
 
+    strides = contiguous_strides(dimensions, dtype);
+
+}
+
+Tensor::Tensor(routio::any_container<size_t> dims, DataType dtype, routio::any_container<ssize_t> strides, uchar* data, DescructorCallback callback) : Array(multiply_dimensions(dims) * Tensor::get_type_bytes(dtype), data, callback), dimensions(dims->begin(), dims->end()), strides(strides->begin(), strides->end()), dtype(dtype) {
+
+    if (this->strides.size() != dimensions.size())
+        throw runtime_error("Number of strides does not match dimensions");
+
+}
+
+SharedTensor Tensor::crop(SharedTensor parent, routio::any_container<size_t> offset, routio::any_container<size_t> dims) {
+
+    if (offset->size() != parent->ndims() || dims->size() != parent->ndims())
+        throw runtime_error("Region does not match tensor dimensions");
+
+    // The view inherits the read-only flag of the parent below
+    uchar* data = (uchar*) parent->get_const_data();
+
+    for (size_t i = 0; i < parent->ndims(); i++) {
+        if ((*offset)[i] + (*dims)[i] > parent->shape(i))
+            throw runtime_error(_format_string("Region exceeds tensor in dimension %d", (int) i));
+        data += (ssize_t) (*offset)[i] * parent->stride(i);
+    }
+
+    SharedTensor view = make_shared<Tensor>(dims, parent->get_type(), parent->get_strides(), data, [parent]() {});
+    view->set_readonly(parent->is_readonly());
+
+    return view;
+
 }
 
 Tensor::~Tensor() {
 
 }
 
+void Tensor::copy_shared() {
+
+    if (is_contiguous()) {
+        Array::copy_shared();
+        strides = contiguous_strides(dimensions, dtype);
+        return;
+    }
+
+    // Views are gathered into a dense copy, the tensor does not own itself
+    TensorBuffer buffer(SharedTensor(SharedTensor(), this));
+
+    uchar* copy = allocate_aligned(size);
+    buffer.copy_data(0, copy, size);
+
+    uchar* previous = data;
+    DescructorCallback release = callback;
+
+    callback = [copy, previous, release]() {
+        free(copy);
+        if (release) release();
+        else if (previous) free(previous);
+    };
+
+    data = copy;
+    strides = contiguous_strides(dimensions, dtype);
+
+}
+
 #ifdef __ROUTIO_HAS_OPENCV
 
 #ifndef CV_MAX_DIM
@@ -122,6 +253,12 @@ DataType Tensor::decode_ocvtype(int cvtype) {
         case CV_32S: { dtype = INT32; break; }
         case CV_32F: { dtype = FLOAT32; break; }
         case CV_64F: { dtype = FLOAT64; break; }
+#ifdef CV_16F
+        case CV_16F: { dtype = FLOAT16; break; }
+#endif
+#ifdef CV_16BF
+        case CV_16BF: { dtype = BFLOAT16; break; }
+#endif
         default: {
             throw runtime_error("Unsupported data type");
         }
@@ -142,6 +279,12 @@ int Tensor::encode_ocvtype(DataType dtype) {
         case INT32: { type = CV_32S; break; }
         case FLOAT32: { type = CV_32F; break; }
         case FLOAT64: { type = CV_64F; break; }
+#ifdef CV_16F
+        case FLOAT16: { type = CV_16F; break; }
+#endif
+#ifdef CV_16BF
+        case BFLOAT16: { type = CV_16BF; break; }
+#endif
         default: {
             throw runtime_error("Unsupported data type");
         }
@@ -152,9 +295,7 @@ int Tensor::encode_ocvtype(DataType dtype) {
 
 Tensor::Tensor(cv::Mat source) {
 
-    if (!source.isContinuous()) 
-        source = source.clone(); // Copy data in case of strides
-
+    // Regions of images are not copied, the tensor uses strides of the source
     data = source.data;
 
     cv::Mat* reservation = new cv::Mat(source); // A dynamically allocated Mat, used to keep data in memory.
@@ -174,6 +315,15 @@ Tensor::Tensor(cv::Mat source) {
     if (cn > 1)
         dimensions[source.dims] = cn;
 
+    strides = vector<ssize_t>(dimensions.size());
+
+    for (int i = 0; i < source.dims; i++) {
+        strides[i] = (ssize_t) source.step[i];
+    }
+
+    if (cn > 1)
+        strides[source.dims] = (ssize_t) source.elemSize1();
+
     size = 0;
 
     if (dimensions.size() > 0) {
@@ -193,19 +343,36 @@ cv::Mat Tensor::asMat() const {
 
     int ndims = (int) dimensions.size();
 
-    int size[CV_MAX_DIM + 1];
-    for (size_t i = 0; i < dimensions.size(); i++) { size[i] = (int) dimensions[i]; }
-
     if (ndims >= CV_MAX_DIM) {
         throw runtime_error(_format_string("Dimensionality (%d) is not supported by OpenCV", ndims));
     } 
 
-    if( ndims == 3 && size[2] <= CV_CN_MAX) {
+    int size[CV_MAX_DIM + 1];
+    size_t step[CV_MAX_DIM + 1];
+    for (size_t i = 0; i < dimensions.size(); i++) {
+        // OpenCV only supports views with increasing addresses
+        if (strides[i] < 0)
+            throw runtime_error("Negative strides are not supported by OpenCV");
+        size[i] = (int) dimensions[i];
+        step[i] = (size_t) strides[i];
+    }
+
+    size_t element = get_type_bytes(dtype);
+
+    if (ndims == 3 && size[2] <= CV_CN_MAX && (size[2] == 1 || step[2] == element)) {
         ndims--;
         type |= CV_MAKETYPE(0, size[2]);
+        element *= size[2];
     }
 
-    return cv::Mat(ndims, size, type, data);
+    if (ndims > 0 && size[ndims - 1] > 1 && step[ndims - 1] != element)
+        throw runtime_error("Tensor layout is not supported by OpenCV");
+
+    // OpenCV matrices cannot be read-only, shared data is copied
+    if (readonly)
+        return cv::Mat(ndims, size, type, data, step).clone();
+
+    return cv::Mat(ndims, size, type, data, step);
 
 }
 
@@ -223,6 +390,68 @@ const std::vector<size_t> Tensor::dims() const {
     return move(dimensions);
 }
 
+SharedTensor Tensor::convert(SharedTensor source, DataType dtype) {
+
+    if (source->get_type() == dtype)
+        return source;
+
+    function<void(const uchar*, uchar*, size_t)> apply;
+
+    if (source->get_type() == FLOAT32 && dtype == FLOAT16) {
+        apply = [](const uchar* in, uchar* out, size_t count) { float32_to_float16((const float*) in, (uint16_t*) out, count); };
+    } else if (source->get_type() == FLOAT32 && dtype == BFLOAT16) {
+        apply = [](const uchar* in, uchar* out, size_t count) { float32_to_bfloat16((const float*) in, (uint16_t*) out, count); };
+    } else if (source->get_type() == FLOAT16 && dtype == FLOAT32) {
+        apply = [](const uchar* in, uchar* out, size_t count) { float16_to_float32((const uint16_t*) in, (float*) out, count); };
+    } else if (source->get_type() == BFLOAT16 && dtype == FLOAT32) {
+        apply = [](const uchar* in, uchar* out, size_t count) { bfloat16_to_float32((const uint16_t*) in, (float*) out, count); };
+    } else {
+        throw runtime_error("Unsupported tensor conversion");
+    }
+
+    SharedTensor result = make_shared<Tensor>(source->dims(), dtype);
+
+    size_t bytes = get_type_bytes(source->get_type());
+
+    if (source->is_contiguous()) {
+        apply(source->get_const_data(), result->get_data(), source->get_size() / bytes);
+        return result;
+    }
+
+    // Views are converted segment by segment
+    TensorBuffer buffer(source);
+
+    size_t count = buffer.get_segment_length() / bytes;
+
+    for (size_t i = 0; i < buffer.get_segments(); i++) {
+        apply(buffer.get_segment(i), result->get_data() + i * count * get_type_bytes(dtype), count);
+    }
+
+    return result;
+
+}
+
+ssize_t Tensor::stride(size_t i) const {
+    return strides[i];
+}
+
+const std::vector<ssize_t> Tensor::get_strides() const {
+    return strides;
+}
+
+bool Tensor::is_contiguous() const {
+
+    ssize_t stride = get_type_bytes(dtype);
+
+    for (ssize_t i = (ssize_t) dimensions.size() - 1; i >= 0; i--) {
+        // Strides of dimensions with a single element do not matter
+        if (dimensions[i] > 1 && strides[i] != stride) return false;
+        stride *= dimensions[i];
+    }
+
+    return true;
+}
+
 DataType Tensor::get_type() const {
     return dtype;
 }
@@ -231,7 +460,384 @@ uchar Tensor::get_bytes() {
     return Tensor::get_type_bytes(dtype);
 }
 
-ArrayBuffer::ArrayBuffer(SharedArray array, function<void()> complete) : array(array), complete(complete) {}
+// Pooled buffers of this size or larger are aligned to huge pages
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static uchar* allocate_pooled(size_t size) {
+
+    if (size < HUGE_PAGE_SIZE)
+        return allocate_aligned(size);
+
+    size = ((size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+
+    uchar* data = (uchar*) aligned_alloc(HUGE_PAGE_SIZE, size);
+
+    // Buffers are long lived, so it pays off to back them with huge pages where available
+    if (data) madvise(data, size, MADV_HUGEPAGE);
+
+    return data;
+}
+
+class TensorPool::Storage {
+public:
+
+    typedef pair<vector<size_t>, DataType> Key;
+
+    Storage(size_t capacity) : capacity(capacity) {}
+
+    ~Storage() { clear(); }
+
+    void release(const Key& key, uchar* data) {
+
+        SYNCHRONIZED(mutex);
+
+        vector<uchar*>& buffers = available[key];
+
+        if (buffers.size() < capacity) {
+            buffers.push_back(data);
+        } else {
+            free(data);
+        }
+
+    }
+
+    uchar* acquire(const Key& key, size_t size) {
+
+        {
+            SYNCHRONIZED(mutex);
+
+            vector<uchar*>& buffers = available[key];
+
+            if (!buffers.empty()) {
+                uchar* data = buffers.back();
+                buffers.pop_back();
+                return data;
+            }
+        }
+
+        uchar* data = allocate_pooled(size);
+
+        if (!data) throw std::bad_alloc();
+
+        return data;
+
+    }
+
+    void clear() {
+
+        SYNCHRONIZED(mutex);
+
+        for (auto& buffers : available) {
+            for (uchar* data : buffers.second) free(data);
+        }
+
+        available.clear();
+
+    }
+
+    size_t count() {
+
+        SYNCHRONIZED(mutex);
+
+        size_t total = 0;
+
+        for (auto& buffers : available) total += buffers.second.size();
+
+        return total;
+
+    }
+
+    void close() {
+
+        SYNCHRONIZED(mutex);
+
+        // Tensors that are still in use free their buffers when released
+        capacity = 0;
+
+        clear();
+
+    }
+
+private:
+
+    size_t capacity;
+
+    std::recursive_mutex mutex;
+
+    map<Key, vector<uchar*>> available;
+
+};
+
+TensorPool::TensorPool(size_t capacity) : storage(make_shared<Storage>(capacity)) {
+
+}
+
+TensorPool::~TensorPool() {
+
+    storage->close();
+
+}
+
+SharedTensor TensorPool::allocate(routio::any_container<size_t> dimensions, DataType dtype) {
+
+    Storage::Key key(vector<size_t>(dimensions->begin(), dimensions->end()), dtype);
+
+    size_t size = multiply_dimensions(key.first) * Tensor::get_type_bytes(dtype);
+
+    uchar* data = storage->acquire(key, size);
+
+    shared_ptr<Storage> owner = storage;
+
+    return make_shared<Tensor>(key.first, dtype, data, [owner, key, data]() { owner->release(key, data); });
+
+}
+
+size_t TensorPool::get_available() const {
+
+    return storage->count();
+
+}
+
+void TensorPool::clear() {
+
+    storage->clear();
+
+}
+
+static inline uint16_t encode_float16(float value) {
+
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(float));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    int exponent = (int) ((bits >> 23) & 0xFF);
+
+    if (exponent == 0xFF) {
+        // Infinity stays infinity, NaN stays a quiet NaN
+        return sign | 0x7C00 | (mantissa ? 0x200 | (mantissa >> 13) : 0);
+    }
+
+    exponent = exponent - 127 + 15;
+
+    if (exponent >= 0x1F)
+        return sign | 0x7C00;
+
+    if (exponent <= 0) {
+        // Subnormal numbers, rounded to nearest even
+        if (exponent < -10)
+            return sign;
+
+        mantissa |= 0x800000;
+        uint32_t shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t midpoint = 1u << (shift - 1);
+
+        if (rest > midpoint || (rest == midpoint && (half & 1)))
+            half++;
+
+        return sign | half;
+    }
+
+    uint32_t half = ((uint32_t) exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1FFF;
+
+    // A carry from rounding correctly moves into the exponent
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+
+    return sign | half;
+}
+
+static inline float decode_float16(uint16_t value) {
+
+    uint32_t sign = ((uint32_t) value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1F;
+    uint32_t mantissa = value & 0x3FF;
+    uint32_t bits;
+
+    if (exponent == 0x1F) {
+        // NaN is quieted like in the vector conversion
+        bits = sign | 0x7F800000 | (mantissa << 13) | (mantissa ? 0x400000 : 0);
+    } else if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        } else {
+            // Subnormal numbers are normalized
+            int shift = -1;
+            do { shift++; mantissa <<= 1; } while (!(mantissa & 0x400));
+            bits = sign | ((uint32_t) (127 - 15 - shift) << 23) | ((mantissa & 0x3FF) << 13);
+        }
+    } else {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(float));
+    return result;
+}
+
+static inline uint16_t encode_bfloat16(float value) {
+
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(float));
+
+    if (std::isnan(value))
+        return (bits >> 16) | 0x40;
+
+    // Round to nearest even
+    bits += 0x7FFF + ((bits >> 16) & 1);
+
+    return bits >> 16;
+}
+
+static inline float decode_bfloat16(uint16_t value) {
+
+    uint32_t bits = (uint32_t) value << 16;
+
+    float result;
+    memcpy(&result, &bits, sizeof(float));
+    return result;
+}
+
+#ifdef ROUTIO_X86_SIMD
+
+static bool has_vector_conversion() {
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+    return supported;
+}
+
+__attribute__((target("avx2,f16c")))
+static size_t float32_to_float16_vector(const float* source, uint16_t* destination, size_t count) {
+
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(source + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*) (destination + i), half);
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2,f16c")))
+static size_t float16_to_float32_vector(const uint16_t* source, float* destination, size_t count) {
+
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(destination + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (source + i))));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t float32_to_bfloat16_vector(const float* source, uint16_t* destination, size_t count) {
+
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i bias = _mm256_set1_epi32(0x7FFF);
+    const __m256i quiet = _mm256_set1_epi32(0x400000);
+
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 value = _mm256_loadu_ps(source + i);
+        __m256i bits = _mm256_castps_si256(value);
+
+        __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16), one);
+        __m256i rounded = _mm256_add_epi32(bits, _mm256_add_epi32(bias, lsb));
+
+        __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(value, value, _CMP_UNORD_Q));
+        rounded = _mm256_blendv_epi8(rounded, _mm256_or_si256(bits, quiet), nan);
+
+        rounded = _mm256_srli_epi32(rounded, 16);
+
+        // Packing works within 128 bit lanes, the permutation joins the results
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(rounded, rounded), 0xD8);
+        _mm_storeu_si128((__m128i*) (destination + i), _mm256_castsi256_si128(packed));
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t bfloat16_to_float32_vector(const uint16_t* source, float* destination, size_t count) {
+
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i bits = _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) (source + i))), 16);
+        _mm256_storeu_ps(destination + i, _mm256_castsi256_ps(bits));
+    }
+
+    return i;
+}
+
+#endif
+
+void float32_to_float16(const float* source, uint16_t* destination, size_t count) {
+
+    size_t i = 0;
+
+#ifdef ROUTIO_X86_SIMD
+    if (has_vector_conversion())
+        i = float32_to_float16_vector(source, destination, count);
+#endif
+
+    for (; i < count; i++) destination[i] = encode_float16(source[i]);
+
+}
+
+void float16_to_float32(const uint16_t* source, float* destination, size_t count) {
+
+    size_t i = 0;
+
+#ifdef ROUTIO_X86_SIMD
+    if (has_vector_conversion())
+        i = float16_to_float32_vector(source, destination, count);
+#endif
+
+    for (; i < count; i++) destination[i] = decode_float16(source[i]);
+
+}
+
+void float32_to_bfloat16(const float* source, uint16_t* destination, size_t count) {
+
+    size_t i = 0;
+
+#ifdef ROUTIO_X86_SIMD
+    if (has_vector_conversion())
+        i = float32_to_bfloat16_vector(source, destination, count);
+#endif
+
+    for (; i < count; i++) destination[i] = encode_bfloat16(source[i]);
+
+}
+
+void bfloat16_to_float32(const uint16_t* source, float* destination, size_t count) {
+
+    size_t i = 0;
+
+#ifdef ROUTIO_X86_SIMD
+    if (has_vector_conversion())
+        i = bfloat16_to_float32_vector(source, destination, count);
+#endif
+
+    for (; i < count; i++) destination[i] = decode_bfloat16(source[i]);
+
+}
+
+ArrayBuffer::ArrayBuffer(SharedArray array, function<void()> complete) : array(array), complete(complete) {
+
+    SharedTensor tensor = std::dynamic_pointer_cast<Tensor>(array);
+
+    // Views have to be serialized with TensorBuffer
+    if (tensor && !tensor->is_contiguous())
+        throw runtime_error("Tensor data is not contiguous");
+
+}
 
 ArrayBuffer::~ArrayBuffer() {
     if (complete)
@@ -246,8 +852,90 @@ size_t ArrayBuffer::copy_data(size_t position, uchar* buffer, size_t length) con
     length = min(length, array->get_size() - position);
     if (length < 1) return 0;
 
-    memcpy(buffer, &(array->get_data()[position]), length);
+    memcpy(buffer, &(array->get_const_data()[position]), length);
+    return length;
+}
+
+const uchar* ArrayBuffer::get_contiguous(size_t position, size_t length) const {
+    if (position + length > array->get_size()) return NULL;
+
+    return &(array->get_const_data()[position]);
+}
+
+TensorBuffer::TensorBuffer(SharedTensor tensor) : tensor(tensor) {
+
+    // Trailing dimensions that are stored densely are merged into a single segment
+    segment_length = Tensor::get_type_bytes(tensor->get_type());
+    outer = tensor->ndims();
+
+    while (outer > 0 && (tensor->shape(outer - 1) == 1 || tensor->stride(outer - 1) == (ssize_t) segment_length)) {
+        segment_length *= tensor->shape(outer - 1);
+        outer--;
+    }
+
+    segments = 1;
+
+    for (size_t i = 0; i < outer; i++) segments *= tensor->shape(i);
+
+    if (tensor->get_size() == 0) segments = 0;
+
+}
+
+TensorBuffer::~TensorBuffer() {}
+
+size_t TensorBuffer::get_length() const {
+    return tensor->get_size();
+}
+
+size_t TensorBuffer::get_segments() const {
+    return segments;
+}
+
+size_t TensorBuffer::get_segment_length() const {
+    return segment_length;
+}
+
+const uchar* TensorBuffer::get_segment(size_t index) const {
+
+    const uchar* data = tensor->get_const_data();
+
+    for (ssize_t i = (ssize_t) outer - 1; i >= 0; i--) {
+        data += (ssize_t) (index % tensor->shape(i)) * tensor->stride(i);
+        index /= tensor->shape(i);
+    }
+
+    return data;
+}
+
+size_t TensorBuffer::copy_data(size_t position, uchar* buffer, size_t length) const {
+
+    if (position >= get_length()) return 0;
+
+    length = min(length, get_length() - position);
+
+    size_t copied = 0;
+
+    while (copied < length) {
+        size_t index = (position + copied) / segment_length;
+        size_t offset = (position + copied) % segment_length;
+        size_t count = min(segment_length - offset, length - copied);
+
+        memcpy(&(buffer[copied]), get_segment(index) + offset, count);
+        copied += count;
+    }
+
     return length;
 }
 
+const uchar* TensorBuffer::get_contiguous(size_t position, size_t length) const {
+
+    if (position + length > get_length()) return NULL;
+
+    size_t offset = position % segment_length;
+
+    if (offset + length > segment_length) return NULL;
+
+    return get_segment(position / segment_length) + offset;
+}
+
 }
@@ -18,9 +18,13 @@
 #include <routio/message.h>
 #include <routio/client.h>
 #include <routio/datatypes.h>
+#include <routio/pipeline.h>
 
 #define MAXEVENTS 8
 
+// Channel, sequence number and chunk index precede message data in a frame
+#define FRAME_DATA_OFFSET (sizeof(int) + sizeof(int64_t) + sizeof(int))
+
 namespace routio
 {
 
@@ -131,8 +135,200 @@ namespace routio
         return client;
     }
 
-    Client::Client(const string &name, const string &address) : fd(connect_socket(address)), writer(fd), reader(fd),
-                                                                next_request_key(0), subscriptions(), watches()
+    SharedMultiplexer multiplex(const string &address, SharedIOLoop loop)
+    {
+
+        SharedMultiplexer multiplexer = make_shared<Multiplexer>(address);
+
+        loop->add_handler(multiplexer);
+
+        return multiplexer;
+    }
+
+    Multiplexer::Multiplexer(const string &address) : fd(connect_socket(address)), connected(true), writer(fd), reader(fd, 2 * sizeof(int) + FRAME_DATA_OFFSET), next_logical_id(1)
+    {
+    }
+
+    Multiplexer::~Multiplexer()
+    {
+
+        disconnect();
+    }
+
+    SharedClient Multiplexer::connect(const string &name)
+    {
+
+        SYNCHRONIZED(mutex);
+
+        int id = next_logical_id++;
+
+        SharedMultiplexer self = std::dynamic_pointer_cast<Multiplexer>(shared_from_this());
+
+        SharedClient client = make_shared<Client>(name, self, id);
+
+        clients[id] = client;
+
+        return client;
+    }
+
+    bool Multiplexer::handle_input()
+    {
+
+        set<SharedClient> active;
+
+        while (true)
+        {
+            SharedMessage msg = reader.read_message();
+
+            if (!msg)
+            {
+                if (reader.get_error())
+                {
+                    disconnect();
+                }
+                break;
+            }
+
+            MessageReader reader(msg);
+
+            if (reader.read_integer() != ROUTIO_LOGICAL_FRAME)
+                continue;
+
+            int id = reader.read_integer();
+
+            SharedClient client;
+
+            {
+                SYNCHRONIZED(mutex);
+                auto it = clients.find(id);
+                if (it != clients.end())
+                    client = it->second.lock();
+            }
+
+            // Frames for clients that were already released are ignored
+            if (client)
+            {
+                client->handle_frame(make_shared<OffsetBufferMessage>(msg, reader.get_position()));
+                active.insert(client);
+            }
+        }
+
+        for (auto client : active)
+            client->end_input();
+
+        return is_connected();
+    }
+
+    bool Multiplexer::handle_output()
+    {
+
+        SYNCHRONIZED(mutex);
+
+        bool status = writer.write_messages();
+        if (!status)
+        {
+            if (writer.get_error())
+            {
+                DEBUGMSG("Writer error: %d\n", writer.get_error());
+                disconnect();
+            }
+        }
+        return status;
+    }
+
+    bool Multiplexer::is_connected()
+    {
+        return connected;
+    }
+
+    void Multiplexer::disconnect()
+    {
+        SYNCHRONIZED(mutex);
+
+        if (connected)
+        {
+            DEBUGMSG("Disconnecting multiplexer.\n");
+            close(fd);
+        }
+
+        connected = false;
+    }
+
+    int Multiplexer::get_queue_size()
+    {
+        return writer.get_queue_size();
+    }
+
+    int Multiplexer::get_file_descriptor()
+    {
+        return fd;
+    }
+
+    void Multiplexer::send(int logical_id, SharedMessage message, MessageCallback callback, int priority)
+    {
+
+        SYNCHRONIZED(mutex);
+
+        if (!connected)
+            return;
+
+        vector<SharedBuffer> buffers{PrimitiveBuffer<int>::wrap(ROUTIO_LOGICAL_FRAME), PrimitiveBuffer<int>::wrap(logical_id)};
+
+        if (message)
+            buffers.push_back(message);
+
+        if (writer.add_message(make_shared<MultiBufferMessage>(buffers), priority, callback))
+        {
+            notify_output();
+        }
+    }
+
+    void Multiplexer::detach(int logical_id)
+    {
+
+        SYNCHRONIZED(mutex);
+
+        clients.erase(logical_id);
+    }
+
+    Client::Client(const string &name, const string &address) : fd(connect_socket(address)), writer(new StreamWriter(fd)), reader(new StreamReader(fd, FRAME_DATA_OFFSET)),
+                                                                logical_id(-1), next_request_key(0), next_call(1), subscriptions(), watches()
+    {
+
+        initialize_common();
+
+        connected = true;
+
+        if (!name.empty())
+        {
+
+            SharedDictionary command = generate_command(ROUTIO_COMMAND_SET_NAME);
+            command->set<string>("name", name);
+
+            send_command(command);
+        }
+    }
+
+    Client::Client(const string &name, pair<SharedMessageQueue, SharedMessageQueue> queues) : fd(queues.first->get_file_descriptor()),
+                                                                                                incoming(queues.first), outgoing(queues.second), logical_id(-1), next_request_key(0), next_call(1), subscriptions(), watches()
+    {
+
+        initialize_common();
+
+        connected = true;
+
+        if (!name.empty())
+        {
+
+            SharedDictionary command = generate_command(ROUTIO_COMMAND_SET_NAME);
+            command->set<string>("name", name);
+
+            send_command(command);
+        }
+    }
+
+    Client::Client(const string &name, SharedMultiplexer multiplexer, int logical_id) : fd(-1), multiplexer(multiplexer), logical_id(logical_id),
+                                                                                       next_request_key(0), next_call(1), subscriptions(), watches()
     {
 
         initialize_common();
@@ -157,6 +353,10 @@ namespace routio
 
     void Client::initialize_common()
     {
+        mailbox_capacity = 16;
+        mailbox_policy = NODE_QUEUE_DROP;
+
+
         if (getenv("ROUTIO_MAP") != NULL)
         {
             string s(getenv("ROUTIO_MAP"));
@@ -195,13 +395,17 @@ namespace routio
     bool Client::handle_input()
     {
 
+        // Input of logical clients is handled by the multiplexer
+        if (multiplexer)
+            return is_connected();
+
         while (true)
         {
-            SharedMessage msg = reader.read_message();
+            SharedMessage msg = (incoming) ? incoming->pop() : reader->read_message();
 
             if (!msg)
             {
-                if (reader.get_error())
+                if ((incoming) ? incoming->is_closed() : reader->get_error())
                 {
                     disconnect();
                     return is_connected();
@@ -210,27 +414,45 @@ namespace routio
             }
             else
             {
-                MessageReader reader(msg);
-                int channel = reader.read<int>();
-
-                SharedMessage offset = make_shared<OffsetBufferMessage>(msg, reader.get_position());
-
-                handle_message(channel, offset);
+                handle_frame(msg);
             }
         }
 
+        // Callbacks added after the queue was emptied will wake up the loop again
+        if (incoming)
+            complete_sent();
+
+        end_input();
+
         return is_connected();
     }
 
+    void Client::handle_frame(SharedMessage frame)
+    {
+
+        MessageReader reader(frame);
+        int channel = reader.read<int>();
+
+        SharedMessage offset = make_shared<OffsetBufferMessage>(frame, reader.get_position());
+
+        handle_message(channel, offset);
+    }
+
     bool Client::handle_output()
     {
 
-        bool status = writer.write_messages();
+        // Messages can be added from other threads, e.g. by nodes and services on an executor
+        SYNCHRONIZED(mutex);
+
+        if (!writer)
+            return true;
+
+        bool status = writer->write_messages();
         if (!status)
         {
-            if (writer.get_error())
+            if (writer->get_error())
             {
-                DEBUGMSG("Writer error: %d\n", writer.get_error());
+                DEBUGMSG("Writer error: %d\n", writer->get_error());
                 disconnect();
             }
         }
@@ -242,14 +464,23 @@ namespace routio
         return fd;
     }
 
+    SharedIOLoop Client::get_loop()
+    {
+        if (multiplexer)
+            return multiplexer->get_loop();
+        return IOBase::get_loop();
+    }
+
     int Client::get_queue_size()
     {
-        return writer.get_queue_size();
+        if (multiplexer)
+            return multiplexer->get_queue_size();
+        return (outgoing) ? outgoing->get_size() : writer->get_queue_size();
     }
 
     bool Client::is_connected()
     {
-        return connected;
+        return connected && (!multiplexer || multiplexer->is_connected());
     }
 
     void Client::disconnect()
@@ -259,12 +490,36 @@ namespace routio
         if (is_connected())
         {
             DEBUGMSG("Disconnecting.\n");
-            close(fd);
+            if (multiplexer)
+            {
+                multiplexer->send(logical_id, SharedMessage());
+                multiplexer->detach(logical_id);
+            }
+            else if (incoming)
+            {
+                // Descriptor belongs to the queue
+                incoming->close();
+                outgoing->close();
+            }
+            else
+                close(fd);
         }
 
         connected = false;
     }
 
+    // Frames that only report the sequence number of a message of this client, see ROUTIO_INDEX_SEQUENCE
+    static bool is_sequence_frame(SharedMessage &frame)
+    {
+        if (frame->get_length() != sizeof(int64_t) + sizeof(int))
+            return false;
+
+        int index;
+        frame->copy_data(sizeof(int64_t), (uchar *)&index, sizeof(int));
+
+        return index == ROUTIO_INDEX_SEQUENCE;
+    }
+
     void Client::handle_message(int channel, SharedMessage &message)
     {
 
@@ -276,9 +531,26 @@ namespace routio
                 if (response->get<int>("code", ROUTIO_COMMAND_UNKNOWN) == ROUTIO_COMMAND_EVENT)
                 {
                     int channel = response->get<int>("channel", 0);
-                    if (watches.find(channel) == watches.end())
+                    // Channel became latched after the subscription was confirmed
+                    if (response->get<string>("type", "") == "latched")
+                    {
+                        SYNCHRONIZED(mutex);
+                        if (!response->get<bool>("latched", false))
+                            latched.erase(channel);
+                        else if (subscriptions.find(channel) != subscriptions.end() && latched.find(channel) == latched.end())
+                            latched[channel].set_limits(1);
                         return;
-                    auto callbacks = watches[channel];
+                    }
+                    set<WatchCallback> callbacks;
+                    {
+                        // Watches change on other threads, callbacks are called without the lock
+                        SYNCHRONIZED(mutex);
+                        auto watch = watches.find(channel);
+                        if (watch == watches.end())
+                            return;
+                        watch_state[channel] = response;
+                        callbacks = watch->second;
+                    }
                     set<WatchCallback>::const_iterator iter;
                     for (iter = callbacks.begin(); iter != callbacks.end(); ++iter)
                         (*(*iter))(response);
@@ -286,18 +558,52 @@ namespace routio
                 return;
             }
             int key = response->get<int>("key", -1);
-            if (requests.find(key) == requests.end())
-                return;
-            pair<SharedDictionary, function<void(SharedDictionary, SharedDictionary)>> pending = requests[key];
+            pair<SharedDictionary, function<void(SharedDictionary, SharedDictionary)>> pending;
+            {
+                SYNCHRONIZED(mutex);
+                auto request = requests.find(key);
+                if (request == requests.end())
+                    return;
+                pending = request->second;
+                requests.erase(request);
+            }
             if (pending.second)
                 pending.second(pending.first, response);
-            requests.erase(key);
         }
         else
         {
-            if (subscriptions.find(channel) == subscriptions.end())
-                return;
-            auto callbacks = subscriptions[channel];
+            set<DataCallback> callbacks;
+
+            {
+                // Subscriptions may change on executor threads, callbacks are called without the lock
+                SYNCHRONIZED(mutex);
+
+                auto subscription = subscriptions.find(channel);
+                if (subscription == subscriptions.end())
+                    return;
+                // Callbacks receive the frame together with its sequence number
+                if (latched.find(channel) != latched.end() && !is_sequence_frame(message))
+                    latched[channel].push(make_shared<OffsetBufferMessage>(message, sizeof(int64_t)));
+                callbacks = subscription->second;
+
+                if (flushes.find(channel) != flushes.end())
+                    received.insert(channel);
+
+                if (executor)
+                {
+                    std::weak_ptr<IOBase> self = weak_from_this();
+                    SharedMessage frame = message;
+
+                    get_mailbox(channel)->push(0, [self, channel, callbacks, frame]()
+                    {
+                        shared_ptr<Client> client = std::static_pointer_cast<Client>(self.lock());
+                        if (client)
+                            client->dispatch(channel, callbacks, frame);
+                    });
+                    return;
+                }
+            }
+
             set<DataCallback>::const_iterator iter;
 
             for (iter = callbacks.begin(); iter != callbacks.end(); ++iter)
@@ -305,28 +611,87 @@ namespace routio
         }
     }
 
-    bool Client::subscribe(int channel, const DataCallback &callback)
+    bool Client::subscribe(int channel, const DataCallback &callback, const SharedDictionary options)
     {
-        SYNCHRONIZED(mutex);
+        vector<SharedMessage> replay;
+
+        {
+            SYNCHRONIZED(mutex);
+
+            if (!subscribe_locked(channel, callback, options, replay))
+                return false;
+        }
+
+        if (replay.empty())
+            return true;
+
+        // The replay is delivered like received frames, on the mailbox of the channel and without the lock
+        std::weak_ptr<IOBase> self = weak_from_this();
+
+        dispatch_task(channel, [self, channel, callback, replay]()
+        {
+            shared_ptr<Client> client = std::static_pointer_cast<Client>(self.lock());
+            if (!client)
+                return;
+            for (auto frame : replay)
+                client->dispatch(channel, {callback}, frame);
+        });
+
+        return true;
+    }
 
+    bool Client::subscribe_locked(int channel, const DataCallback &callback, const SharedDictionary options, vector<SharedMessage> &replay)
+    {
         if (subscriptions.find(channel) == subscriptions.end())
         {
             DEBUGMSG("Subscribing to channel %d\n", channel);
             // Generate a subscription command message
             SharedDictionary command = generate_command(ROUTIO_COMMAND_SUBSCRIBE);
+            if (options)
+            {
+                for (auto it = options->begin(); it != options->end(); it++)
+                    command->set<string>(it->first, it->second);
+            }
             command->set<int>("channel", channel);
-            std::function<bool(SharedDictionary, SharedDictionary)> comm_callback = [](SharedDictionary x, SharedDictionary y)
+            std::function<bool(SharedDictionary, SharedDictionary)> comm_callback = [this, channel](SharedDictionary x, SharedDictionary y)
             {
+                SYNCHRONIZED(mutex);
+                if (subscriptions.find(channel) == subscriptions.end())
+                    return true;
+                if (y->get<int>("code", ROUTIO_COMMAND_UNKNOWN) == ROUTIO_COMMAND_OK)
+                {
+                    confirmed.insert(channel);
+                    samples[channel] = max(1, y->get<int>("sample", 1));
+                }
+                if (y->get<bool>("latched", false))
+                    latched[channel].set_limits(1);
                 return true;
             };
             // add the subscription command to message queue
             send_command(command, comm_callback);
         }
+        else if (options && options->contains("service") && subscriptions[channel].find(callback) == subscriptions[channel].end())
+        {
+            // Roles in a service are kept by the router for each connection, a client can both provide and call the same service
+            SharedDictionary command = generate_command(ROUTIO_COMMAND_SUBSCRIBE);
+            command->set<string>("service", options->get<string>("service", ""));
+            command->set<int>("channel", channel);
+            send_command(command, [](SharedDictionary x, SharedDictionary y) { return true; });
+        }
+        else if (latched.find(channel) != latched.end() && subscriptions[channel].find(callback) == subscriptions[channel].end())
+        {
+            // Router only replays the last message on the first subscription, do it locally for the others
+            subscriptions[channel].insert(callback);
+            // Sequence numbers of the local cache do not match the ones assigned by the router
+            for (auto frame : latched[channel].get_frames(1))
+                replay.push_back(make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<int64_t>::wrap(-1), frame.second}));
+            return true;
+        }
 
         return subscriptions[channel].insert(callback).second; // Returns pair, the second value is success
     }
 
-    bool Client::unsubscribe(int channel, const DataCallback &callback)
+    bool Client::unsubscribe(int channel, const DataCallback &callback, const SharedDictionary options)
     {
         SYNCHRONIZED(mutex);
 
@@ -358,46 +723,333 @@ namespace routio
             // add the unsubscribe command to message queue
             send_command(command, callback);
             subscriptions.erase(channel);
+            confirmed.erase(channel);
+            samples.erase(channel);
+            latched.erase(channel);
+            if (mailboxes.find(channel) != mailboxes.end())
+            {
+                if (executor)
+                    executor->remove(mailboxes[channel]);
+                mailboxes.erase(channel);
+            }
+        }
+        else if (options && options->contains("service"))
+        {
+            // Other callbacks remain, only the service role is given up
+            SharedDictionary command = generate_command(ROUTIO_COMMAND_UNSUBSCRIBE);
+            command->set<string>("service", options->get<string>("service", ""));
+            command->set<int>("channel", channel);
+            send_command(command, [](SharedDictionary x, SharedDictionary y) { return true; });
         }
 
         return true;
     }
 
-    bool Client::watch(int channel, const WatchCallback &callback)
+    void Client::dispatch(int channel, const set<DataCallback> &callbacks, SharedMessage message)
     {
-        SYNCHRONIZED(mutex);
 
-        if (watches.find(channel) == watches.end())
+        for (auto callback : callbacks)
         {
-            // Generate a subscription command message
-            SharedDictionary command = generate_command(ROUTIO_COMMAND_WATCH);
-            command->set<int>("channel", channel);
-            std::function<bool(SharedDictionary, SharedDictionary)> callback = [](SharedDictionary x, SharedDictionary y)
+            // Skip callbacks that were unsubscribed while the message was queued
             {
-                return true;
-            };
-            // add the watch command to message queue
-            send_command(command, callback);
-        }
+                SYNCHRONIZED(mutex);
+                auto current = subscriptions.find(channel);
+                if (current == subscriptions.end() || current->second.find(callback) == current->second.end())
+                    continue;
+            }
 
-        return watches[channel].insert(callback).second; // Returns pair, the second value is success
+            (*callback)(message);
+        }
     }
 
-    bool Client::unwatch(int channel, const WatchCallback &callback)
+    void Client::deliver_local(int channel, const vector<ObjectCallback> &objects, shared_ptr<const void> object, const vector<DataCallback> &others, SharedMessage frame)
     {
-        SYNCHRONIZED(mutex);
 
-        if (watches.find(channel) == watches.end())
         {
-            DEBUGMSG("Unknown channel %d\n", channel);
-            return false;
-        }
+            // Publishers may send from any thread, the executor can be replaced meanwhile
+            SYNCHRONIZED(mutex);
 
-        if (watches[channel].find(callback) == watches[channel].end())
-        {
-            DEBUGMSG("Unknown callback for channel %d\n", channel);
-            return false;
-        }
+            if (executor)
+            {
+                std::weak_ptr<IOBase> self = weak_from_this();
+
+                get_mailbox(channel)->push(0, [self, channel, objects, object, others, frame]()
+                {
+                    shared_ptr<Client> client = std::static_pointer_cast<Client>(self.lock());
+                    if (client)
+                        client->dispatch_local(channel, objects, object, others, frame);
+                });
+                return;
+            }
+        }
+
+        dispatch_local(channel, objects, object, others, frame);
+    }
+
+    void Client::dispatch_local(int channel, const vector<ObjectCallback> &objects, shared_ptr<const void> object, const vector<DataCallback> &others, SharedMessage frame)
+    {
+
+        for (auto callback : objects)
+        {
+            // Skip callbacks that were removed while the object was queued
+            {
+                SYNCHRONIZED(mutex);
+                auto current = this->objects.find(channel);
+                if (current == this->objects.end() || current->second.find(callback) == current->second.end())
+                    continue;
+            }
+
+            (*callback)(object);
+        }
+
+        if (frame && !others.empty())
+            dispatch(channel, set<DataCallback>(others.begin(), others.end()), frame);
+    }
+
+    SharedNode Client::get_mailbox(int channel)
+    {
+        SYNCHRONIZED(mutex);
+
+        SharedNode &mailbox = mailboxes[channel];
+        if (!mailbox)
+        {
+            mailbox = make_shared<Node>();
+            mailbox->add_queue(mailbox_capacity, mailbox_policy);
+            executor->add(mailbox);
+        }
+
+        return mailbox;
+    }
+
+    int Client::get_sample(int channel)
+    {
+        SYNCHRONIZED(mutex);
+
+        auto sample = samples.find(channel);
+
+        return (sample == samples.end()) ? 1 : sample->second;
+    }
+
+    void Client::dispatch_task(int channel, function<void()> task)
+    {
+
+        {
+            SYNCHRONIZED(mutex);
+
+            if (executor)
+            {
+                get_mailbox(channel)->push(0, task);
+                return;
+            }
+        }
+
+        task();
+    }
+
+    void Client::complete_sent()
+    {
+
+        vector<function<void()>> callbacks;
+
+        {
+            std::lock_guard<std::mutex> lock(sent_mutex);
+            callbacks.swap(sent);
+        }
+
+        for (auto &callback : callbacks)
+            callback();
+    }
+
+    void Client::end_input()
+    {
+
+        set<int> channels;
+
+        {
+            SYNCHRONIZED(mutex);
+            channels.swap(received);
+        }
+
+        for (int channel : channels)
+        {
+            set<FlushCallback> callbacks;
+
+            {
+                SYNCHRONIZED(mutex);
+
+                if (flushes.find(channel) == flushes.end())
+                    continue;
+
+                callbacks = flushes[channel];
+
+                if (executor && mailboxes.find(channel) != mailboxes.end())
+                {
+                    // Flush after the messages that are still queued in the mailbox
+                    mailboxes[channel]->push(0, [callbacks]()
+                    {
+                        for (auto callback : callbacks)
+                            (*callback)();
+                    });
+                    continue;
+                }
+            }
+
+            for (auto callback : callbacks)
+                (*callback)();
+        }
+    }
+
+    bool Client::subscribe_flush(int channel, const FlushCallback &callback)
+    {
+        SYNCHRONIZED(mutex);
+
+        return flushes[channel].insert(callback).second;
+    }
+
+    bool Client::unsubscribe_flush(int channel, const FlushCallback &callback)
+    {
+        SYNCHRONIZED(mutex);
+
+        if (flushes.find(channel) == flushes.end())
+            return false;
+
+        if (!flushes[channel].erase(callback))
+            return false;
+
+        if (flushes[channel].empty())
+        {
+            flushes.erase(channel);
+            received.erase(channel);
+        }
+
+        return true;
+    }
+
+    void Client::set_executor(SharedExecutor executor, size_t capacity, int policy)
+    {
+        SYNCHRONIZED(mutex);
+
+        // Messages still queued in mailboxes of the previous executor are discarded
+        if (this->executor)
+        {
+            for (auto mailbox : mailboxes)
+                this->executor->remove(mailbox.second);
+        }
+
+        mailboxes.clear();
+
+        this->executor = executor;
+        mailbox_capacity = capacity;
+        mailbox_policy = policy;
+    }
+
+    bool Client::subscribe_object(int channel, const std::type_info &type, const ObjectCallback &callback, const DataCallback &data)
+    {
+        SYNCHRONIZED(mutex);
+
+        return objects[channel].insert(make_pair(callback, make_pair(std::type_index(type), data))).second;
+    }
+
+    bool Client::unsubscribe_object(int channel, const ObjectCallback &callback)
+    {
+        SYNCHRONIZED(mutex);
+
+        if (objects.find(channel) == objects.end())
+            return false;
+
+        if (!objects[channel].erase(callback))
+            return false;
+
+        if (objects[channel].empty())
+            objects.erase(channel);
+
+        return true;
+    }
+
+    bool Client::find_local(int channel, const std::type_info &type, vector<ObjectCallback> &found, vector<DataCallback> &others, int &remote)
+    {
+        SYNCHRONIZED(mutex);
+
+        set<DataCallback> covered;
+
+        if (objects.find(channel) != objects.end())
+        {
+            for (auto it = objects[channel].begin(); it != objects[channel].end(); it++)
+            {
+                if (it->second.first != std::type_index(type))
+                    continue;
+                found.push_back(it->first);
+                covered.insert(it->second.second);
+            }
+        }
+
+        if (subscriptions.find(channel) != subscriptions.end())
+        {
+            for (auto callback : subscriptions[channel])
+                if (covered.find(callback) == covered.end())
+                    others.push_back(callback);
+        }
+
+        if (watch_state.find(channel) == watch_state.end())
+            return false;
+
+        remote = watch_state[channel]->get<int>("subscribers", 0) - (confirmed.find(channel) != confirmed.end() ? 1 : 0);
+
+        return true;
+    }
+
+    bool Client::watch(int channel, const WatchCallback &callback)
+    {
+        SharedDictionary summary;
+
+        {
+            SYNCHRONIZED(mutex);
+
+            if (watches.find(channel) == watches.end())
+            {
+                // Generate a subscription command message
+                SharedDictionary command = generate_command(ROUTIO_COMMAND_WATCH);
+                command->set<int>("channel", channel);
+                std::function<bool(SharedDictionary, SharedDictionary)> callback = [](SharedDictionary x, SharedDictionary y)
+                {
+                    return true;
+                };
+                // add the watch command to message queue
+                send_command(command, callback);
+            }
+            else if (watch_state.find(channel) != watch_state.end() && watches[channel].find(callback) == watches[channel].end())
+            {
+                // Router only sends a summary to the first watcher, replay the last known state
+                summary = make_shared<Dictionary>(*watch_state[channel]);
+                summary->set<string>("type", "summary");
+            }
+
+            if (!watches[channel].insert(callback).second) // Returns pair, the second value is success
+                return false;
+        }
+
+        // Watchers may lock themselves and send messages, so the state is replayed without the lock
+        if (summary)
+            (*callback)(summary);
+
+        return true;
+    }
+
+    bool Client::unwatch(int channel, const WatchCallback &callback)
+    {
+        SYNCHRONIZED(mutex);
+
+        if (watches.find(channel) == watches.end())
+        {
+            DEBUGMSG("Unknown channel %d\n", channel);
+            return false;
+        }
+
+        if (watches[channel].find(callback) == watches[channel].end())
+        {
+            DEBUGMSG("Unknown callback for channel %d\n", channel);
+            return false;
+        }
 
         if (!watches[channel].erase(callback))
             return false;
@@ -415,12 +1067,27 @@ namespace routio
             // add the unwatch command to message queue
             send_command(command, callback);
             watches.erase(channel);
+            watch_state.erase(channel);
         }
 
         return true;
     }
 
-    void Client::send(int channel, SharedMessage message, MessageCallback callback, int priority)
+    void Client::configure(int channel, const SharedDictionary options)
+    {
+        SYNCHRONIZED(mutex);
+
+        SharedDictionary command = generate_command(ROUTIO_COMMAND_CONFIGURE);
+
+        for (auto it = options->begin(); it != options->end(); it++)
+            command->set<string>(it->first, it->second);
+
+        command->set<int>("channel", channel);
+
+        send_command(command);
+    }
+
+    void Client::send(int channel, SharedMessage message, MessageCallback callback, int priority, int target)
     {
 
         SYNCHRONIZED(mutex);
@@ -428,9 +1095,48 @@ namespace routio
         if (!is_connected())
             return;
 
-        shared_ptr<Message> wrapper = make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<int>::wrap(channel), message});
+        shared_ptr<Message> wrapper;
+
+        if (target < 0 && target != ROUTIO_TARGET_OTHERS && target != ROUTIO_TARGET_PROVIDERS)
+            wrapper = make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<int>::wrap(channel), message});
+        else
+            // Negative channel denotes a message directed to a single subscriber
+            wrapper = make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<int>::wrap(-channel), PrimitiveBuffer<int>::wrap(target), message});
+
+        if (multiplexer)
+        {
+            multiplexer->send(logical_id, wrapper, callback, priority);
+            return;
+        }
+
+        if (outgoing)
+        {
+            MessageCallback deferred;
+
+            if (callback)
+            {
+                std::weak_ptr<IOBase> self = weak_from_this();
+
+                deferred = [self, callback](const SharedMessage message, int state)
+                {
+                    shared_ptr<Client> client = std::static_pointer_cast<Client>(self.lock());
+                    if (!client)
+                        return;
+
+                    {
+                        std::lock_guard<std::mutex> lock(client->sent_mutex);
+                        client->sent.push_back([callback, message, state]() { callback(message, state); });
+                    }
+
+                    client->incoming->notify();
+                };
+            }
+
+            outgoing->push(wrapper, deferred);
+            return;
+        }
 
-        if (writer.add_message(wrapper, priority, callback))
+        if (writer->add_message(wrapper, priority, callback))
         {
             notify_output();
         }
@@ -455,11 +1161,9 @@ namespace routio
         return true;
     }
 
-    void Client::lookup_channel(const string &alias, const string &type, function<void(SharedDictionary)> callback, bool create)
+    SharedDictionary Client::lookup_command(const string &alias, const string &type, bool create)
     {
 
-        using namespace std::placeholders;
-
         // Perform remapping of channels
         string real_alias = alias;
         if (mappings.find(alias) != mappings.end())
@@ -467,14 +1171,22 @@ namespace routio
             real_alias = mappings[alias];
         }
 
-        SYNCHRONIZED(mutex);
-
         // Create appropriate command
         SharedDictionary command = generate_command(ROUTIO_COMMAND_LOOKUP);
         command->set<string>("alias", real_alias);
         command->set<string>("type", type);
         command->set<bool>("create", create);
-        this->send_command(command, bind(&internal_lookup_callback, _1, _2, callback));
+        return command;
+    }
+
+    void Client::lookup_channel(const string &alias, const string &type, function<void(SharedDictionary)> callback, bool create)
+    {
+
+        using namespace std::placeholders;
+
+        SYNCHRONIZED(mutex);
+
+        this->send_command(lookup_command(alias, type, create), bind(&internal_lookup_callback, _1, _2, callback));
     }
 
     void Subscriber::lookup_callback(SharedDictionary lookup)
@@ -496,13 +1208,31 @@ namespace routio
 
         MessageReader reader(chunk);
 
-        int sequence = reader.read_integer();
+        int64_t frame_sequence = reader.read_long();
 
-        if (sequence < 0)
+        int index = reader.read_integer();
+
+        // Messages sent by this client to others only take their place in the sequence
+        if (index == ROUTIO_INDEX_SEQUENCE)
         {
+            track_sequence(frame_sequence);
+            return;
+        }
+
+        if (index < 0)
+        {
+
+            // Truncated messages carry their original length
+            int64_t length = (index < -1) ? reader.read_long() : -1;
 
             shared_ptr<Message> message = make_shared<OffsetBufferMessage>(chunk, reader.get_position());
 
+            track_sequence(frame_sequence);
+
+            sequence = frame_sequence;
+            message_length = (length < 0) ? message->get_length() : (size_t)length;
+            statistics.messages_received++;
+
             (*callback)(message);
         }
         else
@@ -510,134 +1240,621 @@ namespace routio
 
             int64_t id = reader.read_long();
 
-            bool valid = true;
-
-            if (pending.find(id) != pending.end())
+            if (pending.find(id) == pending.end())
             {
 
-                SharedMessage cropped = make_shared<OffsetBufferMessage>(chunk, reader.get_position());
+                if (index != 0) {
+                    DEBUGMSG("Not first chunk, ignoring\n");
+                    return;
+                }
 
-                valid = pending[id]->set_chunk(sequence, cropped);
-            }
-            else
-            {
+                int64_t length = reader.read_long();
+                int chunk_size = reader.read_integer();
 
-                if (sequence != 0) {
-                    DEBUGMSG("Not first chunk, ignoring\n");
+                if (length < 1 || chunk_size < 1)
+                {
+                    DEBUGMSG("Illegal chunked message header, ignoring\n");
                     return;
                 }
 
-                if ((int)pending.size() > pending_capacity && pending_capacity > 0)
+                track_sequence(frame_sequence);
+
+                // The length comes from the sender, remaining chunks are ignored without a buffer
+                if (message_limit > 0 && (uint64_t)length > message_limit)
                 {
-                    DEBUGMSG("Too many pending chunks dropping some.\n");
-                    pending.erase(pending.begin());
+                    statistics.messages_dropped++;
+                    on_error(runtime_error(_format_string("Chunked message of %ld bytes exceeds limit, dropping message", length)));
+                    return;
                 }
 
-                int64_t length = reader.read_long();
-                int chunk_size = reader.read_integer();
+                evict_pending((size_t)length);
 
-                pending[id] = make_shared<ChunkList>(length, chunk_size);
+                if (pending.empty())
+                {
+                    if (!pending_timer)
+                    {
+                        pending_timer = make_shared<Timer>([this, liveness = this->liveness]()
+                        {
+                            std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+                            if (liveness->alive)
+                                dispatch_task([this]() { expire_pending(); });
+                        });
+
+                        client->get_loop()->add_handler(pending_timer);
+                    }
+
+                    pending_timer->start(DEFAULT_PENDING_TIMEOUT);
+                }
+
+                pending[id] = make_shared<ChunkBuffer>((size_t)length, (size_t)chunk_size, frame_sequence);
+                pending_size += (size_t)length;
+            }
 
-                SharedMessage cropped = make_shared<OffsetBufferMessage>(chunk, reader.get_position());
+            shared_ptr<ChunkBuffer> buffer = pending[id];
 
-                valid = pending[id]->set_chunk(sequence, cropped);
+            SharedMessage cropped = make_shared<OffsetBufferMessage>(chunk, reader.get_position());
+
+            if (!buffer->set_chunk(index, cropped))
+            {
+                DEBUGMSG("Invalid message chunk, dropping message\n");
+                pending_size -= buffer->get_length();
+                pending.erase(id);
+                statistics.messages_dropped++;
+                return;
             }
 
-            // MemoryBuffer buffer(chunk->get_length());
-            // chunk->copy_data(0, buffer.get_buffer(), buffer.get_length());
+            if (buffer->is_complete())
+            {
+                pending_size -= buffer->get_length();
+                pending.erase(id);
+
+                sequence = buffer->get_sequence();
+                message_length = buffer->get_length();
+                statistics.messages_received++;
+
+                (*callback)(buffer->get_message());
+            }
+        }
+    }
+
+    void Subscriber::track_sequence(int64_t sequence)
+    {
+
+        if (sequence < 0)
+            return;
+
+        if (last_sequence >= 0)
+        {
+            if (sequence <= last_sequence)
+            {
+                DEBUGMSG("Message %ld arrived after %ld\n", sequence, last_sequence);
+                statistics.messages_reordered++;
+                return;
+            }
+
+            // Sampled subscriptions only receive every n-th message
+            int64_t missed = (sequence - last_sequence) / client->get_sample(id) - 1;
+
+            if (missed > 0)
+            {
+                DEBUGMSG("Missed %ld messages before %ld\n", missed, sequence);
+                statistics.gaps++;
+                statistics.messages_lost += (uint64_t)missed;
+            }
+        }
+
+        last_sequence = sequence;
+    }
+
+    int64_t Subscriber::get_sequence() const
+    {
+        return sequence;
+    }
+
+    int64_t Subscriber::get_last_sequence() const
+    {
+        return last_sequence;
+    }
+
+    size_t Subscriber::get_message_length() const
+    {
+        return message_length;
+    }
+
+    void Subscriber::set_message_limit(size_t limit)
+    {
+        message_limit = limit;
+    }
+
+    SubscriberStatistics Subscriber::get_statistics() const
+    {
+        return statistics;
+    }
+
+    void Subscriber::set_pending_limit(size_t limit)
+    {
+        pending_limit = limit;
+    }
+
+    void Subscriber::expire_pending()
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto timeout = std::chrono::milliseconds(DEFAULT_PENDING_TIMEOUT);
+        auto next = now + timeout;
+
+        for (auto it = pending.begin(); it != pending.end();)
+        {
+            if (now - it->second->get_updated() > timeout)
+            {
+                DEBUGMSG("Chunked message timed out, dropping it\n");
+                statistics.messages_dropped++;
+                pending_size -= it->second->get_length();
+                it = pending.erase(it);
+            }
+            else
+            {
+                next = min(next, it->second->get_updated() + timeout);
+                it++;
+            }
+        }
+
+        if (pending_timer && !pending.empty())
+            pending_timer->start(std::chrono::ceil<std::chrono::milliseconds>(next - now).count());
+    }
+
+    void Subscriber::evict_pending(size_t required)
+    {
+        expire_pending();
+
+        // Drop the least recently updated messages until the new one fits into the limits,
+        // a single message larger than the byte limit is still accepted if nothing else is pending
+        while (!pending.empty() && ((pending_capacity > 0 && (int)pending.size() >= pending_capacity) ||
+            (pending_limit > 0 && pending_size + required > pending_limit)))
+        {
+            auto oldest = pending.begin();
+            for (auto it = pending.begin(); it != pending.end(); it++)
+            {
+                if (it->second->get_updated() < oldest->second->get_updated())
+                    oldest = it;
+            }
+
+            DEBUGMSG("Too many pending chunks dropping some.\n");
+            statistics.messages_dropped++;
+            pending_size -= oldest->second->get_length();
+            pending.erase(oldest);
+        }
+    }
+
+    Subscriber::Subscriber(SharedClient client, const string &alias, const string &type, DataCallback callback, int pending_capacity) : statistics(), client(client), pending_capacity(pending_capacity)
+    {
+
+        using namespace std::placeholders;
+
+        liveness = make_shared<Liveness>();
+
+        internal_callback = create_data_callback([this, liveness = this->liveness](SharedMessage message)
+        {
+            std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+            if (liveness->alive)
+                data_callback(message);
+        });
+
+        this->callback = (callback) ? callback : create_data_callback(bind(&Subscriber::on_message, this, _1));
+
+        client->lookup_channel(alias, type, bind(&Subscriber::lookup_callback, this, _1));
+    }
+
+    Subscriber::~Subscriber()
+    {
+
+        unsubscribe();
+
+        if (pending_timer)
+            client->get_loop()->remove_handler(pending_timer);
+    }
+
+    bool Subscriber::subscribe()
+    {
+        if (this->id < 1)
+            return false;
+        {
+            std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+            liveness->alive = true;
+        }
+        if (object_callback)
+            client->subscribe_object(id, *object_type, object_callback, internal_callback);
+        if (flush_callback)
+            client->subscribe_flush(id, flush_callback);
+        return client->subscribe(id, internal_callback, options);
+    }
+
+    void Subscriber::set_flush_callback(FlushCallback callback)
+    {
+        if (flush_callback && id > 0)
+            client->unsubscribe_flush(id, flush_callback);
+
+        if (!callback)
+        {
+            flush_callback.reset();
+            return;
+        }
+
+        flush_callback = create_flush_callback([callback, liveness = this->liveness]()
+        {
+            std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+            if (liveness->alive)
+                (*callback)();
+        });
+    }
+
+    void Subscriber::set_object_callback(const std::type_info &type, ObjectCallback callback)
+    {
+        if (object_callback && id > 0)
+            client->unsubscribe_object(id, object_callback);
+
+        object_type = &type;
+
+        if (!callback)
+        {
+            object_callback.reset();
+            return;
+        }
+
+        object_callback = create_object_callback([callback, liveness = this->liveness](shared_ptr<const void> object)
+        {
+            std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+            if (liveness->alive)
+                (*callback)(object);
+        });
+    }
+
+    void Subscriber::dispatch_task(function<void()> task)
+    {
+        if (id < 1)
+            return;
+
+        client->dispatch_task(id, [task, liveness = this->liveness]()
+        {
+            std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+            if (liveness->alive)
+                task();
+        });
+    }
+
+    void Subscriber::request_history(size_t count)
+    {
+        if (!options)
+            options = make_shared<Dictionary>();
+        options->set<int>("history", (int)count);
+        options->set<int64_t>("since", -1);
+    }
+
+    void Subscriber::request_history_since(int64_t sequence)
+    {
+        if (!options)
+            options = make_shared<Dictionary>();
+        options->set<int>("history", 0);
+        options->set<int64_t>("since", sequence);
+    }
+
+    void Subscriber::request_truncated(size_t bytes)
+    {
+        if (!options)
+            options = make_shared<Dictionary>();
+        options->set<int>("truncate", (int)bytes);
+    }
+
+    void Subscriber::request_sampled(int interval)
+    {
+        if (!options)
+            options = make_shared<Dictionary>();
+        options->set<int>("sample", max(1, interval));
+    }
+
+    bool Subscriber::unsubscribe()
+    {
+        {
+            // Waits for a callback that is running on another thread
+            std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+            liveness->alive = false;
+        }
+        if (this->id < 1)
+            return false;
+        if (object_callback)
+            client->unsubscribe_object(id, object_callback);
+        if (flush_callback)
+            client->unsubscribe_flush(id, flush_callback);
+        return client->unsubscribe(id, internal_callback);
+    }
+
+    void Subscriber::on_ready()
+    {
+    }
+
+    void Subscriber::on_message(SharedMessage message)
+    {
+    }
+
+    void Subscriber::on_error(const std::exception &error)
+    {
+    }
+
+    BatchSubscriber::BatchSubscriber(SharedClient client, const string &alias, const string &type, BatchCallback callback, size_t batch_size, int64_t max_wait, SharedIOLoop loop) : Subscriber(client, alias, type), callback(callback), batch_size(max<size_t>(batch_size, 1)), max_wait(max<int64_t>(max_wait, 0)), loop(loop)
+    {
+
+        batch.reserve(this->batch_size);
+
+        // Covers messages delivered without reading from the connection, e.g. from publishers of the same client.
+        // The timer fires on the loop, the batch is delivered like the messages themselves.
+        timer = make_shared<Timer>([this, liveness = this->liveness]()
+        {
+            // The loop may still fire a timer that was removed while it was being handled
+            std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+            if (liveness->alive)
+                dispatch_task([this]() { flush(); });
+        });
+
+        loop->add_handler(timer);
+
+        set_flush_callback(create_flush_callback([this]()
+        {
+            // Batches that may wait are completed when full or by the timer
+            if (this->max_wait == 0)
+                flush();
+        }));
+    }
+
+    BatchSubscriber::~BatchSubscriber()
+    {
+        unsubscribe();
+
+        loop->remove_handler(timer);
+    }
+
+    bool BatchSubscriber::unsubscribe()
+    {
+        bool result = Subscriber::unsubscribe();
+
+        timer->stop();
+
+        return result;
+    }
+
+    void BatchSubscriber::on_message(SharedMessage message)
+    {
+        std::lock_guard<std::recursive_mutex> lock(batch_mutex);
+
+        batch.push_back(message);
+
+        if (batch.size() >= batch_size)
+        {
+            flush();
+            return;
+        }
+
+        if (batch.size() == 1)
+            timer->start(max_wait);
+    }
+
+    void BatchSubscriber::on_batch(span<SharedMessage> messages)
+    {
+        if (callback)
+            (*callback)(messages);
+    }
+
+    void BatchSubscriber::flush()
+    {
+        std::lock_guard<std::recursive_mutex> lock(batch_mutex);
+
+        timer->stop();
+
+        if (batch.empty())
+            return;
+
+        vector<SharedMessage> messages;
+        messages.reserve(batch_size);
+        messages.swap(batch);
+
+        on_batch(span<SharedMessage>(messages));
+    }
+
+    LatestSubscriber::LatestSubscriber(SharedClient client, const string &alias, const string &type) : Subscriber(client, alias, type), received(0)
+    {
+    }
+
+    LatestSubscriber::~LatestSubscriber()
+    {
+        unsubscribe();
+    }
+
+    void LatestSubscriber::on_message(SharedMessage message)
+    {
+        latest.store(message, std::memory_order_release);
+        received.fetch_add(1, std::memory_order_release);
+    }
+
+    SharedMessage LatestSubscriber::get_latest() const
+    {
+        return latest.load(std::memory_order_acquire);
+    }
+
+    uint64_t LatestSubscriber::get_received() const
+    {
+        return received.load(std::memory_order_acquire);
+    }
+
+    StreamSubscriber::StreamSubscriber(SharedClient client, const string &alias, const string &type, StreamCallback callback) : Subscriber(client, alias, type)
+    {
+
+        using namespace std::placeholders;
+
+        stream_callback = (callback) ? callback : create_stream_callback(bind(&StreamSubscriber::on_chunk, this, _1, _2, _3));
+    }
+
+    StreamSubscriber::~StreamSubscriber()
+    {
+        unsubscribe();
+    }
+
+    void StreamSubscriber::on_chunk(SharedMessage chunk, size_t offset, size_t length)
+    {
+    }
+
+    void StreamSubscriber::data_callback(SharedMessage chunk)
+    {
+
+        MessageReader reader(chunk);
+
+        int64_t frame_sequence = reader.read_long();
+
+        int index = reader.read_integer();
+
+        if (index == ROUTIO_INDEX_SEQUENCE)
+        {
+            track_sequence(frame_sequence);
+            return;
+        }
+
+        if (index < 0)
+        {
+
+            int64_t length = (index < -1) ? reader.read_long() : -1;
+
+            shared_ptr<Message> message = make_shared<OffsetBufferMessage>(chunk, reader.get_position());
+
+            track_sequence(frame_sequence);
+
+            sequence = frame_sequence;
+            message_length = (length < 0) ? message->get_length() : (size_t)length;
+            statistics.messages_received++;
+
+            // Truncated message arrives as the first chunk of a longer message
+            (*stream_callback)(message, 0, message_length);
+
+            return;
+        }
+
+        int64_t id = reader.read_long();
+
+        auto now = std::chrono::steady_clock::now();
+
+        if (streams.find(id) == streams.end())
+        {
+
+            if (index != 0)
+            {
+                DEBUGMSG("Not first chunk, ignoring\n");
+                return;
+            }
 
-            // string tmp((char*)buffer.get_buffer(), buffer.get_length());
+            int64_t length = reader.read_long();
+            int chunk_size = reader.read_integer();
 
-            if (!valid)
+            if (length < 1 || chunk_size < 1)
             {
-                DEBUGMSG("Invalid message chunk, dropping message\n");
-                pending.erase(id);
+                DEBUGMSG("Illegal chunked message header, ignoring\n");
                 return;
             }
 
-            if (pending[id]->is_complete())
+            track_sequence(frame_sequence);
+
+            for (auto it = streams.begin(); it != streams.end();)
             {
-                shared_ptr<ChunkList> chunks = pending[id];
+                if (now - it->second.updated > std::chrono::milliseconds(DEFAULT_PENDING_TIMEOUT))
+                {
+                    statistics.messages_dropped++;
+                    it = streams.erase(it);
+                }
+                else
+                    it++;
+            }
 
-                pending.erase(id);
+            streams[id] = StreamState{(size_t)length, (size_t)chunk_size, 0, 0, frame_sequence, now};
+        }
 
-                shared_ptr<Message> message = make_shared<MultiBufferMessage>(chunks->cbegin(), chunks->cend());
+        StreamState &state = streams[id];
 
-                (*callback)(message);
-            }
+        SharedMessage cropped = make_shared<OffsetBufferMessage>(chunk, reader.get_position());
+
+        if (index != state.next || cropped->get_length() != min(state.chunk_size, state.length - state.offset))
+        {
+            streams.erase(id);
+            statistics.messages_dropped++;
+            on_error(runtime_error("Stream chunk missing, dropping message"));
+            return;
         }
-    }
 
-    Subscriber::Subscriber(SharedClient client, const string &alias, const string &type, DataCallback callback, int pending_capacity) : client(client), pending_capacity(pending_capacity)
-    {
+        size_t offset = state.offset;
+        size_t length = state.length;
 
-        using namespace std::placeholders;
+        state.next++;
+        state.offset += cropped->get_length();
+        state.updated = now;
 
-        internal_callback = create_data_callback(bind(&Subscriber::data_callback, this, _1));
+        sequence = state.sequence;
+        message_length = state.length;
 
-        this->callback = (callback) ? callback : create_data_callback(bind(&Subscriber::on_message, this, _1));
+        if (state.offset == state.length)
+        {
+            streams.erase(id);
+            statistics.messages_received++;
+        }
 
-        client->lookup_channel(alias, type, bind(&Subscriber::lookup_callback, this, _1));
+        (*stream_callback)(cropped, offset, length);
     }
 
-    Subscriber::~Subscriber()
+    Subscriber::ChunkBuffer::ChunkBuffer(size_t length, size_t chunk_size, int64_t sequence) : message(make_shared<BufferedMessage>(length)), sequence(sequence), chunk_size(chunk_size), next(0), updated(std::chrono::steady_clock::now())
     {
-
-        unsubscribe();
+        chunks = (int)ceil((double)length / (double)chunk_size);
     }
 
-    bool Subscriber::subscribe()
+    Subscriber::ChunkBuffer::~ChunkBuffer()
     {
-        if (this->id < 1)
-            return false;
-        return client->subscribe(id, internal_callback);
     }
 
-    bool Subscriber::unsubscribe()
+    bool Subscriber::ChunkBuffer::set_chunk(int index, SharedMessage &chunk)
     {
-        if (this->id < 1)
+        // Chunks are delivered in order, anything else means that some were lost
+        if (index != next || index >= chunks)
             return false;
-        return client->unsubscribe(id, internal_callback);
-    }
 
-    void Subscriber::on_ready()
-    {
-    }
+        size_t position = (size_t)index * chunk_size;
+        size_t length = min(chunk_size, message->get_length() - position);
 
-    void Subscriber::on_message(SharedMessage message)
-    {
+        if (chunk->get_length() != length)
+            return false;
+
+        chunk->copy_data(0, message->get_buffer() + position, length);
+
+        next++;
+        updated = std::chrono::steady_clock::now();
+
+        return true;
     }
 
-    void Subscriber::on_error(const std::exception &error)
+    bool Subscriber::ChunkBuffer::is_complete() const
     {
+        return next == chunks;
     }
 
-    Subscriber::ChunkList::ChunkList(int length, int chunk_size) : vector<SharedMessage>(), chunk_size(chunk_size)
+    size_t Subscriber::ChunkBuffer::get_length() const
     {
-        int chunks = (int)ceil((double)length / (double)chunk_size);
-
-        resize(chunks, SharedMessage());
+        return message->get_length();
     }
 
-    Subscriber::ChunkList::~ChunkList()
+    std::chrono::steady_clock::time_point Subscriber::ChunkBuffer::get_updated() const
     {
+        return updated;
     }
 
-    bool Subscriber::ChunkList::set_chunk(int index, SharedMessage &chunk)
+    SharedMessage Subscriber::ChunkBuffer::get_message() const
     {
-
-        if (index > 0 && !at(index - 1))
-            return false;
-
-        (*this)[index] = chunk;
-
-        return true;
+        return message;
     }
 
-    bool Subscriber::ChunkList::is_complete() const
+    int64_t Subscriber::ChunkBuffer::get_sequence() const
     {
-
-        return (at(size() - 1)) ? true : false;
+        return sequence;
     }
 
     void Watcher::lookup_callback(SharedDictionary lookup)
@@ -699,34 +1916,146 @@ namespace routio
 
         id = lookup->get<int>("channel", -1);
 
+        if (id > 0)
+            client->watch(id, demand_callback);
+
+        if (configuration)
+            client->configure(id, configuration);
+
         on_ready();
     }
 
-    void Publisher::send_callback(const SharedMessage, int state)
+    void Publisher::watch_callback(SharedDictionary event)
+    {
+
+        string type = event->get<string>("type", "");
+
+        if (type == "subscribe" || type == "unsubscribe" || type == "summary")
+            subscribers = event->get<int>("subscribers", 0);
+    }
+
+    void Publisher::send_callback(const SharedMessage message, int state, std::chrono::steady_clock::time_point queued, bool last, int64_t stream)
     {
 
         if (state != MESSAGE_CALLBACK_SENT && state != MESSAGE_CALLBACK_DROPPED)
             return;
 
-        pending--;
+        // Chunks of an earlier stream do not affect the current one
+        if (stream >= 0 && stream == stream_identifier)
+        {
+            stream_chunks--;
+            if (state == MESSAGE_CALLBACK_DROPPED)
+                stream_dropped = true;
+        }
+
+        if (last)
+            pending--;
+
+        if (state == MESSAGE_CALLBACK_DROPPED)
+        {
+            statistics.data_dropped += message->get_length();
+            if (last)
+                on_sent();
+            return;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+
+        statistics.chunks_sent++;
+        statistics.data_sent += message->get_length();
+        if (last)
+            statistics.messages_sent++;
+
+        statistics.latency = 0.8 * statistics.latency + 0.2 * std::chrono::duration<double>(now - queued).count();
+
+        // Only the time spent writing this chunk counts, not the time spent waiting for
+        // the previous ones. Small messages are dominated by overhead and are not sampled.
+        std::chrono::duration<double> elapsed = now - max(queued, last_sent);
+        last_sent = now;
+
+        if (message->get_length() >= min_chunk_size)
+        {
+            double throughput = (double)message->get_length() / max(elapsed.count(), 1e-6);
+
+            statistics.throughput = (statistics.throughput > 0) ? 0.8 * statistics.throughput + 0.2 * throughput : throughput;
+
+            if (min_chunk_size != max_chunk_size)
+            {
+                size_t target = (size_t)(statistics.throughput * DEFAULT_CHUNK_TARGET_TIME / 1000000);
+
+                // Round to whole pages to avoid changing the size on every sample
+                target = (target / 4096) * 4096;
+
+                chunk_size = max(min_chunk_size, min(max_chunk_size, target));
+                statistics.chunk_size = chunk_size;
+            }
+        }
+
+        if (last)
+            on_sent();
     }
 
     void Publisher::on_ready()
     {
     }
 
-    Publisher::Publisher(SharedClient client, const string &alias, const string &type, int queue, size_t chunk_size) : client(client), queue(queue), chunk_size(chunk_size)
+    void Publisher::on_sent()
+    {
+    }
+
+    bool Publisher::has_credit() const
     {
+        return queue <= 0 || pending < queue;
+    }
+
+    Publisher::Publisher(SharedClient client, const string &alias, const string &type, int queue, size_t chunk_size) : liveness(make_shared<Liveness>()), client(client), queue(queue), chunk_size(chunk_size),
+                                                                                                                        min_chunk_size(DEFAULT_MIN_CHUNK_SIZE), max_chunk_size(DEFAULT_MAX_CHUNK_SIZE), statistics()
+    {
+
+        // Chunk size is fixed unless bounds for adaptation are set
+        if (!set_chunk_bounds(min(chunk_size, (size_t)MAX_CHUNK_SIZE), min(chunk_size, (size_t)MAX_CHUNK_SIZE)))
+            set_chunk_bounds(DEFAULT_CHUNK_SIZE, DEFAULT_CHUNK_SIZE);
 
         identifier_generator = std::bind(std::uniform_int_distribution<int64_t>{}, std::mt19937(std::random_device{}()));
 
-        using namespace std::placeholders;
+        liveness->alive = true;
+
+        demand_callback = create_watch_callback([this, liveness = this->liveness](SharedDictionary event)
+        {
+            std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+            if (liveness->alive)
+                watch_callback(event);
+        });
 
-        client->lookup_channel(alias, type, bind(&Publisher::lookup_callback, this, alias, _1));
+        client->lookup_channel(alias, type, [this, alias, liveness = this->liveness](SharedDictionary lookup)
+        {
+            std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+            if (liveness->alive)
+                lookup_callback(alias, lookup);
+        });
     }
 
     Publisher::~Publisher()
     {
+
+        {
+            // Waits for a callback that is running on another thread, chunks may still be queued
+            std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+            liveness->alive = false;
+        }
+
+        if (id > 0)
+            client->unwatch(id, demand_callback);
+    }
+
+    MessageCallback Publisher::create_send_callback(bool last, int64_t stream)
+    {
+        return [this, liveness = this->liveness, queued = std::chrono::steady_clock::now(), last, stream](const SharedMessage message, int state)
+        {
+            std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+            if (liveness->alive)
+                send_callback(message, state, queued, last, stream);
+        };
     }
 
     int Publisher::get_channel_id()
@@ -734,6 +2063,130 @@ namespace routio
         return id;
     }
 
+    bool Publisher::set_chunk_bounds(size_t minimum, size_t maximum)
+    {
+
+        if (minimum < 1 || minimum > maximum || maximum > MAX_CHUNK_SIZE)
+            return false;
+
+        std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+
+        min_chunk_size = minimum;
+        max_chunk_size = maximum;
+
+        chunk_size = max(minimum, min(maximum, chunk_size.load()));
+        statistics.chunk_size = chunk_size;
+
+        return true;
+    }
+
+    size_t Publisher::get_chunk_size() const
+    {
+        return chunk_size;
+    }
+
+    PublisherStatistics Publisher::get_statistics() const
+    {
+        // Statistics are updated by send callbacks on the loop thread
+        std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+        return statistics;
+    }
+
+    int Publisher::get_subscribers() const
+    {
+        return subscribers;
+    }
+
+    void Publisher::set_latched(bool latched)
+    {
+
+        if (!configuration)
+            configuration = make_shared<Dictionary>();
+
+        configuration->set<bool>("latched", latched);
+
+        if (id > 0)
+            client->configure(id, configuration);
+    }
+
+    void Publisher::set_history(size_t count, size_t bytes, int64_t time)
+    {
+
+        if (!configuration)
+            configuration = make_shared<Dictionary>();
+
+        configuration->set<int>("history", (int)count);
+        configuration->set<int64_t>("history_bytes", (int64_t)bytes);
+        configuration->set<int64_t>("history_time", time);
+
+        if (id > 0)
+            client->configure(id, configuration);
+    }
+
+    bool Publisher::send_lazy(function<SharedMessage()> producer)
+    {
+
+        if (id <= 0 || subscribers < 1)
+            return false;
+
+        if (queue > 0 && pending >= queue)
+            return false;
+
+        SharedMessage message = producer();
+
+        if (!message)
+            return false;
+
+        return send_message_internal(message, id);
+    }
+
+    bool Publisher::send_object(const std::type_info &type, function<shared_ptr<const void>()> object, function<SharedMessage()> serialize)
+    {
+
+        if (id <= 0)
+            return false;
+
+        vector<ObjectCallback> objects;
+        vector<DataCallback> others;
+        int remote = 0;
+
+        bool known = client->find_local(id, type, objects, others, remote);
+
+        if (objects.empty())
+            return send_message_internal(serialize(), id);
+
+        shared_ptr<const void> value = object();
+
+        // Channels that keep messages need them in the router even without subscribers
+        bool retained = configuration && (configuration->get<bool>("latched", false) || configuration->get<int>("history", 0) > 0 ||
+                                          configuration->get<int64_t>("history_bytes", 0) > 0 || configuration->get<int64_t>("history_time", 0) > 0);
+
+        bool forward = !known || remote > 0 || retained;
+
+        if (!forward && others.empty())
+        {
+            client->deliver_local(id, objects, value, others, SharedMessage());
+            return true;
+        }
+
+        SharedMessage message = serialize();
+
+        bool sent = true;
+
+        if (forward)
+            sent = send_message_internal(message, id, ROUTIO_TARGET_OTHERS);
+
+        // Router does not return the message to this client, deliver it to the remaining subscribers here
+        SharedMessage frame;
+
+        if (!others.empty())
+            frame = make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<int64_t>::wrap(-1), PrimitiveBuffer<int>::wrap(-1), message});
+
+        client->deliver_local(id, objects, value, others, frame);
+
+        return sent;
+    }
+
     bool Publisher::send_message(uchar *data, int length)
     {
 
@@ -752,7 +2205,16 @@ namespace routio
         return send_message_internal(make_shared<BufferedMessage>(writer), id);
     }
 
-    bool Publisher::send_message_internal(SharedMessage message, int channel)
+    bool Publisher::send_message_to(int subscriber, MessageWriter &writer)
+    {
+
+        if (id <= 0 || subscriber < 0)
+            return false;
+
+        return send_message_internal(make_shared<BufferedMessage>(writer), id, subscriber);
+    }
+
+    bool Publisher::send_message_internal(SharedMessage message, int channel, int target)
     {
 
         if (queue > 0 && pending >= queue)
@@ -761,8 +2223,6 @@ namespace routio
         if (id <= 0)
             return false;
 
-        using namespace std::placeholders;
-
         size_t length = message->get_length();
 
         pending++;
@@ -770,38 +2230,20 @@ namespace routio
         if (length > chunk_size)
         {
 
-            int chunks = (int)ceil((double)length / (double)chunk_size);
-            int position = 0;
+            // Chunk size may be adapted while the chunks are being sent
+            size_t size = chunk_size;
+            int chunks = (int)ceil((double)length / (double)size);
+            size_t position = 0;
 
             int64_t identifier = identifier_generator();
 
             for (int i = 0; i < chunks; i++)
             {
+                size_t clen = min(length - position, size);
 
-                shared_ptr<MemoryBuffer> header = make_shared<MemoryBuffer>((i == 0 ? 2 : 1) * (sizeof(int64_t) + sizeof(int32_t)));
-                MessageWriter writer(header->get_buffer(), header->get_length());
-                writer.write_integer(i);
-                writer.write_long(identifier);
-                if (i == 0)
-                {
-                    writer.write_long(length);
-                    writer.write_integer(chunk_size);
-                }
-
-                size_t clen = min(length - position, (size_t)chunk_size);
-
-                shared_ptr<Message> chunk = make_shared<MultiBufferMessage>(initializer_list<SharedBuffer>{
-                    header,
-                    make_shared<ProxyBuffer>(message, position, clen)});
-
-                if (i + 1 == chunks)
-                {
-                    client->send(get_channel_id(), chunk, bind(&Publisher::send_callback, this, _1, _2));
-                }
-                else
-                    client->send(get_channel_id(), chunk);
+                send_chunk(i, identifier, length, size, make_shared<ProxyBuffer>(message, position, clen), i + 1 == chunks, target);
 
-                position += chunk_size;
+                position += size;
             }
         }
         else
@@ -815,12 +2257,158 @@ namespace routio
                 header,
                 message});
 
-            client->send(get_channel_id(), chunk, bind(&Publisher::send_callback, this, _1, _2));
+            client->send(get_channel_id(), chunk, create_send_callback(true), 0, target);
+        }
+
+        return true;
+    }
+
+    void Publisher::send_chunk(int index, int64_t identifier, size_t length, size_t chunk_size, SharedBuffer data, bool last, int target, bool stream)
+    {
+
+        shared_ptr<MemoryBuffer> header = make_shared<MemoryBuffer>((index == 0 ? 2 : 1) * (sizeof(int64_t) + sizeof(int32_t)));
+        MessageWriter writer(header->get_buffer(), header->get_length());
+        writer.write_integer(index);
+        writer.write_long(identifier);
+        if (index == 0)
+        {
+            writer.write_long(length);
+            writer.write_integer(chunk_size);
+        }
+
+        shared_ptr<Message> chunk = make_shared<MultiBufferMessage>(initializer_list<SharedBuffer>{header, data});
+
+        if (stream)
+            stream_chunks++;
+
+        client->send(get_channel_id(), chunk, create_send_callback(last, stream ? identifier : -1), 0, target);
+    }
+
+    bool Publisher::begin_stream(size_t length)
+    {
+
+        if (streaming || length < 1)
+            return false;
+
+        if (queue > 0 && pending >= queue)
+            return false;
+
+        if (id <= 0)
+            return false;
+
+        pending++;
+
+        streaming = true;
+        stream_identifier = identifier_generator();
+        stream_length = length;
+        stream_position = 0;
+        stream_index = 0;
+        stream_chunk_size = chunk_size;
+        stream_fill = 0;
+        stream_buffer = make_shared<MemoryBuffer>(min(length, stream_chunk_size));
+        stream_chunks = 0;
+        stream_dropped = false;
+
+        return true;
+    }
+
+    size_t Publisher::write(const uchar *data, size_t length)
+    {
+
+        if (!streaming || stream_dropped)
+            return 0;
+
+        if (stream_position + stream_fill + length > stream_length)
+            return 0;
+
+        size_t written = 0;
+
+        while (true)
+        {
+
+            // A filled chunk is kept until there is room for it in the outgoing queue, otherwise
+            // chunks would be dropped from the middle of the message
+            if (stream_buffer && stream_fill == stream_buffer->get_length())
+            {
+                if (!flush_stream(false))
+                    break;
+            }
+
+            if (length == 0)
+                break;
+
+            size_t clen = min(length, stream_buffer->get_length() - stream_fill);
+
+            memcpy(stream_buffer->get_buffer() + stream_fill, data, clen);
+
+            stream_fill += clen;
+            data += clen;
+            length -= clen;
+            written += clen;
         }
 
+        return written;
+    }
+
+    bool Publisher::flush_stream(bool force)
+    {
+
+        if (!force && stream_chunks >= stream_window)
+            return false;
+
+        stream_position += stream_fill;
+        bool last = stream_position == stream_length;
+
+        send_chunk(stream_index++, stream_identifier, stream_length, stream_chunk_size, stream_buffer, last, -1, true);
+
+        stream_fill = 0;
+        stream_buffer.reset();
+
+        if (!last)
+            stream_buffer = make_shared<MemoryBuffer>(min(stream_length - stream_position, stream_chunk_size));
+
         return true;
     }
 
+    bool Publisher::end()
+    {
+
+        if (!streaming)
+            return false;
+
+        // The last chunk may still wait for room in the queue
+        if (stream_buffer && stream_fill > 0 && stream_position + stream_fill == stream_length)
+            flush_stream(true);
+
+        streaming = false;
+        stream_buffer.reset();
+
+        // An incomplete message is abandoned and will be discarded by subscribers once it times out
+        if (stream_position != stream_length)
+        {
+            DEBUGMSG("Stream ended prematurely, %ld of %ld bytes written\n", stream_position, stream_length);
+            pending--;
+            return false;
+        }
+
+        return !stream_dropped;
+    }
+
+    void Publisher::set_stream_window(int chunks)
+    {
+        stream_window = max(chunks, 1);
+    }
+
+    bool Publisher::is_streaming() const
+    {
+        return streaming;
+    }
+
+    bool Publisher::is_stream_dropped() const
+    {
+        return streaming && stream_dropped;
+    }
+
     Publisher::ProxyBuffer::ProxyBuffer(SharedMessage parent, size_t start, size_t length) : parent(parent), start(start), length(length)
     {
     }
@@ -0,0 +1,25 @@
+
+#include <routio/coroutine.h>
+
+namespace routio {
+
+ChannelLookup::ChannelLookup(SharedClient client, const string &alias, const string &type, bool create) : client(client), alias(alias), type(type), create(create) {
+
+}
+
+void ChannelLookup::await_suspend(std::coroutine_handle<> handle) {
+
+    waiting = handle;
+
+    SYNCHRONIZED(client->mutex);
+
+    // The callback only refers to the awaiter, which lives in the suspended coroutine
+    client->send_command(client->lookup_command(alias, type, create), [this](SharedDictionary sent, SharedDictionary received) {
+        result = received;
+        waiting.resume();
+        return true;
+    });
+
+}
+
+}
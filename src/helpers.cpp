@@ -0,0 +1,144 @@
+
+#include <routio/helpers.h>
+
+// Changed bytes closer than this are merged into a single run
+#define PATCH_RUN_GAP 16
+
+namespace routio {
+
+typedef struct PatchRun {
+    size_t offset;
+    size_t removed;
+    size_t inserted;
+} PatchRun;
+
+void write_patch(MessageWriter &writer, const vector<uchar> &previous, const vector<uchar> &current) {
+
+    size_t limit = min(previous.size(), current.size());
+
+    size_t prefix = 0;
+    while (prefix < limit && previous[prefix] == current[prefix])
+        prefix++;
+
+    size_t suffix = 0;
+    while (suffix < limit - prefix && previous[previous.size() - suffix - 1] == current[current.size() - suffix - 1])
+        suffix++;
+
+    vector<PatchRun> runs;
+
+    if (previous.size() == current.size()) {
+
+        size_t end = current.size() - suffix;
+        size_t i = prefix;
+
+        while (i < end) {
+
+            if (previous[i] == current[i]) {
+                i++;
+                continue;
+            }
+
+            size_t start = i;
+            size_t last = i;
+
+            while (i < end && i - last <= PATCH_RUN_GAP) {
+                if (previous[i] != current[i])
+                    last = i;
+                i++;
+            }
+
+            runs.push_back(PatchRun{start, last + 1 - start, last + 1 - start});
+
+        }
+
+    } else {
+
+        runs.push_back(PatchRun{prefix, previous.size() - prefix - suffix, current.size() - prefix - suffix});
+
+    }
+
+    writer.write_long(current.size());
+    writer.write_integer(runs.size());
+
+    // Offsets refer to the previous buffer, inserted data is taken from the same position in the
+    // current one, which is shifted only by the runs before it
+    int64_t shift = 0;
+
+    for (auto run : runs) {
+        writer.write_long(run.offset);
+        writer.write_long(run.removed);
+        writer.write_long(run.inserted);
+        writer.write_buffer(current.data() + run.offset + shift, run.inserted);
+        shift += (int64_t) run.inserted - (int64_t) run.removed;
+    }
+
+}
+
+bool read_patch(MessageReader &reader, vector<uchar> &buffer) {
+
+    try {
+
+        size_t length = reader.read_long();
+        int count = reader.read_integer();
+
+        // Every byte of the result comes either from the buffer or from the patch
+        if (count < 0 || length > buffer.size() + (reader.get_length() - reader.get_position()))
+            return false;
+
+        vector<uchar> result;
+        result.reserve(length);
+
+        size_t position = 0;
+
+        for (int i = 0; i < count; i++) {
+
+            size_t offset = reader.read_long();
+            size_t removed = reader.read_long();
+            size_t inserted = reader.read_long();
+
+            if (offset < position || offset > buffer.size() || removed > buffer.size() - offset)
+                return false;
+
+            if (offset - position > length - result.size() || inserted > length - result.size() - (offset - position))
+                return false;
+
+            if (inserted > reader.get_length() - reader.get_position())
+                return false;
+
+            result.insert(result.end(), buffer.begin() + position, buffer.begin() + offset);
+
+            if (inserted > 0) {
+                size_t at = result.size();
+                result.resize(at + inserted);
+                reader.copy_data(result.data() + at, inserted);
+            }
+
+            position = offset + removed;
+        }
+
+        result.insert(result.end(), buffer.begin() + position, buffer.end());
+
+        if (result.size() != length)
+            return false;
+
+        buffer.swap(result);
+
+        return true;
+
+    } catch (EndOfBufferException &e) {
+        return false;
+    }
+
+}
+
+vector<uchar> serialize_message(const SharedMessage message) {
+
+    vector<uchar> data(message->get_length());
+
+    message->copy_data(0, data.data(), data.size());
+
+    return data;
+
+}
+
+}
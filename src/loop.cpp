@@ -4,6 +4,8 @@
 #include <sys/un.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <chrono>
 #include <algorithm>
 
@@ -23,10 +25,24 @@ IOLoop::IOLoop() {
         throw runtime_error("Unable to use epoll");
     }
 
+    // Wakes up the loop when coroutines are scheduled from other threads
+    wfd = eventfd(0, EFD_NONBLOCK);
+    if (wfd == -1) {
+        throw runtime_error("Unable to create event");
+    }
+
+    struct epoll_event event;
+    event.data.fd = wfd;
+    event.events = EPOLLIN;
+    if (epoll_ctl (efd, EPOLL_CTL_ADD, wfd, &event) == -1) {
+        throw runtime_error(_format_string("Unable to use epoll (%d)", errno));
+    }
+
 }
 
 IOLoop::~IOLoop() {
 
+    close(wfd);
 
 }
 
@@ -55,6 +71,16 @@ bool IOBase::unobserve(SharedIOBaseObserver observer) {
     return true;
 }
 
+shared_ptr<IOLoop> IOBase::get_loop() {
+
+    SYNCHRONIZED(mutex);
+
+    SharedIOLoop loop = owner.lock();
+
+    return loop ? loop : default_loop();
+
+}
+
 void IOBase::notify_output() {
 
     if (observers.size() > 0) {
@@ -69,6 +95,15 @@ void IOBase::notify_output() {
 
 void IOLoop::add_handler(SharedIOBase base) {
 
+    {
+        // Set before taking the loop lock, handlers call into the loop while holding their own
+        SYNCHRONIZED(base->mutex);
+
+        base->owner = weak_from_this();
+    }
+
+    SYNCHRONIZED(mutex);
+
 	int fd = base->get_file_descriptor();
 
 	//if (handlers.find(fd) != handlers.end()) {
@@ -88,11 +123,14 @@ void IOLoop::add_handler(SharedIOBase base) {
 
 void IOLoop::remove_handler(SharedIOBase base) {
 
+    SYNCHRONIZED(mutex);
+
 	int fd = base->get_file_descriptor();
 
     DEBUGMSG("Removing client handler FID=%d\n", fd);
 
-	if (handlers.find(fd) == handlers.end()) {
+	// The descriptor may already be reused by another handler
+	if (handlers.find(fd) == handlers.end() || handlers[fd] != base) {
 		DEBUGMSG("Listener for file descriptor not registered\n");
         return;
 	}
@@ -115,7 +153,7 @@ bool IOLoop::wait(int64_t timeout) {
     bool write_done = true;
 
     auto start = std::chrono::system_clock::now();
-    while (handlers.size() > 0) {
+    while (true) {
         auto current = std::chrono::system_clock::now();
 
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(current - start);
@@ -128,38 +166,96 @@ bool IOLoop::wait(int64_t timeout) {
                 break;
             if (!write_done) remaining = 1;
         }
+
+        vector<function<void()> > pending;
+
+        {
+            // Handlers, coroutines and tasks may be added from other threads
+            SYNCHRONIZED(mutex);
+
+            pending.swap(tasks);
+
+            if (pending.empty() && handlers.size() == 0 && sleeping.size() == 0)
+                break;
+
+            if (sleeping.size() > 0) {
+                auto until = std::chrono::ceil<std::chrono::milliseconds>(sleeping.begin()->first - std::chrono::steady_clock::now()).count();
+                until = max<int64_t>(until, 0);
+                remaining = (remaining < 0) ? until : min(remaining, until);
+            }
+        }
+
+        if (!pending.empty()) {
+            // Tasks run on the waiting thread, so no handler is active at the same time
+            for (auto &task : pending)
+                task();
+            continue;
+        }
+
         int n = epoll_wait (efd, events, MAXEVENTS, remaining);
+
+        vector<std::coroutine_handle<> > due;
+        vector<pair<SharedIOBase, uint32_t> > active;
+        vector<SharedIOBase> registered;
+
+        {
+            // The lock is only held to take what has to be handled, handlers and coroutines run without it
+            SYNCHRONIZED(mutex);
+
+            auto now = std::chrono::steady_clock::now();
+            while (sleeping.size() > 0 && sleeping.begin()->first <= now) {
+                due.push_back(sleeping.begin()->second);
+                sleeping.erase(sleeping.begin());
+            }
+
+            for (int i = 0; i < n; i++) {
+                auto handler = handlers.find(events[i].data.fd);
+                if (handler != handlers.end())
+                    active.push_back(make_pair(handler->second, (uint32_t) events[i].events));
+            }
+
+            for (auto handler : handlers)
+                registered.push_back(handler.second);
+        }
+
+        for (auto handle : due)
+            handle.resume();
+
         for (int i = 0; i < n; i++) {
-        	int fd = events[i].data.fd;
-        	if (handlers.find(fd) == handlers.end()) continue;
+            if (events[i].data.fd == wfd) {
+                uint64_t count;
+                while (::read(wfd, &count, sizeof(count)) == sizeof(count)) {}
+            }
+        }
 
-			SharedIOBase base = handlers[fd];
+        for (auto &event : active) {
+			SharedIOBase base = event.first;
 
-            if ((events[i].events & EPOLLERR) || (events[i].events & EPOLLHUP)) {
+            if ((event.second & EPOLLERR) || (event.second & EPOLLHUP)) {
                 base->disconnect();
                 remove_handler(base);
-            } else if (events[i].events & EPOLLIN) {
+            } else if (event.second & EPOLLIN) {
                 // TODO: handle timeout
                 if (!base->handle_input()) {
                     base->disconnect();
                     remove_handler(base);
                 }
-            } else if (events[i].events & EPOLLOUT) {
-                struct epoll_event event;
-                event.data.fd = fd;
-                event.events = EPOLLOUT;
-                if (epoll_ctl (efd, EPOLL_CTL_DEL, event.data.fd, &event) == -1) {
-                    throw runtime_error(_format_string("Error when removing an epoll FD %d (%d)", event.data.fd, errno));
+            } else if (event.second & EPOLLOUT) {
+                struct epoll_event update;
+                update.data.fd = base->get_file_descriptor();
+                update.events = EPOLLOUT;
+                if (epoll_ctl (efd, EPOLL_CTL_DEL, update.data.fd, &update) == -1) {
+                    throw runtime_error(_format_string("Error when removing an epoll FD %d (%d)", update.data.fd, errno));
                 }
             }
         }
 
         write_done = true;
-        for (std::map<int, SharedIOBase>::iterator it = handlers.begin(); it != handlers.end(); it++) {
-            bool done = it->second->handle_output();
+        for (auto base : registered) {
+            bool done = base->handle_output();
             if (!done) {
                 struct epoll_event event;
-                event.data.fd = it->second->get_file_descriptor();
+                event.data.fd = base->get_file_descriptor();
                 event.events = EPOLLOUT;
                 if (epoll_ctl (efd, EPOLL_CTL_ADD, event.data.fd, &event) == -1) {
                     if (errno == EBADF) {
@@ -175,7 +271,113 @@ bool IOLoop::wait(int64_t timeout) {
     }
 
     free(events);
-    return handlers.size() > 0;
+
+    SYNCHRONIZED(mutex);
+
+    return handlers.size() > 0 || sleeping.size() > 0 || tasks.size() > 0;
+
+}
+
+IOLoop::SleepAwaiter IOLoop::sleep(int64_t timeout) {
+
+	return SleepAwaiter(this, std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout));
+
+}
+
+void IOLoop::resume_at(std::chrono::steady_clock::time_point deadline, std::coroutine_handle<> handle) {
+
+	{
+		SYNCHRONIZED(mutex);
+
+		sleeping.insert(make_pair(deadline, handle));
+	}
+
+	// The loop may be waiting without a timeout
+	uint64_t increment = 1;
+	if (::write(wfd, &increment, sizeof(increment)) != sizeof(increment)) {
+		DEBUGMSG("Unable to wake up the loop\n");
+	}
+
+}
+
+Timer::Timer(function<void()> callback) : callback(callback) {
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (fd == -1) {
+		throw runtime_error("Unable to create timer");
+	}
+
+}
+
+Timer::~Timer() {
+
+	close(fd);
+
+}
+
+void Timer::start(int64_t timeout) {
+
+	struct itimerspec value = {};
+	// Zero would disarm the timer
+	timeout = max<int64_t>(timeout, 1);
+	value.it_value.tv_sec = timeout / 1000;
+	value.it_value.tv_nsec = (timeout % 1000) * 1000000;
+
+	timerfd_settime(fd, 0, &value, NULL);
+
+}
+
+void Timer::stop() {
+
+	struct itimerspec value = {};
+
+	timerfd_settime(fd, 0, &value, NULL);
+
+}
+
+int Timer::get_file_descriptor() {
+
+	return fd;
+
+}
+
+bool Timer::handle_input() {
+
+	uint64_t expirations;
+
+	if (::read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+		callback();
+
+	return true;
+
+}
+
+bool Timer::handle_output() {
+
+	return true;
+
+}
+
+void Timer::disconnect() {
+
+	// Descriptor is kept until the timer is released so that it can still be removed from the loop
+	stop();
+
+}
+
+void IOLoop::execute(function<void()> task) {
+
+    {
+        SYNCHRONIZED(mutex);
+
+        tasks.push_back(task);
+    }
+
+    // The loop may be waiting without a timeout
+    uint64_t increment = 1;
+    if (::write(wfd, &increment, sizeof(increment)) != sizeof(increment)) {
+        DEBUGMSG("Unable to wake up the loop\n");
+    }
 
 }
 
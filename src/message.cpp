@@ -6,6 +6,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/eventfd.h>
 #include <algorithm>
 #include <malloc.h>
 #include <cmath>
@@ -34,11 +35,29 @@ namespace routio
         using bounded_priority_queue::size;
     };
 
+    uchar *allocate_aligned(size_t length)
+    {
+        // Size of an aligned allocation has to be a multiple of the alignment
+        size_t size = ((max<size_t>(length, 1) + ROUTIO_ALIGNMENT - 1) / ROUTIO_ALIGNMENT) * ROUTIO_ALIGNMENT;
+
+        return (uchar *)aligned_alloc(ROUTIO_ALIGNMENT, size);
+    }
+
     const char *EndOfBufferException::what() const throw()
     {
         return "End of buffer";
     }
 
+    const uchar *Buffer::get_contiguous(size_t position, size_t length) const
+    {
+        return NULL;
+    }
+
+    const uchar *Buffer::get_owned(size_t position, size_t length) const
+    {
+        return NULL;
+    }
+
     void Buffer::inspect_data(ostream& output) const
     {
         uchar* temp = new uchar[get_length()];
@@ -186,6 +205,27 @@ namespace routio
         position += length;
     }
 
+    const uchar *MessageReader::view_data(size_t length)
+    {
+
+        if (message->get_length() - position < length)
+        {
+            throw EndOfBufferException();
+        }
+
+        const uchar *data = message->get_owned(position, length);
+
+        if (data)
+            position += length;
+
+        return data;
+    }
+
+    SharedMessage MessageReader::get_message() const
+    {
+        return message;
+    }
+
     MessageWriter::~MessageWriter()
     {
 
@@ -348,9 +388,10 @@ namespace routio
         return msg;
     }
 
-    StreamReader::StreamReader(int fd) : fd(fd)
+    StreamReader::StreamReader(int fd, size_t offset) : fd(fd)
     {
         data = NULL;
+        data_padding = (ROUTIO_ALIGNMENT - offset % ROUTIO_ALIGNMENT) % ROUTIO_ALIGNMENT;
         buffer_length = 0;
         total_data_read = 0;
         data_read_counter = 0;
@@ -433,6 +474,8 @@ namespace routio
 
         if (data)
             free(data);
+
+        data = NULL;
     }
 
     shared_ptr<Message> StreamReader::process_buffer()
@@ -477,8 +520,7 @@ namespace routio
                 }
 
                 // TODO: test if total length too high
-                // TODO: custom allocator?
-                data = (uchar *)malloc(data_length * sizeof(char));
+                data = allocate_aligned(data_padding + data_length);
 
             } // intentional fallthrough
             case 6:
@@ -487,13 +529,13 @@ namespace routio
                 data_read_counter += buffer_length - i;
                 if (data_read_counter >= data_length)
                 {
-                    memcpy(&(data[data_current]), &(buffer[i]), data_length - data_current);
+                    memcpy(&(data[data_padding + data_current]), &(buffer[i]), data_length - data_current);
                     i += data_length - data_current;
                     complete = true;
                 }
                 else
                 {
-                    memcpy(&(data[data_current]), &(buffer[i]), buffer_length - i - 1);
+                    memcpy(&(data[data_padding + data_current]), &(buffer[i]), buffer_length - i);
                     data_current += buffer_length - i;
                     state = 6; // Wait for more data
                     i = buffer_length;
@@ -511,7 +553,9 @@ namespace routio
 
             if (complete)
             {
-                shared_ptr<Message> ptr(make_shared<BufferedMessage>(data, data_length, true));
+                shared_ptr<Message> ptr(make_shared<BufferedMessage>(data, data_padding + data_length, true));
+                if (data_padding)
+                    ptr = make_shared<OffsetBufferMessage>(ptr, data_padding);
                 total_data_read += data_length;
                 data = NULL;
                 buffer_position = i;
@@ -641,6 +685,165 @@ namespace routio
         return total_data_dropped;
     }
 
+    MessageQueue::MessageQueue(size_t size) : limit(size), closed(false), total_data_transferred(0), total_data_dropped(0)
+    {
+
+        fd = eventfd(0, EFD_NONBLOCK);
+
+        if (fd == -1)
+            throw runtime_error("Unable to create event descriptor");
+    }
+
+    MessageQueue::~MessageQueue()
+    {
+
+        ::close(fd);
+    }
+
+    static bool is_control_message(const SharedMessage message)
+    {
+        int channel = -1;
+
+        if (message->get_length() < sizeof(int))
+            return false;
+
+        message->copy_data(0, (uchar *)&channel, sizeof(int));
+
+        return channel == ROUTIO_CONTROL_CHANNEL;
+    }
+
+    bool MessageQueue::push(const SharedMessage message, MessageCallback callback)
+    {
+
+        QueuedMessage entry{message, callback, is_control_message(message)};
+        QueuedMessage dropped;
+        bool accepted = false;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (!closed)
+            {
+                accepted = true;
+
+                if (limit > 0 && messages.size() >= limit)
+                {
+                    // Control messages are never dropped, the oldest data message makes room instead
+                    auto victim = std::find_if(messages.begin(), messages.end(), [](const QueuedMessage &m)
+                                               { return !m.control; });
+
+                    if (victim != messages.end())
+                    {
+                        dropped = *victim;
+                        messages.erase(victim);
+                        total_data_dropped += dropped.message->get_length();
+                    }
+                    else if (!entry.control)
+                    {
+                        accepted = false;
+                        total_data_dropped += message->get_length();
+                    }
+                }
+
+                if (accepted)
+                {
+                    messages.push_back(entry);
+                    total_data_transferred += message->get_length();
+                }
+            }
+        }
+
+        if (!accepted)
+            dropped = entry;
+        else
+            notify();
+
+        if (dropped.callback)
+            dropped.callback(dropped.message, MESSAGE_CALLBACK_DROPPED);
+
+        return !dropped.message;
+    }
+
+    SharedMessage MessageQueue::pop()
+    {
+
+        QueuedMessage entry;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (messages.empty())
+            {
+                // Reset the event so that the descriptor is only readable while messages are available,
+                // messages pushed after this will signal it again
+                uint64_t signal;
+                if (::read(fd, &signal, sizeof(uint64_t)) < 0 && errno != EAGAIN)
+                {
+                    DEBUGMSG("Unable to reset message queue\n");
+                }
+                return SharedMessage();
+            }
+
+            entry = messages.front();
+            messages.pop_front();
+        }
+
+        // Message is sent once the other side takes it from the queue
+        if (entry.callback)
+            entry.callback(entry.message, MESSAGE_CALLBACK_SENT);
+
+        return entry.message;
+    }
+
+    void MessageQueue::notify()
+    {
+
+        uint64_t signal = 1;
+        if (::write(fd, &signal, sizeof(uint64_t)) < 0)
+        {
+            DEBUGMSG("Unable to signal message queue\n");
+        }
+    }
+
+    void MessageQueue::close()
+    {
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+
+        // Wake up the reader so that it notices that the queue is closed
+        notify();
+    }
+
+    bool MessageQueue::is_closed() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return closed;
+    }
+
+    int MessageQueue::get_file_descriptor() const
+    {
+        return fd;
+    }
+
+    int MessageQueue::get_size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (int)messages.size();
+    }
+
+    unsigned long MessageQueue::get_transferred_data() const
+    {
+        return total_data_transferred;
+    }
+
+    unsigned long MessageQueue::get_dropped_data() const
+    {
+        return total_data_dropped;
+    }
+
 #define INTEGER_TO_ARRAY(A, I)   \
     {                            \
         A[0] = (I >> 24) & 0xFF; \
@@ -746,7 +949,7 @@ namespace routio
     {
     }
 
-    BufferedMessage::BufferedMessage(int length) : MemoryBuffer(length), Message()
+    BufferedMessage::BufferedMessage(size_t length) : MemoryBuffer(length), Message()
     {
     }
 
@@ -764,7 +967,7 @@ namespace routio
 
     MemoryBuffer::MemoryBuffer(size_t length) : data_length(length), data_owned(true)
     {
-        data = (uchar *)malloc(sizeof(uchar) * length);
+        data = allocate_aligned(length);
     }
 
     MemoryBuffer::MemoryBuffer(MessageWriter &writer)
@@ -801,6 +1004,23 @@ namespace routio
         return length;
     }
 
+    const uchar *MemoryBuffer::get_contiguous(size_t position, size_t length) const
+    {
+        if (position + length > data_length)
+            return NULL;
+
+        return &data[position];
+    }
+
+    const uchar *MemoryBuffer::get_owned(size_t position, size_t length) const
+    {
+        // Data given by the caller without ownership may still be changed by it
+        if (!data_owned)
+            return NULL;
+
+        return get_contiguous(position, length);
+    }
+
     uchar *MemoryBuffer::get_buffer() const
     {
         return data;
@@ -858,6 +1078,39 @@ namespace routio
         return offset;
     }
 
+    const uchar *MultiBufferMessage::get_contiguous(size_t position, size_t length) const
+    {
+
+        vector<size_t>::const_iterator it = std::upper_bound(offsets.begin(), offsets.end(), position);
+        int index = (it - offsets.begin()) - 1;
+
+        if (index < 0)
+            return NULL;
+
+        // Only ranges within a single buffer are contiguous
+        size_t pos = position - offsets[index];
+        if (pos + length > buffers[index]->get_length())
+            return NULL;
+
+        return buffers[index]->get_contiguous(pos, length);
+    }
+
+    const uchar *MultiBufferMessage::get_owned(size_t position, size_t length) const
+    {
+
+        vector<size_t>::const_iterator it = std::upper_bound(offsets.begin(), offsets.end(), position);
+        int index = (it - offsets.begin()) - 1;
+
+        if (index < 0)
+            return NULL;
+
+        size_t pos = position - offsets[index];
+        if (pos + length > buffers[index]->get_length())
+            return NULL;
+
+        return buffers[index]->get_owned(pos, length);
+    }
+
     OffsetBufferMessage::OffsetBufferMessage(const SharedBuffer buffer, size_t offset) : buffer(buffer), offset(offset)
     {
         if (offset > buffer->get_length())
@@ -880,6 +1133,18 @@ namespace routio
         return this->buffer->copy_data(position + offset, buffer, length);
     }
 
+    const uchar *OffsetBufferMessage::get_contiguous(size_t position, size_t length) const
+    {
+
+        return this->buffer->get_contiguous(position + offset, length);
+    }
+
+    const uchar *OffsetBufferMessage::get_owned(size_t position, size_t length) const
+    {
+
+        return this->buffer->get_owned(position + offset, length);
+    }
+
     static inline bool is_invalid_atribute_char(char c)
     {
         return !(isalnum(c) || c == '.' || c == '_');
@@ -921,4 +1186,190 @@ namespace routio
         return arguments.size();
     }
 
+    MessageCache::MessageCache(size_t count, size_t bytes, int64_t time) : limit_count(count), limit_bytes(bytes), limit_time(time), sequence(0), bytes(0)
+    {
+    }
+
+    MessageCache::~MessageCache()
+    {
+    }
+
+    void MessageCache::set_limits(size_t count, size_t bytes, int64_t time)
+    {
+        limit_count = count;
+        limit_bytes = bytes;
+        limit_time = time;
+
+        if (!is_retaining())
+        {
+            clear();
+            return;
+        }
+
+        evict();
+    }
+
+    bool MessageCache::is_retaining() const
+    {
+        return limit_count > 0 || limit_bytes > 0 || limit_time > 0;
+    }
+
+    int64_t MessageCache::push(SharedMessage frame)
+    {
+
+        MessageReader reader(frame);
+
+        int64_t result = -1;
+
+        try
+        {
+
+            int index = reader.read_integer();
+
+            if (index < 0)
+            {
+                // Single chunk message
+                Entry entry{sequence++, std::chrono::steady_clock::now(), 0, 0, 1, {}};
+                if (is_retaining())
+                    entry.frames.push_back(frame);
+                entry.bytes = frame->get_length();
+                complete(entry);
+                return entry.sequence;
+            }
+
+            int64_t id = reader.read_long();
+
+            if (index == 0)
+            {
+                int64_t length = reader.read_long();
+                reader.read_integer();
+
+                if (partial.size() >= MESSAGE_CACHE_PARTIALS)
+                {
+                    auto oldest = partial.begin();
+                    for (auto it = partial.begin(); it != partial.end(); it++)
+                        if (it->second.sequence < oldest->second.sequence)
+                            oldest = it;
+                    partial.erase(oldest);
+                }
+
+                partial[id] = Entry{sequence++, std::chrono::steady_clock::now(), 0, length, 0, {}};
+            }
+            else if (partial.find(id) == partial.end() || index != partial[id].chunks)
+            {
+                // Missed the beginning of the message or some of its chunks
+                partial.erase(id);
+                return -1;
+            }
+
+            Entry &entry = partial[id];
+
+            if (is_retaining())
+                entry.frames.push_back(frame);
+            entry.chunks++;
+            entry.bytes += frame->get_length();
+            entry.remaining -= (int64_t)(frame->get_length() - reader.get_position());
+
+            result = entry.sequence;
+
+            if (entry.remaining <= 0)
+            {
+                Entry done = std::move(entry);
+                partial.erase(id);
+                complete(done);
+            }
+        }
+        catch (EndOfBufferException &e)
+        {
+        }
+
+        return result;
+    }
+
+    void MessageCache::complete(Entry &entry)
+    {
+
+        if (!is_retaining())
+            return;
+
+        entry.time = std::chrono::steady_clock::now();
+        bytes += entry.bytes;
+        messages.push_back(std::move(entry));
+
+        evict();
+    }
+
+    void MessageCache::evict()
+    {
+
+        auto now = std::chrono::steady_clock::now();
+
+        while (!messages.empty())
+        {
+            Entry &oldest = messages.front();
+
+            bool expired = (limit_count > 0 && messages.size() > limit_count) ||
+                           (limit_bytes > 0 && bytes > limit_bytes && messages.size() > 1) ||
+                           (limit_time > 0 && now - oldest.time > std::chrono::milliseconds(limit_time));
+
+            if (!expired)
+                break;
+
+            bytes -= oldest.bytes;
+            messages.pop_front();
+        }
+    }
+
+    vector<pair<int64_t, SharedMessage>> MessageCache::get_frames(size_t count, int64_t since) const
+    {
+
+        vector<pair<int64_t, SharedMessage>> frames;
+
+        if (!is_retaining())
+            return frames;
+
+        auto now = std::chrono::steady_clock::now();
+
+        size_t skip = (since < 0 && count < messages.size()) ? messages.size() - count : 0;
+
+        for (auto entry = messages.begin() + skip; entry != messages.end(); entry++)
+        {
+            if (since >= 0 && entry->sequence <= since)
+                continue;
+
+            if (limit_time > 0 && now - entry->time > std::chrono::milliseconds(limit_time))
+                continue;
+
+            for (auto frame : entry->frames)
+                frames.push_back(make_pair(entry->sequence, frame));
+        }
+
+        vector<const Entry *> progress;
+        for (auto it = partial.begin(); it != partial.end(); it++)
+            progress.push_back(&(it->second));
+
+        sort(progress.begin(), progress.end(), [](const Entry *a, const Entry *b)
+             { return a->sequence < b->sequence; });
+
+        for (auto entry : progress)
+            for (auto frame : entry->frames)
+                frames.push_back(make_pair(entry->sequence, frame));
+
+        return frames;
+    }
+
+    int64_t MessageCache::get_sequence() const
+    {
+        return sequence;
+    }
+
+    void MessageCache::clear()
+    {
+        messages.clear();
+        bytes = 0;
+
+        for (auto it = partial.begin(); it != partial.end(); it++)
+            it->second.frames.clear();
+    }
+
 }
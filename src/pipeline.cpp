@@ -0,0 +1,307 @@
+
+#include <algorithm>
+
+#include "debug.h"
+#include <routio/pipeline.h>
+
+namespace routio {
+
+// Set on threads of executors, only these may wait for room in a queue
+static thread_local bool executor_thread = false;
+
+// Nodes whose messages are being processed on this thread, they cannot wait for room in their own queues
+static thread_local vector<const Node*> active_nodes;
+
+Node::Node(const string &name) : name(name), next(0), scheduled(false), running(false), statistics{0, 0, 0} {
+
+}
+
+Node::~Node() {
+
+}
+
+string Node::get_name() const {
+
+    return name;
+
+}
+
+NodeStatistics Node::get_statistics() {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return statistics;
+
+}
+
+void Node::on_error(const std::exception &error) {
+
+    DEBUGMSG("Error in node %s: %s\n", name.c_str(), error.what());
+
+}
+
+size_t Node::add_queue(size_t capacity, int policy) {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    queues.push_back(NodeQueue{deque<function<void()>>(), max<size_t>(capacity, 1), policy});
+
+    return queues.size() - 1;
+
+}
+
+void Node::push(size_t index, function<void()> task) {
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    bool active = std::find(active_nodes.begin(), active_nodes.end(), this) != active_nodes.end();
+
+    // A node that pushes into its own full queue would wait for itself, the oldest message is dropped instead
+    if (queues[index].policy == NODE_QUEUE_BLOCK && executor_thread && !active) {
+
+        while (queues[index].tasks.size() >= queues[index].capacity) {
+
+            if (running) {
+                space.wait(lock);
+                continue;
+            }
+
+            // Process a message of this node here instead of waiting for a free worker,
+            // otherwise all workers could end up waiting for each other
+            running = true;
+            lock.unlock();
+            step();
+            lock.lock();
+
+        }
+
+    }
+
+    NodeQueue &queue = queues[index];
+
+    size_t capacity = (queue.policy == NODE_QUEUE_LATEST) ? 1 : queue.capacity;
+
+    while (queue.tasks.size() >= capacity) {
+        queue.tasks.pop_front();
+        statistics.messages_dropped++;
+    }
+
+    queue.tasks.push_back(task);
+
+    if (scheduled || running)
+        return;
+
+    lock.unlock();
+
+    schedule();
+
+}
+
+bool Node::step() {
+
+    function<void()> task;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (size_t i = 0; i < queues.size(); i++) {
+            NodeQueue &queue = queues[(next + i) % queues.size()];
+            if (queue.tasks.empty())
+                continue;
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+            next = (next + i + 1) % queues.size();
+            break;
+        }
+
+        if (!task) {
+            running = false;
+            return false;
+        }
+
+        space.notify_all();
+    }
+
+    bool failed = false;
+
+    active_nodes.push_back(this);
+
+    try {
+        task();
+    } catch (std::exception &e) {
+        failed = true;
+        on_error(e);
+    }
+
+    active_nodes.pop_back();
+
+    bool pending = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        statistics.messages_processed++;
+        if (failed)
+            statistics.errors++;
+
+        running = false;
+
+        for (auto &queue : queues)
+            pending |= !queue.tasks.empty();
+
+        space.notify_all();
+    }
+
+    if (pending)
+        schedule();
+
+    return true;
+
+}
+
+void Node::schedule() {
+
+    SharedExecutor e;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        e = executor.lock();
+
+        if (!e || scheduled)
+            return;
+
+        scheduled = true;
+    }
+
+    e->schedule(shared_from_this());
+
+}
+
+Executor::Executor(size_t threads) : running(true) {
+
+    threads = max<size_t>(threads, 1);
+
+    for (size_t i = 0; i < threads; i++)
+        workers.push_back(std::thread(&Executor::run, this));
+
+}
+
+Executor::~Executor() {
+
+    stop();
+
+}
+
+void Executor::add(SharedNode node) {
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        nodes.insert(node);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(node->mutex);
+
+        node->executor = shared_from_this();
+    }
+
+    // Messages may have been received before the node was added
+    node->schedule();
+
+}
+
+void Executor::remove(SharedNode node) {
+
+    {
+        std::lock_guard<std::mutex> lock(node->mutex);
+
+        node->executor.reset();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    nodes.erase(node);
+
+}
+
+void Executor::stop() {
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (!running)
+            return;
+
+        running = false;
+
+        ready.clear();
+
+        ready_condition.notify_all();
+    }
+
+    for (auto &worker : workers) {
+        if (worker.get_id() == std::this_thread::get_id())
+            worker.detach();
+        else
+            worker.join();
+    }
+
+    workers.clear();
+
+}
+
+void Executor::schedule(SharedNode node) {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!running)
+        return;
+
+    ready.push_back(node);
+
+    ready_condition.notify_one();
+
+}
+
+void Executor::run() {
+
+    executor_thread = true;
+
+    while (true) {
+
+        SharedNode node;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            ready_condition.wait(lock, [this]() { return !running || !ready.empty(); });
+
+            if (!running)
+                return;
+
+            node = ready.front();
+            ready.pop_front();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(node->mutex);
+
+            node->scheduled = false;
+
+            // Node is processed on another thread that reschedules it when done
+            if (node->running)
+                continue;
+
+            node->running = true;
+        }
+
+        // Each node processes a single message before other nodes get a turn
+        node->step();
+
+    }
+
+}
+
+}
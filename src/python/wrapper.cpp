@@ -84,72 +84,68 @@ public:
 
         if (!a) return false;
 
-        auto capsule = py::reinterpret_borrow<py::capsule>(a.base());
+        // Arrays that wrap a tensor are unwrapped, unless they are a slice of it
+        if (py::isinstance<py::capsule>(a.base())) {
 
-        if (!capsule) {
+            auto ref = static_cast<SharedTensor*>(py::reinterpret_borrow<py::capsule>(a.base()));
 
-            std::vector<size_t> dimensions, strides;
+            bool same = (*ref)->get_const_data() == (const uchar *) a.data() && (*ref)->ndims() == a.ndim();
 
-            for (int i = 0; i < a.ndim(); i++) {
-                dimensions.push_back(static_cast<size_t>(a.shape(i)));
+            for (int i = 0; same && i < a.ndim(); i++) {
+                same = (*ref)->shape(i) == static_cast<size_t>(a.shape(i)) && (*ref)->stride(i) == a.strides(i);
             }
 
-            const auto pyarray_dtype = a.dtype();
-            DataType type;
-            if (pyarray_dtype.is(pybind11::dtype::of<uint8_t>())) {
-	            type = UINT8;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<int8_t>())) {
-                type = INT8;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<uint16_t>())) {
-	            type = UINT16;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<int16_t>())) {
-                type = INT16;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<uint32_t>())) {
-	            type = UINT32;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<int32_t>())) {
-                type = INT32;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<float>())) {
-	            type = FLOAT32;
-            } else if (pyarray_dtype.is(pybind11::dtype::of<double>())) {
-                type = FLOAT64;
-            } else {
-                return false;
+            if (same) {
+                value = SharedTensor(*ref);
+                return true;
             }
 
-            bool continious = true;
-            ssize_t stride = Tensor::get_type_bytes(type);
-
-            for (ssize_t i = a.ndim() - 1; i >= 0; i--) {
-
-               // std::cout << i << ":" << stride << " " << a.strides(i) << std::endl;
-
-                if (stride != a.strides(i)) {
-                    continious = false;
-                    break;
-                }
-
-                stride = static_cast<ssize_t>(dimensions[i]) * stride;
+        }
 
-            } 
+        std::vector<size_t> dimensions;
+        std::vector<ssize_t> strides;
 
-            py::handle reservation(a);
-            reservation.inc_ref();
+        for (int i = 0; i < a.ndim(); i++) {
+            dimensions.push_back(static_cast<size_t>(a.shape(i)));
+        }
 
-            if (continious) {
-                value = std::make_shared<Tensor>(dimensions, type, (uchar *) a.data(), [reservation](){ reservation.dec_ref(); });
-            } else {
-                return false;
-            }
-            
+        const auto pyarray_dtype = a.dtype();
+        DataType type;
+        if (pyarray_dtype.is(pybind11::dtype::of<uint8_t>())) {
+            type = UINT8;
+        } else if (pyarray_dtype.is(pybind11::dtype::of<int8_t>())) {
+            type = INT8;
+        } else if (pyarray_dtype.is(pybind11::dtype::of<uint16_t>())) {
+            type = UINT16;
+        } else if (pyarray_dtype.is(pybind11::dtype::of<int16_t>())) {
+            type = INT16;
+        } else if (pyarray_dtype.is(pybind11::dtype::of<uint32_t>())) {
+            type = UINT32;
+        } else if (pyarray_dtype.is(pybind11::dtype::of<int32_t>())) {
+            type = INT32;
+        } else if (pyarray_dtype.is(pybind11::dtype::of<float>())) {
+            type = FLOAT32;
+        } else if (pyarray_dtype.is(pybind11::dtype::of<double>())) {
+            type = FLOAT64;
+        } else if (pyarray_dtype.is(pybind11::dtype("float16"))) {
+            type = FLOAT16;
+        } else if (py::str(pyarray_dtype.attr("name")).cast<std::string>() == "bfloat16") {
+            type = BFLOAT16;
         } else {
+            return false;
+        }
 
-            auto ref = static_cast<SharedTensor*>(capsule);
+        // Non-contiguous arrays, e.g. slices, are used as strided views without copying
+        for (int i = 0; i < a.ndim(); i++) {
+            strides.push_back(static_cast<ssize_t>(a.strides(i)));
+        }
 
-            value = SharedTensor(*ref);
+        py::handle reservation(a);
+        reservation.inc_ref();
+
+        value = std::make_shared<Tensor>(dimensions, type, strides, (uchar *) a.data(), [reservation](){ reservation.dec_ref(); });
+        value->set_readonly(!a.writeable());
 
-            //std::cout << "Capsule " << (ref) << " " << (void *) value->get_data() << std::endl;
-        }
-        
         return true;
     }
     static py::handle cast(const SharedTensor &src, return_value_policy policy, py::handle parent) {
@@ -162,6 +158,7 @@ public:
         });
 
         std::vector<ssize_t> dimensions(src->ndims(), 0);
+        std::vector<ssize_t> strides = src->get_strides();
 
         for (size_t i = 0; i < src->ndims(); i++) {
             dimensions[i] = static_cast<ssize_t>(src->shape(i));
@@ -171,42 +168,61 @@ public:
 
         switch (src->get_type()) {
             case UINT8: {
-                result = py::array(std::move(dimensions), {}, (uint8_t *) src->get_data(), capsule);
+                result = py::array(std::move(dimensions), std::move(strides), (uint8_t *) src->get_const_data(), capsule);
                 break;
             }
             case INT8: {
-                result = py::array(std::move(dimensions), {}, (int8_t *) src->get_data(), capsule);
+                result = py::array(std::move(dimensions), std::move(strides), (int8_t *) src->get_const_data(), capsule);
                 break;
             }
             case UINT16: {
-                result = py::array(std::move(dimensions), {}, (uint16_t *) src->get_data(), capsule);
+                result = py::array(std::move(dimensions), std::move(strides), (uint16_t *) src->get_const_data(), capsule);
                 break;
             }
             case INT16: {
-                result = py::array(std::move(dimensions), {}, (int16_t *) src->get_data(), capsule);
+                result = py::array(std::move(dimensions), std::move(strides), (int16_t *) src->get_const_data(), capsule);
                 break;
             }
             case UINT32: {
-                result = py::array(std::move(dimensions), {}, (uint32_t *) src->get_data(), capsule);
+                result = py::array(std::move(dimensions), std::move(strides), (uint32_t *) src->get_const_data(), capsule);
                 break;
             }
             case INT32: {
-                result = py::array(std::move(dimensions), {}, (int32_t *) src->get_data(), capsule);
+                result = py::array(std::move(dimensions), std::move(strides), (int32_t *) src->get_const_data(), capsule);
                 break;
             }
             case FLOAT32: {
-                result = py::array(std::move(dimensions), {}, (float_t *) src->get_data(), capsule);
+                result = py::array(std::move(dimensions), std::move(strides), (float_t *) src->get_const_data(), capsule);
                 break;
             }
             case FLOAT64: {
-               result = py::array(std::move(dimensions), {}, (double_t *) src->get_data(), capsule);
+               result = py::array(std::move(dimensions), std::move(strides), (double_t *) src->get_const_data(), capsule);
                break;
             }
+            case FLOAT16: {
+                result = py::array(pybind11::dtype("float16"), std::move(dimensions), std::move(strides), src->get_const_data(), capsule);
+                break;
+            }
+            case BFLOAT16: {
+                // Numpy has no bfloat16 type, the one from ml_dtypes is used if available, raw values otherwise
+                pybind11::dtype type = pybind11::dtype::of<uint16_t>();
+                try {
+                    type = pybind11::dtype::from_args(py::module::import("ml_dtypes").attr("bfloat16"));
+                } catch (py::error_already_set &e) {
+                }
+                result = py::array(type, std::move(dimensions), std::move(strides), src->get_const_data(), capsule);
+                break;
+            }
             default: {
                 return py::none(); 
             }
 
         }
+
+        // Received tensors share the message with other subscribers
+        if (src->is_readonly()) {
+            result.attr("setflags")(py::arg("write") = false);
+        }
   
         result.inc_ref();
         return result;
@@ -368,6 +384,21 @@ PYBIND11_MODULE(pyroutio, m) {
     .def("fd", &Client::get_file_descriptor, "Get access to low-level file descriptor")
     .def("isConnected", &Client::is_connected, "Check if the client is connected");
 
+    py::class_<Multiplexer, IOBase, std::shared_ptr<Multiplexer> >(m, "Multiplexer")
+    .def(py::init<const string&>(), py::arg("address") = string(""))
+    .def("connect", &Multiplexer::connect, "Create a logical client sharing the connection", py::arg("name") = string(""))
+    .def("disconnect", &Multiplexer::disconnect, "Disconnect all logical clients")
+    .def("handle_input", &Multiplexer::handle_input, "Handle input messages")
+    .def("handle_output", &Multiplexer::handle_output, "Handle output messages")
+    .def("fd", &Multiplexer::get_file_descriptor, "Get access to low-level file descriptor")
+    .def("isConnected", &Multiplexer::is_connected, "Check if the connection is open");
+
+    py::class_<EmbeddedRouter, std::shared_ptr<EmbeddedRouter> >(m, "EmbeddedRouter")
+    .def(py::init<string>(), py::arg("address") = string(""))
+    .def("connect", [](EmbeddedRouter &r, string name) {
+        return r.connect(name);
+    }, "Connect a client in this process", py::arg("name") = string(""));
+
     py::class_<Subscriber, PySubscriber, std::shared_ptr<Subscriber> >(m, "Subscriber")
     .def(py::init<SharedClient, string, string, function<void(SharedMessage)> >())
     .def("subscribe", [](PySubscriber &a) {
@@ -377,7 +408,30 @@ PYBIND11_MODULE(pyroutio, m) {
     .def("unsubscribe", [](PySubscriber &a) {
         py::gil_scoped_release gil; // release GIL lock
         return a.unsubscribe();
-    }, "Stop receiving");
+    }, "Stop receiving")
+    .def("request_history", &Subscriber::request_history, "Request last messages from channel history on subscribe")
+    .def("request_history_since", &Subscriber::request_history_since, "Request messages after sequence from channel history on subscribe")
+    .def("request_truncated", &Subscriber::request_truncated, "Request only the beginning of each message on subscribe")
+    .def("request_sampled", &Subscriber::request_sampled, "Request only every n-th message on subscribe")
+    .def("length", &Subscriber::get_message_length, "Get original length of the current message")
+    .def("sequence", &Subscriber::get_sequence, "Get channel sequence number of the current message")
+    .def("last_sequence", &Subscriber::get_last_sequence, "Get channel sequence number of the last received message")
+    .def("lost", [](Subscriber &s) {
+        return s.get_statistics().messages_lost;
+    }, "Get number of messages missing from the channel sequence");
+
+    py::class_<BatchSubscriber, Subscriber, std::shared_ptr<BatchSubscriber> >(m, "BatchSubscriber")
+    .def(py::init([](SharedClient client, string alias, string type, function<void(vector<SharedMessage>)> callback, size_t batch_size, int64_t max_wait) {
+        // A single call with all messages of the batch saves acquiring the GIL for each message
+        return make_shared<BatchSubscriber>(client, alias, type, create_batch_callback([callback](span<SharedMessage> messages) {
+            py::gil_scoped_acquire gil; // acquire GIL lock
+            callback(vector<SharedMessage>(messages.begin(), messages.end()));
+        }), batch_size, max_wait);
+    }), py::arg("client"), py::arg("channel"), py::arg("type"), py::arg("callback"), py::arg("batch_size") = (size_t) 64, py::arg("max_wait") = (int64_t) 0)
+    .def("flush", [](BatchSubscriber &s) {
+        py::gil_scoped_release gil; // release GIL lock
+        s.flush();
+    }, "Deliver messages collected so far");
 
     py::class_<Watcher, PyWatcher, std::shared_ptr<Watcher> >(m, "Watcher")
     .def(py::init<SharedClient, string>())
@@ -403,7 +457,14 @@ PYBIND11_MODULE(pyroutio, m) {
     .def("send", [](Publisher &p, MessageWriter& message) {
         py::gil_scoped_release gil; // release GIL lock
         return p.send_message(message);
-    }, "Send a writer");
+    }, "Send a writer")
+    .def("send_to", [](Publisher &p, int subscriber, MessageWriter& message) {
+        py::gil_scoped_release gil; // release GIL lock
+        return p.send_message_to(subscriber, message);
+    }, "Send a writer to a single subscriber")
+    .def("subscribers", &Publisher::get_subscribers, "Get number of subscribers on the channel")
+    .def("set_latched", &Publisher::set_latched, "Keep last message in router for new subscribers")
+    .def("set_history", &Publisher::set_history, "Keep bounded message history in router", py::arg("count"), py::arg("bytes") = (size_t) 0, py::arg("time") = (int64_t) 0);
 
     py::class_<MemoryBuffer, std::shared_ptr<MemoryBuffer> >(m, "MemoryBuffer")
     .def("size", &MemoryBuffer::get_length, "Get message length");
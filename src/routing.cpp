@@ -4,10 +4,12 @@
 #include <sys/socket.h>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include <sys/un.h>
 
 #include "debug.h"
 #include <routio/routing.h>
+#include <routio/state.h>
 
 // https://stackoverflow.com/questions/8104904/identify-program-that-connects-to-a-unix-domain-socket
 #define MAX_RECEIVED_MESSAGES_SIZE 50000000 // 50 MB
@@ -49,12 +51,26 @@ namespace routio
 
     }
 
-    Channel::Channel(int identifier, SharedClientConnection owner, const string &type) : identifier(identifier), type(type), owner(owner)
+    // Data frames also carry the sequence number of their message in the channel, -1 for frames outside the sequence
+    void send(SharedClientConnection client, int channel, int64_t sequence, SharedMessage message) {
+
+        shared_ptr<Message> wrapper = make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<int>::wrap(channel),
+            PrimitiveBuffer<int64_t>::wrap(sequence), message});
+
+        client->send(wrapper);
+
+    }
+
+    Channel::Channel(int identifier, SharedClientConnection owner, const string &type) : identifier(identifier), type(type), latched(false),
+                                                                                              history_count(0), history_bytes(0), history_time(0), owner(owner),
+                                                                                              next_provider(0), service(false), segment_size(0)
     {
     }
 
     Channel::~Channel()
     {
+        if (!segment.empty())
+            StateSegment::remove(segment);
     }
 
     string Channel::get_type() const
@@ -73,16 +89,21 @@ namespace routio
         return false;
     }
 
-    bool Channel::publish(SharedClientConnection client, SharedMessage message)
+    bool Channel::publish(SharedClientConnection client, SharedMessage message, bool echo)
     {
 
+        int64_t sequence = cache.push(message);
+
         // TODO: CHECK PERMISSION !
         std::vector<SharedClientConnection> to_remove;
         for (std::set<SharedClientConnection>::iterator it = subscribers.begin(); it != subscribers.end(); ++it)
         {
             if ((*it)->is_connected())
             {
-                send((*it), identifier, message);
+                if (echo || (*it) != client)
+                    deliver((*it), sequence, message);
+                else
+                    deliver_sequence((*it), sequence, message);
             }
             else
             {
@@ -100,17 +121,180 @@ namespace routio
         return true;
     }
 
-    bool Channel::subscribe(SharedClientConnection client)
+    bool Channel::publish_to(SharedClientConnection client, int target, SharedMessage message)
+    {
+
+        // Providers answer each request exactly once, replies are used to track their load
+        for (auto &provider : providers)
+        {
+            if (provider.client == client && provider.outstanding > 0)
+                provider.outstanding--;
+        }
+
+        // Directed messages are not part of channel history
+        for (auto subscriber : subscribers)
+        {
+            if (subscriber->get_identifier() != target)
+                continue;
+
+            if (subscriber->is_connected())
+            {
+                deliver(subscriber, -1, message);
+                return true;
+            }
+
+            break;
+        }
+
+        DEBUGMSG("Client ID=%d is not subscribed to channel %d\n", target, get_identifier());
+
+        return false;
+    }
+
+    bool Channel::request(SharedClientConnection client, SharedMessage message, bool all)
+    {
+
+        size_t selected = providers.size();
+
+        for (size_t i = 0; i < providers.size(); i++)
+        {
+            size_t index = (next_provider + i) % providers.size();
+
+            if (!providers[index].client->is_connected())
+                continue;
+
+            if (all)
+            {
+                send(providers[index].client, identifier, client->get_identifier(), message);
+                continue;
+            }
+
+            if (selected == providers.size() || providers[index].outstanding < providers[selected].outstanding)
+                selected = index;
+        }
+
+        if (all)
+            return !providers.empty();
+
+        if (selected == providers.size())
+        {
+            DEBUGMSG("Service on channel %d has no providers\n", identifier);
+            send(client, identifier, ROUTIO_SEQUENCE_RETURNED, message);
+            return false;
+        }
+
+        providers[selected].outstanding++;
+        next_provider = (selected + 1) % providers.size();
+
+        // Providers receive the identifier of the caller in place of the sequence number
+        send(providers[selected].client, identifier, client->get_identifier(), message);
+
+        return true;
+    }
+
+    void Channel::deliver_sequence(SharedClientConnection client, int64_t sequence, SharedMessage frame)
+    {
+
+        try
+        {
+            MessageReader reader(frame);
+
+            // Chunks of a message share the sequence number, it is only reported once
+            if (reader.read_integer() > 0)
+                return;
+        }
+        catch (EndOfBufferException &e)
+        {
+            return;
+        }
+
+        auto filter = filters.find(client);
+
+        if (filter != filters.end() && filter->second.sample > 1 && sequence % filter->second.sample != 0)
+            return;
+
+        send(client, identifier, sequence, make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<int>::wrap(ROUTIO_INDEX_SEQUENCE)}));
+    }
+
+    void Channel::deliver(SharedClientConnection client, int64_t sequence, SharedMessage frame)
+    {
+
+        auto filter = filters.find(client);
+
+        if (filter == filters.end())
+        {
+            send(client, identifier, sequence, frame);
+            return;
+        }
+
+        // Sampling is based on the sequence number so that all chunks of a message are treated the same
+        if (filter->second.sample > 1 && sequence >= 0 && sequence % filter->second.sample != 0)
+            return;
+
+        if (filter->second.truncate < 1)
+        {
+            send(client, identifier, sequence, frame);
+            return;
+        }
+
+        try
+        {
+
+            MessageReader reader(frame);
+
+            int index = reader.read_integer();
+
+            // Only the first chunk of a chunked message is delivered
+            if (index > 0)
+                return;
+
+            int64_t length = 0;
+
+            if (index == 0)
+            {
+                reader.read_long();
+                length = reader.read_long();
+                reader.read_integer();
+            }
+            else
+            {
+                length = (int64_t)(frame->get_length() - reader.get_position());
+            }
+
+            size_t position = reader.get_position();
+            size_t available = min(filter->second.truncate, frame->get_length() - position);
+
+            // Truncated messages are marked with index -2 followed by the original length
+            shared_ptr<BufferedMessage> truncated = make_shared<BufferedMessage>(sizeof(int) + sizeof(int64_t) + available);
+
+            MessageWriter writer(truncated->get_buffer(), truncated->get_length());
+            writer.write_integer(-2);
+            writer.write_long(length);
+            frame->copy_data(position, truncated->get_buffer() + sizeof(int) + sizeof(int64_t), available);
+
+            send(client, identifier, sequence, truncated);
+        }
+        catch (EndOfBufferException &e)
+        {
+            DEBUGMSG("Illegal message frame on channel %d\n", identifier);
+        }
+    }
+
+    bool Channel::subscribe(SharedClientConnection client, size_t truncate, int sample)
     {
         if (!is_subscribed(client))
         {
 
+            if (truncate > 0 || sample > 1)
+                filters[client] = SubscriptionFilter{truncate, sample};
+
             subscribers.insert(client);
-            DEBUGMSG("Client FID=%d has subscribed to channel %d (%ld total)\n",
-                     client->get_file_descriptor(), get_identifier(), (int64_t)subscribers.size());
+            DEBUGMSG("Client ID=%d has subscribed to channel %d (%ld total)\n",
+                     client->get_identifier(), get_identifier(), (int64_t)subscribers.size());
 
             SharedDictionary status = generate_event_command(get_identifier());
             status->set<int>("subscribers", subscribers.size());
+            status->set<int>("subscriber", client->get_identifier());
             status->set<string>("type", "subscribe");
             SharedMessage message = Message::pack<Dictionary>(*status);
             for (std::set<SharedClientConnection>::iterator it = watchers.begin(); it != watchers.end(); ++it)
@@ -124,6 +308,35 @@ namespace routio
         return false;
     }
 
+    bool Channel::provide(SharedClientConnection client)
+    {
+        if (is_providing(client))
+            return false;
+
+        providers.push_back(ServiceProvider{client, 0});
+        service = true;
+
+        DEBUGMSG("Client ID=%d provides service on channel %d (%ld total)\n",
+                 client->get_identifier(), get_identifier(), (int64_t)providers.size());
+
+        return true;
+    }
+
+    bool Channel::withdraw(SharedClientConnection client)
+    {
+
+        if (!is_providing(client))
+            return false;
+
+        providers.erase(std::find_if(providers.begin(), providers.end(), [client](const ServiceProvider &p)
+                                     { return p.client == client; }));
+        next_provider = 0;
+        DEBUGMSG("Client ID=%d no longer provides service on channel %d (%ld total)\n",
+                 client->get_identifier(), get_identifier(), (int64_t)providers.size());
+
+        return true;
+    }
+
     bool Channel::unsubscribe(SharedClientConnection client)
     {
 
@@ -131,11 +344,13 @@ namespace routio
         {
 
             subscribers.erase(client);
-            DEBUGMSG("Client FID=%d has unsubscribed from channel %d (%ld total)\n",
-                     client->get_file_descriptor(), get_identifier(), (int64_t)subscribers.size());
+            filters.erase(client);
+            DEBUGMSG("Client ID=%d has unsubscribed from channel %d (%ld total)\n",
+                     client->get_identifier(), get_identifier(), (int64_t)subscribers.size());
 
             SharedDictionary status = generate_event_command(get_identifier());
             status->set<int>("subscribers", subscribers.size());
+            status->set<int>("subscriber", client->get_identifier());
             status->set<string>("type", "unsubscribe");
             SharedMessage message = Message::pack<Dictionary>(*status);
             for (std::set<SharedClientConnection>::iterator it = watchers.begin(); it != watchers.end(); ++it)
@@ -155,7 +370,7 @@ namespace routio
         {
 
             watchers.insert(client);
-            DEBUGMSG("Client FID=%d is watching channel %d\n", client->get_file_descriptor(), get_identifier());
+            DEBUGMSG("Client ID=%d is watching channel %d\n", client->get_identifier(), get_identifier());
 
             SharedDictionary status = generate_event_command(get_identifier());
             status->set<int>("subscribers", subscribers.size());
@@ -176,13 +391,113 @@ namespace routio
         {
 
             watchers.erase(client);
-            DEBUGMSG("Client FID=%d has stopped watching channel %d\n", client->get_file_descriptor(), get_identifier());
+            DEBUGMSG("Client ID=%d has stopped watching channel %d\n", client->get_identifier(), get_identifier());
             return true;
         }
 
         return false;
     }
 
+    void Channel::replay(SharedClientConnection client, size_t count, int64_t since)
+    {
+
+        // Latched channels always deliver at least the last message
+        if (latched && count < 1 && since < 0)
+            count = 1;
+
+        if (count < 1 && since < 0)
+            return;
+
+        for (auto frame : cache.get_frames(count, since))
+        {
+            deliver(client, frame.first, frame.second);
+        }
+    }
+
+    bool Channel::is_latched() const
+    {
+        return latched;
+    }
+
+    void Channel::set_latched(bool l)
+    {
+
+        DEBUGMSG("Channel %d is %s\n", identifier, l ? "latched" : "not latched");
+
+        // Clients that subscribed before keep the last message for their later local subscribers
+        if (l != latched)
+        {
+            SharedDictionary status = generate_event_command(get_identifier());
+            status->set<int>("subscribers", subscribers.size());
+            status->set<string>("type", "latched");
+            status->set<bool>("latched", l);
+            SharedMessage message = Message::pack<Dictionary>(*status);
+            for (auto subscriber : subscribers)
+            {
+                send(subscriber, ROUTIO_CONTROL_CHANNEL, message);
+            }
+        }
+
+        latched = l;
+
+        update_limits();
+    }
+
+    void Channel::set_history(size_t count, size_t bytes, int64_t time)
+    {
+
+        DEBUGMSG("Channel %d history set to %ld messages, %ld bytes, %ld ms\n", identifier, count, bytes, time);
+
+        history_count = count;
+        history_bytes = bytes;
+        history_time = time;
+
+        update_limits();
+    }
+
+    int64_t Channel::get_sequence() const
+    {
+        return cache.get_sequence();
+    }
+
+    void Channel::update_limits()
+    {
+        if (latched && history_count == 0 && history_bytes == 0 && history_time == 0)
+            cache.set_limits(1);
+        else
+            cache.set_limits(history_count, history_bytes, history_time);
+    }
+
+    string Channel::get_segment(size_t size)
+    {
+        if (!segment.empty())
+            return (size == segment_size) ? segment : string();
+
+        if (size < 1)
+            return string();
+
+        // Segments of different routers on the same host must not collide
+        string name = "/routio-" + to_string(getpid()) + "-" + to_string(identifier);
+
+        try
+        {
+            StateSegment::remove(name);
+            StateSegment created(name, size, true);
+        }
+        catch (runtime_error &e)
+        {
+            DEBUGMSG("%s\n", e.what());
+            return string();
+        }
+
+        DEBUGMSG("Created state segment %s for channel %d (%ld bytes)\n", name.c_str(), identifier, (int64_t)size);
+
+        segment = name;
+        segment_size = size;
+
+        return segment;
+    }
+
     bool Channel::is_subscribed(SharedClientConnection client)
     {
 
@@ -195,19 +510,107 @@ namespace routio
         return (watchers.find(client) != watchers.end());
     }
 
+    bool Channel::is_providing(SharedClientConnection client)
+    {
+
+        return std::find_if(providers.begin(), providers.end(), [client](const ServiceProvider &p)
+                            { return p.client == client; }) != providers.end();
+    }
+
+    bool Channel::is_service() const
+    {
+        return service;
+    }
+
+    void Channel::set_service(bool s)
+    {
+        service = s;
+    }
+
     int Channel::get_identifier() const
     {
         return identifier;
     }
 
-    Router::Router(SharedIOLoop loop, const std::string &address) : Server(loop, address), next_channel_id(1), clients(&ClientConnection::comparator), received_messages_size(0)
+    Router::Router(SharedIOLoop loop, const std::string &address, bool listen) : Server(loop, address, listen), next_channel_id(1), clients(&ClientConnection::comparator), received_messages_size(0), state_limit(DEFAULT_STATE_LIMIT)
     {
     }
 
+    void Router::set_state_limit(size_t limit)
+    {
+        state_limit = limit;
+    }
+
     Router::~Router()
     {
     }
 
+    void Router::shutdown()
+    {
+
+        // Disconnecting removes the client from the set
+        vector<SharedClientConnection> connected(clients.begin(), clients.end());
+
+        for (auto client : connected)
+        {
+            // Connections refer to the router, the loop must not keep them
+            loop->remove_handler(client);
+            if (client->is_connected())
+                client->disconnect();
+        }
+
+        loop->remove_handler(shared_from_this());
+
+        clients.clear();
+
+        // Releases shared memory segments of state channels
+        channels.clear();
+        aliases.clear();
+    }
+
+    EmbeddedRouter::EmbeddedRouter(const std::string &address) : loop(make_shared<IOLoop>()), running(true)
+    {
+
+        router = make_shared<Router>(loop, address, !address.empty());
+
+        if (!address.empty())
+            loop->add_handler(router);
+
+        thread = std::thread([this]()
+                             {
+            while (running)
+            {
+                // Waiting returns immediately if there is nothing to wait for
+                if (!loop->wait(100))
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            } });
+    }
+
+    EmbeddedRouter::~EmbeddedRouter()
+    {
+
+        running = false;
+
+        thread.join();
+
+        router->shutdown();
+    }
+
+    SharedClient EmbeddedRouter::connect(const string &name, SharedIOLoop loop)
+    {
+
+        SharedClient client = make_shared<Client>(name, router->connect_local());
+
+        loop->add_handler(client);
+
+        return client;
+    }
+
+    shared_ptr<Router> EmbeddedRouter::get_router() const
+    {
+        return router;
+    }
+
     string format_bytes(uint64_t b)
     {
 
@@ -248,7 +651,7 @@ namespace routio
 
         max_name += 2;
 
-        cout << setw(5) << "FID" << setw(max_name) << "NAME" << setw(8) << "OUT" << setw(8) << "IN" << setw(8) << "DROP" << endl;
+        cout << setw(5) << "ID" << setw(max_name) << "NAME" << setw(8) << "OUT" << setw(8) << "IN" << setw(8) << "DROP" << endl;
 
         for (auto client : clients)
         {
@@ -259,7 +662,7 @@ namespace routio
             if (name.empty())
                 name = "";
 
-            cout << setw(5) << client->get_file_descriptor() << setw(max_name) << name
+            cout << setw(5) << client->get_identifier() << setw(max_name) << name
                  << setw(8) << format_bytes(stats.data_read)
                  << setw(8) << format_bytes(stats.data_written)
                  << setw(8) << format_bytes(stats.data_dropped);
@@ -281,6 +684,7 @@ namespace routio
         for (auto ch : channels)
         {
             ch.second->unsubscribe(client);
+            ch.second->withdraw(client);
             ch.second->unwatch(client);
         }
 
@@ -314,6 +718,14 @@ namespace routio
             }
             return;
         }
+        // Negative channel denotes a message directed to a single subscriber
+        int target = -1;
+        if (channel < 0)
+        {
+            channel = -channel;
+            target = reader.read_integer();
+        }
+
         // Does the channel exist?
         if (channels.find(channel) == channels.end())
         {
@@ -323,8 +735,21 @@ namespace routio
 
         SharedMessage offset = make_shared<OffsetBufferMessage>(message, reader.get_position());
 
+        if (target >= 0)
+        {
+            channels[channel]->publish_to(client, target, offset);
+            return;
+        }
+
+        // Requests on service channels go to a single provider, cancellations to all of them
+        if (target == ROUTIO_TARGET_PROVIDERS || channels[channel]->is_service())
+        {
+            channels[channel]->request(client, offset, target == ROUTIO_TARGET_PROVIDERS);
+            return;
+        }
+
         // Distribute the message
-        channels[channel]->publish(client, offset);
+        channels[channel]->publish(client, offset, target != ROUTIO_TARGET_OTHERS);
     }
 
     SharedChannel Router::create_channel(const string &alias, SharedClientConnection creator, const string &type)
@@ -350,9 +775,9 @@ namespace routio
         for (set<SharedClientConnection>::iterator it = clients.begin(); it != clients.end(); it++)
         {
 
-            if ((*it)->get_file_descriptor() < fid)
+            if ((*it)->get_identifier() < fid)
                 continue;
-            if ((*it)->get_file_descriptor() == fid)
+            if ((*it)->get_identifier() == fid)
                 return *it;
 
             break;
@@ -365,8 +790,8 @@ namespace routio
     {
         if (!command->contains("key"))
         {
-            DEBUGMSG("Received illegal command message from client %s (FID=%d)\n", client->get_name().c_str(),
-                     client->get_file_descriptor());
+            DEBUGMSG("Received illegal command message from client %s (ID=%d)\n", client->get_name().c_str(),
+                     client->get_identifier());
             return SharedDictionary();
         }
 
@@ -424,13 +849,43 @@ namespace routio
                 return generate_error_command(key, "Channel does not exist");
             }
 
-            if (!channels[channel_id]->subscribe(client))
+            string service = command->get<string>("service", "");
+
+            // Providers of a service only receive requests, callers subscribe to get their replies
+            if (service == "provide")
+            {
+                if (!channels[channel_id]->provide(client))
+                    return generate_error_command(key, "Already providing");
+
+                return generate_confirm_command(key);
+            }
+
+            if (service == "call")
+            {
+                channels[channel_id]->set_service(true);
+
+                // The client may already be subscribed, e.g. as a provider of the same service
+                if (channels[channel_id]->is_subscribed(client))
+                    return generate_confirm_command(key);
+            }
+
+            if (!channels[channel_id]->subscribe(client, (size_t) max(0, command->get<int>("truncate", 0)), command->get<int>("sample", 1)))
             {
 
                 return generate_error_command(key, "Already subscribed");
             }
 
-            return generate_confirm_command(key);
+            // Confirmation has to arrive before the replayed messages so that the client knows the channel is latched,
+            // replay and live delivery are then handled in order so that no message is lost or delivered twice
+            SharedDictionary response = generate_confirm_command(key);
+            response->set<bool>("latched", channels[channel_id]->is_latched());
+            response->set<int>("sample", max(1, command->get<int>("sample", 1)));
+            response->set<int64_t>("sequence", channels[channel_id]->get_sequence());
+            send(client, ROUTIO_CONTROL_CHANNEL, Message::pack<Dictionary>(*response));
+
+            channels[channel_id]->replay(client, command->get<int>("history", 0), command->get<int64_t>("since", -1));
+
+            return SharedDictionary();
         }
         case ROUTIO_COMMAND_SUBSCRIBE_ALIAS:
         {
@@ -441,7 +896,7 @@ namespace routio
                 return generate_error_command(key, "Channel does not exist");
             }
 
-            if (!channels[channel_id]->subscribe(client))
+            if (!channels[channel_id]->subscribe(client, (size_t) max(0, command->get<int>("truncate", 0)), command->get<int>("sample", 1)))
             {
 
                 return generate_error_command(key, "Already subscribed");
@@ -450,7 +905,14 @@ namespace routio
             auto ret = generate_confirm_command(key);
             ret->set<string>("alias", channel_alias);
             ret->set<int>("channel_id", channel_id);
-            return ret;
+            ret->set<bool>("latched", channels[channel_id]->is_latched());
+            ret->set<int>("sample", max(1, command->get<int>("sample", 1)));
+            ret->set<int64_t>("sequence", channels[channel_id]->get_sequence());
+            send(client, ROUTIO_CONTROL_CHANNEL, Message::pack<Dictionary>(*ret));
+
+            channels[channel_id]->replay(client, command->get<int>("history", 0), command->get<int64_t>("since", -1));
+
+            return SharedDictionary();
         }
         case ROUTIO_COMMAND_CREATE_CHANNEL_WITH_ALIAS:
         {
@@ -470,7 +932,18 @@ namespace routio
                 return generate_error_command(key, "Channel does not exist");
             }
 
-            if (!channels[channel_id]->unsubscribe(client))
+            string service = command->get<string>("service", "");
+
+            // A client can both provide and call a service, each role can be given up separately
+            bool removed = false;
+
+            if (service != "call")
+                removed = channels[channel_id]->withdraw(client);
+
+            if (service != "provide")
+                removed = channels[channel_id]->unsubscribe(client) || removed;
+
+            if (!removed)
             {
 
                 return generate_error_command(key, "Not subscribed");
@@ -516,6 +989,58 @@ namespace routio
 
             return generate_confirm_command(key);
         }
+        case ROUTIO_COMMAND_CONFIGURE:
+        {
+
+            int channel_id = command->get<int>("channel", 0);
+
+            if (channels.find(channel_id) == channels.end())
+            {
+
+                return generate_error_command(key, "Channel does not exist");
+            }
+
+            if (command->contains("latched"))
+                channels[channel_id]->set_latched(command->get<bool>("latched", false));
+
+            if (command->contains("history") || command->contains("history_bytes") || command->contains("history_time"))
+                channels[channel_id]->set_history(command->get<int>("history", 0), command->get<int64_t>("history_bytes", 0),
+                                                  command->get<int64_t>("history_time", 0));
+
+            return generate_confirm_command(key);
+        }
+        case ROUTIO_COMMAND_STATE:
+        {
+
+            int channel_id = command->get<int>("channel", 0);
+
+            if (channels.find(channel_id) == channels.end())
+            {
+
+                return generate_error_command(key, "Channel does not exist");
+            }
+
+            // Remote clients cannot map the segment, they must not fix its size for the local ones
+            if (!client->is_local())
+                return generate_error_command(key, "State segments are only available to local clients");
+
+            int64_t size = command->get<int64_t>("size", 0);
+
+            if (size > (int64_t) state_limit)
+                return generate_error_command(key, "State segment size exceeds limit");
+
+            string segment = channels[channel_id]->get_segment((size_t) max<int64_t>(size, 0));
+
+            if (segment.empty())
+                return generate_error_command(key, "State segment not available or size does not match");
+
+            SharedDictionary response = generate_command(ROUTIO_COMMAND_RESULT);
+            response->set<string>("segment", segment);
+            response->set<int64_t>("size", size);
+            response->set<int>("key", key);
+
+            return response;
+        }
         case ROUTIO_COMMAND_SET_NAME:
         {
 
@@ -17,14 +17,23 @@
 
 #define SOCKET_BUFFER_SIZE 1024 * 1024
 #define MAX_SEND_MESSAGE_QUEUE 10000
+#define MAX_LOGICAL_CLIENTS 256
 
 using namespace std;
 
 namespace routio {
 
-ClientConnection::ClientConnection(int sfd, SharedServer server): fd(sfd), reader(sfd), writer(sfd, MAX_SEND_MESSAGE_QUEUE), connected(true),  server(server) {
+ClientConnection::ClientConnection(int sfd, SharedServer server): fd(sfd), reader(new StreamReader(sfd)), writer(new StreamWriter(sfd, MAX_SEND_MESSAGE_QUEUE)),
+	logical_id(-1), connected(true), server(server) {
 	struct ucred cr;
-	socklen_t len;
+	socklen_t len = sizeof(cr);
+
+	identifier = server->next_identifier++;
+
+	struct sockaddr_storage address;
+	socklen_t address_length = sizeof(address);
+
+	local = getsockname(fd, (struct sockaddr *) &address, &address_length) == 0 && address.ss_family == AF_UNIX;
 
 	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &len) < 0) {
 		// Unable to determine credentials, use default
@@ -41,30 +50,75 @@ ClientConnection::ClientConnection(int sfd, SharedServer server): fd(sfd), reade
 
 }
 
+ClientConnection::ClientConnection(SharedMessageQueue incoming, SharedMessageQueue outgoing, SharedServer server): fd(incoming->get_file_descriptor()),
+	incoming(incoming), outgoing(outgoing), logical_id(-1), connected(true), local(true), server(server) {
+
+	identifier = server->next_identifier++;
+
+	process_id = getpid();
+	group_id = getgid();
+	user_id = getuid();
+
+}
+
+ClientConnection::ClientConnection(SharedClientConnection parent, int logical_id, SharedServer server): fd(parent->get_file_descriptor()),
+	parent(parent), logical_id(logical_id), connected(true), local(parent->is_local()), server(server) {
+
+	identifier = server->next_identifier++;
+
+	process_id = parent->get_process();
+	group_id = parent->get_group();
+	user_id = parent->get_user();
+
+}
+
 ClientConnection::~ClientConnection() {
 
+	if (incoming) {
+		incoming->close();
+		outgoing->close();
+	}
 
 }
 
 ClientStatistics ClientConnection::get_statistics() const {
 
-	ClientStatistics s;
+	ClientStatistics s{0, 0, 0};
 
-	s.data_read = reader.get_read_data();
-	s.data_written = writer.get_written_data();
-	s.data_dropped = writer.get_dropped_data();
+	if (incoming) {
+		s.data_read = incoming->get_transferred_data();
+		s.data_written = outgoing->get_transferred_data();
+		s.data_dropped = outgoing->get_dropped_data();
+		return s;
+	}
+
+	// Traffic of logical connections is accounted to their physical connection
+	if (!reader)
+		return s;
+
+	s.data_read = reader->get_read_data();
+	s.data_written = writer->get_written_data();
+	s.data_dropped = writer->get_dropped_data();
 
 	return s;
 }
 
 
 SharedMessage ClientConnection::read() {
-	if (!connected)
+	if (!connected || parent)
 		return SharedMessage();
-	SharedMessage msg = reader.read_message();
+
+	if (incoming) {
+		SharedMessage msg = incoming->pop();
+		if (!msg && incoming->is_closed())
+			disconnect();
+		return msg;
+	}
+
+	SharedMessage msg = reader->read_message();
 
 	if (!msg) {
-		if (reader.get_error()) {
+		if (reader->get_error()) {
 			disconnect();
 		}
 
@@ -74,33 +128,69 @@ SharedMessage ClientConnection::read() {
 }
 
 bool ClientConnection::is_connected() {
-	return connected;
+	return connected && (!parent || parent->is_connected());
 }
 
 void ClientConnection::disconnect() {
 
-	server->handle_disconnect(std::dynamic_pointer_cast<ClientConnection>(shared_from_this()));
+	if (!connected)
+		return;
+
+	connected = false;
+
+	SharedClientConnection self = std::dynamic_pointer_cast<ClientConnection>(shared_from_this());
+
+	server->handle_disconnect(self);
+
+	// Logical connections end together with their physical connection
+	for (auto child : logical) {
+		child.second->disconnect();
+	}
+	logical.clear();
+
+	if (parent) {
+		DEBUGMSG("Disconnecting logical client ID=%d\n", identifier);
+		return;
+	}
+
+	if (incoming) {
+		// Descriptor belongs to the queue
+		DEBUGMSG("Disconnecting local client ID=%d\n", identifier);
+		incoming->close();
+		outgoing->close();
+		return;
+	}
 
 	if (!close(fd)) {
-		DEBUGMSG("Disconnecting client FID=%d\n", fd);
+		DEBUGMSG("Disconnecting client ID=%d (FID=%d)\n", identifier, fd);
 	} else {
 		perror("close");
 	}
-	connected = false;
 
 }
 
 void ClientConnection::send(const SharedMessage message) {
-	writer.add_message(message, 0);
+	if (parent) {
+		parent->send(make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<int>::wrap(ROUTIO_LOGICAL_FRAME),
+			PrimitiveBuffer<int>::wrap(logical_id), message}));
+		return;
+	}
+	if (outgoing) {
+		outgoing->push(message);
+		return;
+	}
+	writer->add_message(message, 0);
 }
 
 bool ClientConnection::write() {
 	if (!connected) {
 		return false;
 	}
-	bool status = writer.write_messages();
+	if (!writer)
+		return true;
+	bool status = writer->write_messages();
 	if (!status) {
-		if (writer.get_error()) {
+		if (writer->get_error()) {
 			DEBUGMSG("Writer error FID=%d\n", fd);
 			disconnect();
 		}
@@ -117,6 +207,11 @@ int ClientConnection::get_user() const {
 	return user_id;
 }
 
+bool ClientConnection::is_local() const {
+
+	return local;
+}
+
 int ClientConnection::get_group() const {
 
 	return group_id;
@@ -126,6 +221,10 @@ int ClientConnection::get_file_descriptor() {
 	return fd;
 }
 
+int ClientConnection::get_identifier() const {
+	return identifier;
+}
+
 string ClientConnection::get_name() const {
 	return name;
 }
@@ -136,17 +235,68 @@ void ClientConnection::set_name(string name) {
 
 bool ClientConnection::handle_input() {
 
+	SharedClientConnection self = std::dynamic_pointer_cast<ClientConnection>(shared_from_this());
+
 	while (true) {
 		SharedMessage msg = read();
 
-		if (msg) {
-			server->handle_message(std::dynamic_pointer_cast<ClientConnection>(shared_from_this()), msg);
-		} else {
+		if (!msg) {
 			if (!is_connected())
 				return false;
 			break;
 		}
 
+		try {
+
+			MessageReader reader(msg);
+
+			if (msg->get_length() < sizeof(int) || reader.read_integer() != ROUTIO_LOGICAL_FRAME) {
+				server->handle_message(self, msg);
+				continue;
+			}
+
+			// Frame of a logical client multiplexed over this connection
+			if (msg->get_length() < 2 * sizeof(int)) {
+				throw ParseException();
+			}
+
+			int id = reader.read_integer();
+
+			auto child = logical.find(id);
+
+			if (msg->get_length() == reader.get_position()) {
+				// Frame without content closes the logical connection
+				if (child != logical.end()) {
+					SharedClientConnection closed = child->second;
+					logical.erase(child);
+					closed->disconnect();
+				}
+				continue;
+			}
+
+			if (child == logical.end()) {
+				if (logical.size() >= MAX_LOGICAL_CLIENTS) {
+					DEBUGMSG("Too many logical clients over FID=%d, dropping frame of ID=%d\n", fd, id);
+					continue;
+				}
+				SharedClientConnection connection = make_shared<ClientConnection>(self, id, server);
+				DEBUGMSG("Connecting logical client ID=%d over FID=%d\n", connection->get_identifier(), fd);
+				child = logical.insert(make_pair(id, connection)).first;
+				server->handle_connect(connection);
+			}
+
+			server->handle_message(child->second, make_shared<OffsetBufferMessage>(msg, reader.get_position()));
+
+		} catch (EndOfBufferException &e) {
+			DEBUGMSG("Truncated message from FID=%d\n", fd);
+			disconnect();
+			return false;
+		} catch (ParseException &e) {
+			DEBUGMSG("Malformed message from FID=%d\n", fd);
+			disconnect();
+			return false;
+		}
+
 	}
 
 	return true;
@@ -160,7 +310,7 @@ bool ClientConnection::handle_output() {
 
 bool ClientConnection::comparator(const SharedClientConnection &lhs, const SharedClientConnection &rhs) {
 
-    return lhs->get_file_descriptor() < rhs->get_file_descriptor();
+    return lhs->get_identifier() < rhs->get_identifier();
 
 }
 
@@ -250,7 +400,11 @@ int create_and_bind_interface(int port) {
 
 }
 
-Server::Server(SharedIOLoop loop, const std::string& address) : loop(loop) {
+Server::Server(SharedIOLoop loop, const std::string& address, bool listen) : loop(loop), fd(-1) {
+
+	// Server that only accepts clients in the same process
+	if (!listen)
+		return;
 
 	int s;
 	// Valgrind reports error otherwise: http://stackoverflow.com/questions/19364942/points-to-uninitialised-bytes-valgrind-errors
@@ -287,7 +441,7 @@ Server::Server(SharedIOLoop loop, const std::string& address) : loop(loop) {
 	if (s == -1)
 		abort();
 
-	s = listen(fd, SOMAXCONN);
+	s = ::listen(fd, SOMAXCONN);
 	if (s == -1) {
 		perror("listen");
 		abort();
@@ -354,6 +508,25 @@ bool Server::handle_output() {
 	return true;
 }
 
+pair<SharedMessageQueue, SharedMessageQueue> Server::connect_local() {
+
+	SharedMessageQueue to_client = make_shared<MessageQueue>(MAX_SEND_MESSAGE_QUEUE);
+	SharedMessageQueue to_server = make_shared<MessageQueue>();
+
+	SharedServer self = std::dynamic_pointer_cast<Server>(shared_from_this());
+
+	// Connection identifiers are assigned while the loop is not handling other connections
+	loop->execute([this, self, to_client, to_server]() {
+		SharedClientConnection client = make_shared<ClientConnection>(to_server, to_client, self);
+		DEBUGMSG("Connecting local client ID=%d\n", client->get_identifier());
+		loop->add_handler(client);
+		handle_connect(client);
+	});
+
+	return make_pair(to_client, to_server);
+
+}
+
 void Server::disconnect() {
 
 	if (fd > 0) {
@@ -0,0 +1,679 @@
+
+#include "debug.h"
+#include <routio/service.h>
+
+namespace routio {
+
+ServiceRequest::ServiceRequest(int64_t identifier, int caller, SharedMessage message, int64_t timeout) : identifier(identifier),
+    caller(caller), message(message), cancelled(false) {
+
+    if (timeout > 0)
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    else
+        deadline = std::chrono::steady_clock::time_point::max();
+
+}
+
+int64_t ServiceRequest::get_identifier() const {
+
+    return identifier;
+
+}
+
+int ServiceRequest::get_caller() const {
+
+    return caller;
+
+}
+
+SharedMessage ServiceRequest::get_message() const {
+
+    return message;
+
+}
+
+bool ServiceRequest::is_cancelled() const {
+
+    return cancelled;
+
+}
+
+bool ServiceRequest::is_expired() const {
+
+    return std::chrono::steady_clock::now() > deadline;
+
+}
+
+std::chrono::steady_clock::time_point ServiceRequest::get_deadline() const {
+
+    return deadline;
+
+}
+
+Service::Service(SharedClient client, const string &name, ServiceHandler handler, SharedExecutor executor, size_t concurrency,
+                 size_t queue, const string &type) : liveness(make_shared<Liveness>()), client(client), handler(handler), executor(executor), queue(queue), statistics{0, 0, 0, 0, 0, 0} {
+
+    liveness->alive = true;
+
+    callback = create_data_callback([this, liveness = this->liveness](SharedMessage message) {
+        std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+        if (liveness->alive)
+            data_callback(message);
+    });
+
+    if (executor) {
+
+        concurrency = max<size_t>(concurrency, 1);
+
+        for (size_t i = 0; i < concurrency; i++) {
+            SharedNode worker = make_shared<Node>(name);
+            worker->add_queue(1, NODE_QUEUE_DROP);
+            executor->add(worker);
+            workers.push_back(worker);
+        }
+
+        active.resize(concurrency);
+
+    }
+
+    client->lookup_channel(name, type, [this, liveness = this->liveness](SharedDictionary lookup) {
+        std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+        if (liveness->alive)
+            lookup_callback(lookup);
+    });
+
+}
+
+Service::~Service() {
+
+    stop();
+
+    // Waits for a callback that is running, e.g. a request handled on the loop
+    std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+    liveness->alive = false;
+
+}
+
+void Service::stop() {
+
+    deque<SharedServiceRequest> waiting;
+    vector<SharedNode> removed;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        stopped = true;
+
+        waiting.swap(pending);
+
+        // Requests are only handed to workers under the lock and while not stopped
+        removed.swap(workers);
+    }
+
+    for (auto request : waiting)
+        reply(request, SERVICE_UNAVAILABLE);
+
+    int channel = id.exchange(-1);
+
+    if (channel > 0) {
+        SharedDictionary options = make_shared<Dictionary>();
+        options->set<string>("service", "provide");
+        client->unsubscribe(channel, callback, options);
+    }
+
+    for (auto worker : removed) {
+
+        executor->remove(worker);
+
+        size_t cleared = 0;
+
+        // Requests that have not started yet would never be processed once the worker is removed
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+
+            for (auto &queue : worker->queues) {
+                cleared += queue.tasks.size();
+                queue.tasks.clear();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        scheduled -= cleared;
+
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    idle.wait(lock, [this]() { return scheduled == 0; });
+
+}
+
+ServiceStatistics Service::get_statistics() {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return statistics;
+
+}
+
+SharedMessage Service::on_request(SharedServiceRequest request) {
+
+    if (!handler)
+        throw runtime_error("No handler for service request");
+
+    return handler(request);
+
+}
+
+void Service::on_error(const std::exception &error) {
+
+    DEBUGMSG("Error in service: %s\n", error.what());
+
+}
+
+void Service::lookup_callback(SharedDictionary lookup) {
+
+    if (lookup->contains("error")) {
+        on_error(runtime_error("Unable to find service channel"));
+        return;
+    }
+
+    int channel = lookup->get<int>("channel", -1);
+
+    {
+        // A service that was stopped meanwhile does not provide the channel any more
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopped)
+            return;
+        id = channel;
+    }
+
+    SharedDictionary options = make_shared<Dictionary>();
+    options->set<string>("service", "provide");
+
+    client->subscribe(channel, callback, options);
+
+}
+
+void Service::data_callback(SharedMessage message) {
+
+    SharedServiceRequest request;
+
+    try {
+
+        MessageReader reader(message);
+
+        int64_t caller = reader.read_long();
+
+        // Replies to calls made by the same client
+        if (caller < 0)
+            return;
+
+        int64_t identifier = reader.read_long();
+        int kind = reader.read_integer();
+        int64_t timeout = reader.read_long();
+
+        if (kind == SERVICE_CANCEL) {
+            cancel(identifier, (int) caller);
+            return;
+        }
+
+        request = make_shared<ServiceRequest>(identifier, (int) caller, make_shared<OffsetBufferMessage>(message, reader.get_position()), timeout);
+
+    } catch (EndOfBufferException &e) {
+        on_error(e);
+        return;
+    }
+
+    int status = SERVICE_OK;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        statistics.requests_received++;
+
+        if (stopped) {
+            status = SERVICE_UNAVAILABLE;
+        } else if (!active.empty()) {
+
+            size_t worker = active.size();
+
+            for (size_t i = 0; i < active.size(); i++) {
+                if (!active[i]) {
+                    worker = i;
+                    break;
+                }
+            }
+
+            if (worker < active.size()) {
+                // Worker is taken right away so that a worker that finishes cannot be given another request
+                active[worker] = request;
+                assign(worker, request);
+                return;
+            } else if (pending.size() < queue) {
+                pending.push_back(request);
+                return;
+            } else {
+                statistics.requests_rejected++;
+                status = SERVICE_BUSY;
+            }
+        }
+    }
+
+    if (status != SERVICE_OK) {
+        reply(request, status);
+        return;
+    }
+
+    // Without workers requests are handled on the loop
+    handle(request);
+
+}
+
+void Service::cancel(int64_t identifier, int caller) {
+
+    SharedServiceRequest request;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto it = pending.begin(); it != pending.end(); it++) {
+            if ((*it)->identifier == identifier && (*it)->caller == caller) {
+                request = *it;
+                pending.erase(it);
+                statistics.requests_cancelled++;
+                break;
+            }
+        }
+
+        // Handlers that are already running are only notified
+        for (auto running : active) {
+            if (running && running->identifier == identifier && running->caller == caller)
+                running->cancelled = true;
+        }
+    }
+
+    // Every request is answered so that the router knows how many requests a provider has
+    if (request)
+        reply(request, SERVICE_CANCELLED);
+
+}
+
+void Service::assign(size_t worker, SharedServiceRequest request) {
+
+    scheduled++;
+
+    workers[worker]->push(0, [this, worker, request]() { process(worker, request); });
+
+}
+
+void Service::process(size_t worker, SharedServiceRequest request) {
+
+    handle(request);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    active[worker].reset();
+
+    // A stopped service has removed its workers, the request would never run
+    if (!stopped && !pending.empty()) {
+        active[worker] = pending.front();
+        pending.pop_front();
+        assign(worker, active[worker]);
+    }
+
+    scheduled--;
+
+    idle.notify_all();
+
+}
+
+void Service::handle(SharedServiceRequest request) {
+
+    if (request->is_cancelled()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            statistics.requests_cancelled++;
+        }
+        reply(request, SERVICE_CANCELLED);
+        return;
+    }
+
+    // Nobody is waiting for the result any more
+    if (request->is_expired()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            statistics.requests_expired++;
+        }
+        reply(request, SERVICE_TIMEOUT);
+        return;
+    }
+
+    SharedMessage result;
+
+    try {
+
+        result = on_request(request);
+
+    } catch (std::exception &e) {
+
+        on_error(e);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            statistics.errors++;
+        }
+
+        MessageWriter writer;
+        writer.write_string(e.what());
+        reply(request, SERVICE_ERROR, make_shared<BufferedMessage>(writer));
+        return;
+
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (request->is_cancelled())
+            statistics.requests_cancelled++;
+        else
+            statistics.requests_completed++;
+    }
+
+    if (request->is_cancelled())
+        reply(request, SERVICE_CANCELLED);
+    else
+        reply(request, SERVICE_OK, result);
+
+}
+
+void Service::reply(SharedServiceRequest request, int status, SharedMessage message) {
+
+    int channel = id;
+
+    if (channel < 1)
+        return;
+
+    vector<SharedBuffer> buffers{PrimitiveBuffer<int64_t>::wrap(request->identifier), PrimitiveBuffer<int>::wrap(status)};
+
+    if (message)
+        buffers.push_back(message);
+
+    client->send(channel, make_shared<MultiBufferMessage>(buffers), NULL, 0, request->caller);
+
+}
+
+ServiceClient::ServiceClient(SharedClient client, const string &name, const string &type, SharedIOLoop loop) : liveness(make_shared<Liveness>()), client(client), loop(loop) {
+
+    liveness->alive = true;
+
+    callback = create_data_callback([this, liveness = this->liveness](SharedMessage message) {
+        std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+        if (liveness->alive)
+            data_callback(message);
+    });
+
+    timer = make_shared<Timer>([this, liveness = this->liveness]() {
+        std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+        if (liveness->alive)
+            expire();
+    });
+
+    loop->add_handler(timer);
+
+    client->lookup_channel(name, type, [this, liveness = this->liveness](SharedDictionary lookup) {
+        std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+        if (liveness->alive)
+            lookup_callback(lookup);
+    });
+
+}
+
+ServiceClient::~ServiceClient() {
+
+    {
+        // Replies, timeouts and the lookup are ignored from now on, calls are only completed below
+        std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+        liveness->alive = false;
+    }
+
+    vector<int64_t> pending;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+
+        for (auto &call : calls)
+            pending.push_back(call.first);
+    }
+
+    // Every call is completed, also the ones whose reply would arrive after the client is gone
+    for (auto identifier : pending)
+        cancel(identifier);
+
+    // Other subscriptions of the client may still need the channel, so the role is not given up explicitly
+    if (id > 0)
+        client->unsubscribe(id, callback);
+
+    loop->remove_handler(timer);
+
+}
+
+int64_t ServiceClient::call(SharedMessage request, ServiceCallback callback, int64_t timeout) {
+
+    int64_t identifier;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+
+        // Replies reach all service clients of the connection, identifiers tell them apart
+        identifier = client->next_call++;
+
+        PendingCall call{request, callback, max<int64_t>(timeout, 0), std::chrono::steady_clock::time_point::max()};
+
+        if (timeout > 0) {
+            call.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+            deadlines.insert(make_pair(call.deadline, identifier));
+        }
+
+        calls[identifier] = call;
+
+        if (timeout > 0)
+            update_timer();
+
+        // Calls made before the channel is known are sent once it is
+        if (id > 0) {
+            send_request(identifier, call);
+            calls[identifier].message.reset();
+        }
+
+        if (!failed)
+            return identifier;
+    }
+
+    complete(identifier, SERVICE_UNAVAILABLE);
+
+    return identifier;
+
+}
+
+bool ServiceClient::cancel(int64_t request) {
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+
+        if (calls.find(request) == calls.end())
+            return false;
+
+        if (id > 0) {
+            MessageWriter writer;
+            writer.write_long(request);
+            writer.write_integer(SERVICE_CANCEL);
+            writer.write_long(0);
+            client->send(id, make_shared<BufferedMessage>(writer), NULL, 0, ROUTIO_TARGET_PROVIDERS);
+        }
+    }
+
+    complete(request, SERVICE_CANCELLED);
+
+    return true;
+
+}
+
+size_t ServiceClient::get_pending() {
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    return calls.size();
+
+}
+
+void ServiceClient::lookup_callback(SharedDictionary lookup) {
+
+    vector<int64_t> unsent;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+
+        if (lookup->contains("error")) {
+            failed = true;
+        } else {
+
+            id = lookup->get<int>("channel", -1);
+
+            SharedDictionary options = make_shared<Dictionary>();
+            options->set<string>("service", "call");
+
+            // Replies are directed to subscribers, requests are only sent after subscribing
+            client->subscribe(id, callback, options);
+
+            for (auto &call : calls) {
+                send_request(call.first, call.second);
+                call.second.message.reset();
+            }
+
+            return;
+        }
+
+        for (auto &call : calls)
+            unsent.push_back(call.first);
+    }
+
+    for (auto identifier : unsent)
+        complete(identifier, SERVICE_UNAVAILABLE);
+
+}
+
+void ServiceClient::data_callback(SharedMessage message) {
+
+    try {
+
+        MessageReader reader(message);
+
+        int64_t sequence = reader.read_long();
+
+        // Requests of other callers that were published before the channel became a service
+        if (sequence >= 0)
+            return;
+
+        int64_t identifier = reader.read_long();
+
+        if (sequence == ROUTIO_SEQUENCE_RETURNED) {
+            complete(identifier, SERVICE_UNAVAILABLE);
+            return;
+        }
+
+        int status = reader.read_integer();
+
+        complete(identifier, status, make_shared<OffsetBufferMessage>(message, reader.get_position()));
+
+    } catch (EndOfBufferException &e) {
+        DEBUGMSG("Illegal service reply\n");
+    }
+
+}
+
+void ServiceClient::send_request(int64_t identifier, const PendingCall &call) {
+
+    int64_t timeout = 0;
+
+    // Provider gets the time that is left, clocks of different machines are not compared
+    if (call.timeout > 0)
+        timeout = max<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(call.deadline - std::chrono::steady_clock::now()).count(), 1);
+
+    vector<SharedBuffer> buffers{PrimitiveBuffer<int64_t>::wrap(identifier), PrimitiveBuffer<int>::wrap(SERVICE_REQUEST),
+        PrimitiveBuffer<int64_t>::wrap(timeout)};
+
+    if (call.message)
+        buffers.push_back(call.message);
+
+    client->send(id, make_shared<MultiBufferMessage>(buffers));
+
+}
+
+void ServiceClient::complete(int64_t identifier, int status, SharedMessage reply) {
+
+    ServiceCallback callback;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+
+        auto call = calls.find(identifier);
+
+        // Replies to cancelled or expired calls
+        if (call == calls.end())
+            return;
+
+        callback = call->second.callback;
+
+        if (call->second.timeout > 0) {
+            deadlines.erase(make_pair(call->second.deadline, identifier));
+            update_timer();
+        }
+
+        calls.erase(call);
+    }
+
+    if (callback)
+        callback(status, reply);
+
+}
+
+void ServiceClient::expire() {
+
+    vector<int64_t> expired;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        for (auto deadline : deadlines) {
+            if (deadline.first > now)
+                break;
+            expired.push_back(deadline.second);
+        }
+    }
+
+    for (auto identifier : expired)
+        complete(identifier, SERVICE_TIMEOUT);
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    update_timer();
+
+}
+
+void ServiceClient::update_timer() {
+
+    if (deadlines.empty()) {
+        timer->stop();
+        return;
+    }
+
+    int64_t timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadlines.begin()->first - std::chrono::steady_clock::now()).count();
+
+    timer->start(max<int64_t>(timeout + 1, 1));
+
+}
+
+}
@@ -0,0 +1,323 @@
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "debug.h"
+#include <routio/state.h>
+
+namespace routio {
+
+// Attempts between checks of the timeout, the processor is yielded after the first ones
+#define STATE_SPIN_ATTEMPTS 64
+
+static inline void backoff(int attempt) {
+
+    if (attempt < STATE_SPIN_ATTEMPTS) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else {
+        std::this_thread::yield();
+    }
+
+}
+
+static inline bool expired(int attempt, std::chrono::steady_clock::time_point start) {
+
+    return (attempt % STATE_SPIN_ATTEMPTS) == STATE_SPIN_ATTEMPTS - 1 &&
+        std::chrono::steady_clock::now() - start > std::chrono::microseconds(ROUTIO_STATE_TIMEOUT);
+
+}
+
+StateSegment::StateSegment(const string &name, size_t capacity, bool create) : name(name), mapped(ROUTIO_STATE_HEADER_SIZE + capacity), capacity(capacity), stalled(0) {
+
+    int fd = shm_open(name.c_str(), create ? (O_CREAT | O_EXCL | O_RDWR) : O_RDWR, 0660);
+
+    if (fd == -1)
+        throw runtime_error(_format_string("Unable to open state segment %s (%d)", name.c_str(), errno));
+
+    if (create && ftruncate(fd, mapped) == -1) {
+        close(fd);
+        shm_unlink(name.c_str());
+        throw runtime_error(_format_string("Unable to resize state segment %s (%d)", name.c_str(), errno));
+    }
+
+    void *memory = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (memory == MAP_FAILED) {
+        if (create)
+            shm_unlink(name.c_str());
+        throw runtime_error(_format_string("Unable to map state segment %s (%d)", name.c_str(), errno));
+    }
+
+    header = (StateSegmentHeader *) memory;
+    data = (uchar *) memory + ROUTIO_STATE_HEADER_SIZE;
+
+    if (create) {
+        // Memory of a new segment is zeroed
+        new (header) StateSegmentHeader();
+        header->capacity = capacity;
+        header->magic = ROUTIO_STATE_MAGIC;
+    } else if (header->magic != ROUTIO_STATE_MAGIC || header->capacity != capacity) {
+        munmap(header, mapped);
+        throw runtime_error(_format_string("State segment %s does not match", name.c_str()));
+    }
+
+}
+
+StateSegment::~StateSegment() {
+
+    munmap(header, mapped);
+
+}
+
+bool StateSegment::write(const void *value, size_t length) {
+
+    // The header is shared with other processes, only the mapped size is trusted
+    if (length > capacity)
+        return false;
+
+    // Writers take turns by making the sequence odd
+    uint64_t sequence = header->sequence.load(std::memory_order_relaxed);
+    uint64_t observed = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int attempt = 0; ; attempt++) {
+
+        if (!(sequence & 1)) {
+            if (header->sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                sequence++;
+                break;
+            }
+            continue;
+        }
+
+        if (sequence != observed) {
+            observed = sequence;
+            start = std::chrono::steady_clock::now();
+        } else if (expired(attempt, start)) {
+            // A writer that died while writing left the sequence odd, its write is taken over
+            if (header->sequence.compare_exchange_strong(sequence, sequence + 2, std::memory_order_acquire, std::memory_order_relaxed)) {
+                DEBUGMSG("Taking over unfinished write of state segment %s\n", name.c_str());
+                sequence += 2;
+                break;
+            }
+            continue;
+        }
+
+        backoff(attempt);
+
+        sequence = header->sequence.load(std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(data, value, length);
+    header->length.store(length, std::memory_order_relaxed);
+
+    // Fails if the write took too long and was taken over by another writer
+    return header->sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_release, std::memory_order_relaxed);
+
+}
+
+uint64_t StateSegment::read(void *value, size_t capacity, size_t &length) const {
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int attempt = 0; ; attempt++) {
+
+        uint64_t before = header->sequence.load(std::memory_order_acquire);
+
+        if (!(before & 1)) {
+
+            length = min<size_t>(header->length.load(std::memory_order_relaxed), this->capacity);
+
+            memcpy(value, data, min(length, capacity));
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (header->sequence.load(std::memory_order_relaxed) == before)
+                return before / 2;
+
+        } else if (before == stalled.load(std::memory_order_relaxed)) {
+            // Do not wait again for a write that did not complete before, until a writer takes it over
+            length = 0;
+            return 0;
+        }
+
+        if (expired(attempt, start)) {
+            if (before & 1)
+                stalled.store(before, std::memory_order_relaxed);
+            length = 0;
+            return 0;
+        }
+
+        backoff(attempt);
+
+    }
+
+}
+
+uint64_t StateSegment::get_version() const {
+
+    return header->sequence.load(std::memory_order_acquire) / 2;
+
+}
+
+size_t StateSegment::get_capacity() const {
+
+    return capacity;
+
+}
+
+string StateSegment::get_name() const {
+
+    return name;
+
+}
+
+void StateSegment::remove(const string &name) {
+
+    shm_unlink(name.c_str());
+
+}
+
+StateChannel::StateChannel(SharedClient client, const string &alias, size_t size, const string &type) : segment(NULL), liveness(make_shared<Liveness>()), client(client), size(size) {
+
+    liveness->alive = true;
+
+    client->lookup_channel(alias, type, [this, liveness = this->liveness](SharedDictionary lookup) {
+        std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+        if (liveness->alive)
+            lookup_callback(lookup);
+    });
+
+}
+
+StateChannel::~StateChannel() {
+
+    // Waits for a callback that is running on another thread
+    std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+    liveness->alive = false;
+
+}
+
+bool StateChannel::is_ready() const {
+
+    return segment.load(std::memory_order_acquire) != NULL;
+
+}
+
+size_t StateChannel::get_size() const {
+
+    return size;
+
+}
+
+void StateChannel::on_ready() {
+
+}
+
+void StateChannel::on_error(const std::exception &error) {
+
+    DEBUGMSG("Error in state channel: %s\n", error.what());
+
+}
+
+void StateChannel::lookup_callback(SharedDictionary lookup) {
+
+    if (lookup->contains("error")) {
+        on_error(runtime_error("Unable to find channel"));
+        return;
+    }
+
+    SharedDictionary command = generate_command(ROUTIO_COMMAND_STATE);
+    command->set<int>("channel", lookup->get<int>("channel", -1));
+    command->set<int64_t>("size", size);
+
+    client->send_command(command, [this, liveness = this->liveness](SharedDictionary, SharedDictionary response) {
+        std::lock_guard<std::recursive_mutex> lock(liveness->mutex);
+        return liveness->alive ? broker_callback(response) : true;
+    });
+
+}
+
+bool StateChannel::broker_callback(SharedDictionary response) {
+
+    if (response->get<int>("code", ROUTIO_COMMAND_UNKNOWN) != ROUTIO_COMMAND_RESULT) {
+        on_error(runtime_error(response->get<string>("error", "Unable to get state segment")));
+        return true;
+    }
+
+    try {
+
+        mapping.reset(new StateSegment(response->get<string>("segment", ""), size));
+
+    } catch (runtime_error &e) {
+        on_error(e);
+        return true;
+    }
+
+    segment.store(mapping.get(), std::memory_order_release);
+
+    on_ready();
+
+    return true;
+
+}
+
+StateWriter::StateWriter(SharedClient client, const string &alias, size_t size, const string &type) : StateChannel(client, alias, size, type) {
+
+}
+
+StateWriter::~StateWriter() {
+
+}
+
+bool StateWriter::write(const void *data, size_t length) {
+
+    StateSegment *s = segment.load(std::memory_order_acquire);
+
+    if (!s)
+        return false;
+
+    return s->write(data, length);
+
+}
+
+StateReader::StateReader(SharedClient client, const string &alias, size_t size, const string &type) : StateChannel(client, alias, size, type) {
+
+}
+
+StateReader::~StateReader() {
+
+}
+
+uint64_t StateReader::read(void *data, size_t capacity, size_t &length) const {
+
+    StateSegment *s = segment.load(std::memory_order_acquire);
+
+    length = 0;
+
+    if (!s)
+        return 0;
+
+    return s->read(data, capacity, length);
+
+}
+
+uint64_t StateReader::get_version() const {
+
+    StateSegment *s = segment.load(std::memory_order_acquire);
+
+    return s ? s->get_version() : 0;
+
+}
+
+}
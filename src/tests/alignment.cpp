@@ -0,0 +1,115 @@
+#include <iostream>
+#include <memory>
+#include <unistd.h>
+
+#include <routio/client.h>
+#include <routio/datatypes.h>
+#include <routio/helpers.h>
+#include <routio/array.h>
+#include <routio/routing.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+SharedTensor make_tensor(size_t height, size_t width) {
+
+    SharedTensor tensor = make_shared<Tensor>(initializer_list<size_t>{height, width, 3}, UINT8);
+
+    for (size_t i = 0; i < tensor->get_size(); i++)
+        tensor->get_data()[i] = i % 251;
+
+    return tensor;
+}
+
+bool is_valid(SharedTensor tensor) {
+
+    for (size_t i = 0; i < tensor->get_size(); i++)
+        if (tensor->get_const_data()[i] != (uchar) (i % 251)) return false;
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+
+    string address = "/tmp/routio_alignment_" + to_string(getpid()) + ".sock";
+
+    EmbeddedRouter router(address);
+
+    SharedClient publisher_client = router.connect("publisher");
+
+    // Socket clients read frames with a channel prefix, logical clients with an additional multiplexer prefix
+    SharedClient socket_client = routio::connect(address, "socket");
+    SharedMultiplexer multiplexer = routio::multiplex(address);
+    SharedClient logical_client = multiplexer->connect("logical");
+
+    TypedPublisher<SharedTensor> publisher(publisher_client, "tensors");
+
+    int received = 0, failed = 0;
+
+    auto callback = [&](shared_ptr<SharedTensor> tensor) {
+        received++;
+        if (((uintptr_t) (*tensor)->get_const_data()) % ROUTIO_ALIGNMENT != 0 || !is_valid(*tensor)) {
+            cerr << "Unaligned or invalid tensor of size " << (*tensor)->get_size() << endl;
+            failed++;
+        }
+    };
+
+    TypedSubscriber<SharedTensor> socket_subscriber(socket_client, "tensors", callback);
+    TypedSubscriber<SharedTensor> logical_subscriber(logical_client, "tensors", callback);
+
+    if (!wait_for([&]() { return publisher.get_subscribers() >= 2; })) {
+        cerr << "Subscribers not connected" << endl;
+        return -1;
+    }
+
+    publisher.send(make_tensor(60, 80));
+    publisher.send(make_tensor(1, 1));
+
+    if (!wait_for([&]() { return received >= 4; })) {
+        cerr << "Received " << received << " tensors" << endl;
+        return -1;
+    }
+
+    unlink(address.c_str());
+
+    // Readers without alignment take the low byte of the header as the number of dimensions
+    MessageWriter aligned;
+    write(aligned, make_tensor(4, 4));
+
+    MessageReader legacy(make_shared<BufferedMessage>(aligned));
+    uint8_t ndim = legacy.read<size_t>();
+    DataType type = (DataType) legacy.read<uint8_t>();
+
+    bool rejected = false;
+
+    try {
+        make_shared<Tensor>(vector<size_t>(ndim, 1), type);
+    } catch (runtime_error &e) {
+        rejected = true;
+    }
+
+    if (ndim != 0 || !rejected) {
+        cerr << "Aligned tensor accepted by older readers" << endl;
+        return -1;
+    }
+
+    // Tensors from older writers are still decoded
+    SharedTensor original = make_tensor(4, 4);
+    MessageWriter unaligned;
+    unaligned.write<size_t>(original->ndims());
+    for (size_t i = 0; i < original->ndims(); i++)
+        unaligned.write<size_t>(original->shape(i));
+    unaligned.write<uint8_t>((uint8_t) original->get_type());
+    unaligned.write_buffer(original->get_const_data(), original->get_size());
+
+    SharedTensor decoded = *Message::unpack<SharedTensor>(make_shared<BufferedMessage>(unaligned));
+
+    if (decoded->dims() != original->dims() || !is_valid(decoded)) {
+        cerr << "Tensor without alignment not decoded" << endl;
+        return -1;
+    }
+
+    return failed ? -1 : 0;
+}
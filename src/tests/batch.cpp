@@ -0,0 +1,118 @@
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <atomic>
+
+#include <routio/client.h>
+#include <routio/datatypes.h>
+#include <routio/pipeline.h>
+#include <routio/routing.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+#define MESSAGES 10
+
+Dictionary make_value(int value) {
+
+    Dictionary dictionary;
+    dictionary.set<int>("value", value);
+    return dictionary;
+
+}
+
+int main(int argc, char** argv) {
+
+    EmbeddedRouter router;
+
+    SharedClient publisher_client = router.connect("publisher");
+    SharedClient client = router.connect("batches");
+
+    TypedPublisher<Dictionary> publisher(publisher_client, "values");
+
+    // Batches are limited in size
+    std::atomic<int> received(0), largest(0);
+
+    TypedBatchSubscriber<Dictionary> limited(client, "values", [&](vector<shared_ptr<Dictionary>> &batch) {
+        received += batch.size();
+        largest = max<int>(largest, batch.size());
+    }, 4);
+
+    // Batches are collected until the first message has waited long enough
+    std::atomic<int> waited(0), batches(0);
+
+    TypedBatchSubscriber<Dictionary> waiting(client, "values", [&](vector<shared_ptr<Dictionary>> &batch) {
+        waited += batch.size();
+        batches++;
+    }, 100, 200);
+
+    // Released before its timer fires
+    std::atomic<int> released_received(0);
+
+    unique_ptr<TypedBatchSubscriber<Dictionary>> released(new TypedBatchSubscriber<Dictionary>(client, "values", [&](vector<shared_ptr<Dictionary>> &batch) {
+        released_received += batch.size();
+    }, 100, 200));
+
+    if (!wait_for([&]() { return publisher.get_subscribers() == 1; })) {
+        cerr << "Subscribers not ready" << endl;
+        return -1;
+    }
+
+    for (int i = 0; i < MESSAGES; i++)
+        publisher.send(make_value(i));
+
+    if (!wait_for([&]() { return received == MESSAGES; })) {
+        cerr << "Messages not delivered in batches" << endl;
+        return -1;
+    }
+
+    if (largest > 4) {
+        cerr << "Batch larger than its size" << endl;
+        return -1;
+    }
+
+    released.reset();
+
+    if (!wait_for([&]() { return waited > 0; }) || waited != MESSAGES || batches != 1) {
+        cerr << "Messages not collected until the timeout" << endl;
+        return -1;
+    }
+
+    routio::wait(100);
+
+    // Timers of released subscribers do not deliver anything
+    if (released_received != 0) {
+        cerr << "Batch delivered by a released subscriber" << endl;
+        return -1;
+    }
+
+    // Batches completed by the timer are delivered on the executor
+    client->set_executor(make_shared<Executor>(2));
+
+    std::thread::id main_thread = std::this_thread::get_id();
+    std::atomic<bool> on_executor(false);
+    std::atomic<int> executed(0);
+
+    TypedBatchSubscriber<Dictionary> executed_subscriber(client, "executed", [&](vector<shared_ptr<Dictionary>> &batch) {
+        on_executor = std::this_thread::get_id() != main_thread;
+        executed += batch.size();
+    }, 100, 50);
+
+    TypedPublisher<Dictionary> executed_publisher(publisher_client, "executed");
+
+    if (!wait_for([&]() { return executed_publisher.get_subscribers() == 1; })) {
+        cerr << "Subscriber not ready" << endl;
+        return -1;
+    }
+
+    executed_publisher.send(make_value(0));
+
+    if (!wait_for([&]() { return executed == 1; }) || !on_executor) {
+        cerr << "Batch not delivered on the executor" << endl;
+        return -1;
+    }
+
+    return 0;
+}
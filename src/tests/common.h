@@ -0,0 +1,21 @@
+#ifndef __ROUTIO_TESTS_COMMON_H
+#define __ROUTIO_TESTS_COMMON_H
+
+#include <functional>
+
+#include <routio/loop.h>
+
+/**
+ * Runs the loop until the condition holds or the timeout in milliseconds passes.
+ */
+inline bool wait_for(std::function<bool()> condition, int timeout = 3000) {
+
+    for (int i = 0; i < timeout / 10; i++) {
+        if (condition()) return true;
+        routio::wait(10);
+    }
+
+    return condition();
+}
+
+#endif
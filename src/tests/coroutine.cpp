@@ -0,0 +1,163 @@
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <routio/coroutine.h>
+#include <routio/routing.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+#define MESSAGES 5
+
+Dictionary make_value(int value) {
+
+    Dictionary dictionary;
+    dictionary.set<int>("value", value);
+    return dictionary;
+
+}
+
+Task<int> exchange(SharedClient client, AwaitablePublisher<Dictionary> &publisher, AwaitableSubscriber<Dictionary> &subscriber) {
+
+    SharedDictionary response = co_await lookup(client, "numbers");
+
+    if (response->get<int>("channel", -1) < 1)
+        co_return -1;
+
+    co_await publisher.ready();
+
+    for (int i = 0; i < MESSAGES; i++) {
+        if (!co_await publisher.send(make_value(i)))
+            co_return -1;
+    }
+
+    int received = 0;
+
+    for (int i = 0; i < MESSAGES; i++) {
+        shared_ptr<Dictionary> value = co_await subscriber.next();
+        if (value->get<int>("value", -1) == i) received++;
+    }
+
+    co_return received;
+
+}
+
+Task<> run(SharedClient client, AwaitablePublisher<Dictionary> &publisher, AwaitableSubscriber<Dictionary> &subscriber, int &result) {
+
+    result = co_await exchange(client, publisher, subscriber);
+
+    auto start = std::chrono::steady_clock::now();
+
+    co_await default_loop()->sleep(50);
+
+    if (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(50))
+        result = -1;
+
+}
+
+Task<> sleeper(std::atomic<bool> &woken, std::chrono::steady_clock::time_point &time) {
+
+    co_await default_loop()->sleep(10);
+
+    time = std::chrono::steady_clock::now();
+    woken = true;
+
+}
+
+Task<> blocker(std::atomic<bool> &entered, std::atomic<bool> &added, bool &unblocked) {
+
+    co_await default_loop()->sleep(10);
+
+    entered = true;
+
+    auto start = std::chrono::steady_clock::now();
+
+    while (!added && std::chrono::steady_clock::now() - start < std::chrono::seconds(1))
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    unblocked = added;
+
+}
+
+int main(int argc, char** argv) {
+
+    EmbeddedRouter router;
+
+    SharedClient client = router.connect("coroutines");
+
+    AwaitableSubscriber<Dictionary> subscriber(client, "numbers");
+    AwaitablePublisher<Dictionary> publisher(client, "numbers", 2);
+
+    if (!wait_for([&]() { return publisher.get_subscribers() == 1; })) {
+        cerr << "Subscriber not ready" << endl;
+        return -1;
+    }
+
+    int result = 0;
+
+    spawn(run(client, publisher, subscriber, result));
+
+    if (!wait_for([&]() { return result != 0; }) || result != MESSAGES) {
+        cerr << "Messages not exchanged by coroutines" << endl;
+        return -1;
+    }
+
+    // Finishes the sleep at the end of the coroutine
+    routio::wait(100);
+
+    if (result != MESSAGES) {
+        cerr << "Coroutine resumed before its sleep ended" << endl;
+        return -1;
+    }
+
+    // A sleep started on another thread wakes up the loop that is already waiting
+    std::atomic<bool> woken(false);
+    std::chrono::steady_clock::time_point scheduled, resumed;
+
+    std::thread other([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        scheduled = std::chrono::steady_clock::now();
+        spawn(sleeper(woken, resumed));
+    });
+
+    routio::wait(1000);
+
+    other.join();
+
+    if (!woken || resumed - scheduled > std::chrono::milliseconds(500)) {
+        cerr << "Sleep from another thread not resumed in time" << endl;
+        return -1;
+    }
+
+    // Handlers are added from other threads while the loop resumes a coroutine
+    std::atomic<bool> entered(false), added(false);
+    bool unblocked = false;
+
+    SharedTimer timer = make_shared<Timer>([]() {});
+
+    std::thread adder([&]() {
+        while (!entered) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        default_loop()->add_handler(timer);
+        added = true;
+    });
+
+    spawn(blocker(entered, added, unblocked));
+
+    wait_for([&]() { return added.load(); });
+
+    adder.join();
+
+    default_loop()->remove_handler(timer);
+
+    if (!unblocked) {
+        cerr << "Loop locked while resuming a coroutine" << endl;
+        return -1;
+    }
+
+    return 0;
+}
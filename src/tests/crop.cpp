@@ -0,0 +1,104 @@
+#include <iostream>
+#include <memory>
+
+#include <routio/array.h>
+
+using namespace std;
+using namespace routio;
+
+uchar value(size_t y, size_t x, size_t c) {
+
+    return (uchar) ((y * 7 + x * 3 + c) % 251);
+
+}
+
+// Checks that a dense tensor contains the given region of the parent, rows may be flipped
+bool check_region(SharedTensor tensor, size_t top, size_t left, size_t height, size_t width, bool flipped = false) {
+
+    if (tensor->ndims() != 3 || tensor->shape(0) != height || tensor->shape(1) != width || tensor->shape(2) != 3 || !tensor->is_contiguous())
+        return false;
+
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            for (size_t c = 0; c < 3; c++) {
+                if (tensor->get_const_data()[(y * width + x) * 3 + c] != value(flipped ? top - y : top + y, left + x, c))
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+
+    SharedTensor parent = make_shared<Tensor>(initializer_list<size_t>{100, 120, 3}, UINT8);
+
+    for (size_t y = 0; y < 100; y++)
+        for (size_t x = 0; x < 120; x++)
+            for (size_t c = 0; c < 3; c++)
+                parent->get_data()[(y * 120 + x) * 3 + c] = value(y, x, c);
+
+    SharedTensor crop = Tensor::crop(parent, {10, 20, 0}, {30, 40, 3});
+
+    if (crop->is_contiguous() || crop->get_size() != 30 * 40 * 3) {
+        cerr << "Crop is not a view" << endl;
+        return -1;
+    }
+
+    if (!Tensor::crop(parent, {10, 0, 0}, {30, 120, 3})->is_contiguous()) {
+        cerr << "Crop of whole rows is not contiguous" << endl;
+        return -1;
+    }
+
+    // Packed message, copied in pieces that do not match the rows
+    SharedMessage packed = Message::pack(crop);
+    shared_ptr<BufferedMessage> copy = make_shared<BufferedMessage>(packed->get_length());
+
+    for (size_t position = 0; position < packed->get_length(); position += 37)
+        packed->copy_data(position, copy->get_buffer() + position, 37);
+
+    if (!check_region(*Message::unpack<SharedTensor>(copy), 10, 20, 30, 40)) {
+        cerr << "Packed crop does not match" << endl;
+        return -1;
+    }
+
+    // Crop inside a structure
+    MessageWriter writer;
+    writer.write<int>(1);
+    write(writer, crop);
+
+    MessageReader reader(make_shared<BufferedMessage>(writer));
+    SharedTensor decoded;
+    reader.read<int>();
+    read(reader, decoded);
+
+    if (!check_region(decoded, 10, 20, 30, 40)) {
+        cerr << "Crop in a structure does not match" << endl;
+        return -1;
+    }
+
+    // Crop passed as an array is gathered as well
+    SharedArray array = crop;
+    SharedArray gathered = *Message::unpack<SharedArray>(Message::pack(array));
+
+    SharedTensor reference = *Message::unpack<SharedTensor>(packed);
+
+    if (gathered->get_size() != reference->get_size() || memcmp(gathered->get_const_data(), reference->get_const_data(), reference->get_size()) != 0) {
+        cerr << "Crop as array does not match" << endl;
+        return -1;
+    }
+
+    // Rows in reverse order with a negative stride
+    vector<ssize_t> strides = parent->get_strides();
+    strides[0] = -strides[0];
+
+    SharedTensor flipped = make_shared<Tensor>(initializer_list<size_t>{100, 120, 3}, UINT8, strides, parent->get_data() + 99 * 120 * 3, [parent]() {});
+
+    if (!check_region(*Message::unpack<SharedTensor>(Message::pack(flipped)), 99, 0, 100, 120, true)) {
+        cerr << "Flipped tensor does not match" << endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <iostream>
+#include <memory>
+
+#include <routio/array.h>
+
+using namespace std;
+using namespace routio;
+
+bool inside(SharedArray array, shared_ptr<BufferedMessage> message) {
+
+    return array->get_const_data() >= message->get_buffer() && array->get_const_data() + array->get_size() <= message->get_buffer() + message->get_length();
+
+}
+
+int main(int argc, char** argv) {
+
+    SharedTensor source = make_shared<Tensor>(initializer_list<size_t>{16, 8}, FLOAT32);
+
+    for (size_t i = 0; i < 16 * 8; i++)
+        ((float *) source->get_data())[i] = (float) i;
+
+    MessageWriter writer;
+    writer.write<int>(1);
+    write(writer, source);
+
+    shared_ptr<BufferedMessage> message = make_shared<BufferedMessage>(writer);
+    weak_ptr<BufferedMessage> released = message;
+
+    SharedTensor decoded;
+
+    {
+        MessageReader reader(message);
+        reader.read<int>();
+        read(reader, decoded);
+    }
+
+    // Decoded tensor points into the message and keeps it alive
+    if (!inside(decoded, message) || memcmp(decoded->get_const_data(), source->get_data(), source->get_size()) != 0) {
+        cerr << "Tensor not decoded in place" << endl;
+        return -1;
+    }
+
+    if (source->is_readonly() || !decoded->is_readonly() || !Tensor::crop(decoded, {2, 0}, {4, 8})->is_readonly()) {
+        cerr << "Received tensor not marked as read-only" << endl;
+        return -1;
+    }
+
+    // Writing to a received tensor copies it and leaves the message untouched
+    SharedTensor modified;
+
+    {
+        MessageReader reader(message);
+        reader.read<int>();
+        read(reader, modified);
+    }
+
+    SharedTensor row = Tensor::crop(modified, {3, 0}, {1, 8});
+
+    // Tensors shared with other threads are detached explicitly, get_data detaches the others
+    modified->detach();
+
+    if (modified->is_readonly() || inside(modified, message)) {
+        cerr << "Tensor not detached" << endl;
+        return -1;
+    }
+
+    ((float *) modified->get_data())[0] = -1;
+    ((float *) row->get_data())[0] = -1;
+
+    if (inside(modified, message) || modified->is_readonly() || ((const float *) modified->get_const_data())[1] != 1) {
+        cerr << "Tensor not copied on write" << endl;
+        return -1;
+    }
+
+    if (inside(row, message) || ((const float *) row->get_const_data())[1] != 3 * 8 + 1) {
+        cerr << "Tensor view not copied on write" << endl;
+        return -1;
+    }
+
+    if (((const float *) decoded->get_const_data())[0] != 0 || ((const float *) decoded->get_const_data())[3 * 8] != 3 * 8) {
+        cerr << "Writing to a received tensor changed the message" << endl;
+        return -1;
+    }
+
+    modified.reset();
+    row.reset();
+
+    message.reset();
+
+    if (released.expired() || ((const float *) decoded->get_const_data())[16 * 8 - 1] != 16 * 8 - 1) {
+        cerr << "Message released before the tensor" << endl;
+        return -1;
+    }
+
+    decoded.reset();
+
+    if (!released.expired()) {
+        cerr << "Message not released with the tensor" << endl;
+        return -1;
+    }
+
+    // Dimensions with a size that does not fit into memory are rejected
+    MessageWriter overflowing;
+    overflowing.write<size_t>((2 << 8) | TENSOR_ENCODING_ALIGNED);
+    overflowing.write<uint8_t>(0);
+    overflowing.write<size_t>((size_t) 1 << 62);
+    overflowing.write<size_t>(8);
+    overflowing.write<uint8_t>(UINT8);
+    overflowing.write<uint8_t>(0);
+
+    bool rejected = false;
+
+    try {
+        Message::unpack<SharedTensor>(make_shared<BufferedMessage>(overflowing));
+    } catch (ParseException &e) {
+        rejected = true;
+    }
+
+    if (!rejected) {
+        cerr << "Tensor with overflowing size decoded" << endl;
+        return -1;
+    }
+
+    // Arrays are decoded in place as well
+    SharedArray array = make_shared<Array>(100);
+    shared_ptr<BufferedMessage> packed = make_shared<BufferedMessage>(Message::pack(array)->get_length());
+    Message::pack(array)->copy_data(0, packed->get_buffer(), packed->get_length());
+
+    SharedArray unpacked = *Message::unpack<SharedArray>(packed);
+
+    if (!inside(unpacked, packed) || !unpacked->is_readonly()) {
+        cerr << "Array not decoded in place" << endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <routio/client.h>
+#include <routio/datatypes.h>
+#include <routio/pipeline.h>
+#include <routio/routing.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+#define MESSAGES 20
+
+Dictionary make_value(int value) {
+
+    Dictionary dictionary;
+    dictionary.set<int>("value", value);
+    return dictionary;
+
+}
+
+int main(int argc, char** argv) {
+
+    EmbeddedRouter router;
+
+    SharedClient publisher_client = router.connect("publisher");
+    SharedClient node_client = router.connect("node");
+    SharedClient mailbox_client = router.connect("mailbox");
+
+    SharedExecutor executor = make_shared<Executor>(2);
+
+    TypedPublisher<Dictionary> publisher(publisher_client, "values");
+
+    // Messages of a node input are processed in order on the executor
+    std::mutex mutex;
+    vector<int> processed;
+
+    SharedNode node = make_shared<Node>("values");
+
+    node->add_input<Dictionary>(node_client, "values", [&](shared_ptr<Dictionary> value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        processed.push_back(value->get<int>("value", -1));
+    }, MESSAGES, NODE_QUEUE_DROP);
+
+    executor->add(node);
+
+    // Subscriber released while its messages are still queued in the mailbox
+    mailbox_client->set_executor(executor, MESSAGES);
+
+    std::atomic<int> delivered(0);
+
+    unique_ptr<TypedSubscriber<Dictionary>> subscriber(new TypedSubscriber<Dictionary>(mailbox_client, "values", [&](shared_ptr<Dictionary> value) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        delivered++;
+    }));
+
+    if (!wait_for([&]() { return publisher.get_subscribers() >= 2; })) {
+        cerr << "Subscribers not connected" << endl;
+        return -1;
+    }
+
+    for (int i = 0; i < MESSAGES; i++)
+        publisher.send(make_value(i));
+
+    if (!wait_for([&]() { std::lock_guard<std::mutex> lock(mutex); return processed.size() == MESSAGES; })) {
+        cerr << "Node processed " << processed.size() << " messages" << endl;
+        return -1;
+    }
+
+    for (int i = 0; i < MESSAGES; i++) {
+        if (processed[i] != i) {
+            cerr << "Node processed messages out of order" << endl;
+            return -1;
+        }
+    }
+
+    if (!wait_for([&]() { return delivered > 0; })) {
+        cerr << "Mailbox messages not delivered" << endl;
+        return -1;
+    }
+
+    // Waits for the callback that is running
+    subscriber.reset();
+
+    int released = delivered;
+
+    wait_for([]() { return false; }, 300);
+
+    if (delivered != released) {
+        cerr << "Callback called after the subscriber was released" << endl;
+        return -1;
+    }
+
+    // Only the latest message waits while the node is busy
+    std::atomic<bool> busy(true), started(false);
+    vector<int> latest;
+
+    SharedNode latest_node = make_shared<Node>("latest");
+
+    latest_node->add_input<Dictionary>(node_client, "latest", [&](shared_ptr<Dictionary> value) {
+        started = true;
+        while (busy) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::lock_guard<std::mutex> lock(mutex);
+        latest.push_back(value->get<int>("value", -1));
+    }, MESSAGES, NODE_QUEUE_LATEST);
+
+    executor->add(latest_node);
+
+    TypedPublisher<Dictionary> latest_publisher(publisher_client, "latest");
+
+    if (!wait_for([&]() { return latest_publisher.get_subscribers() > 0; })) {
+        cerr << "Latest input not connected" << endl;
+        return -1;
+    }
+
+    latest_publisher.send(make_value(0));
+
+    if (!wait_for([&]() { return started.load(); })) {
+        cerr << "Latest input not processed" << endl;
+        return -1;
+    }
+
+    for (int i = 1; i < 5; i++)
+        latest_publisher.send(make_value(i));
+
+    if (!wait_for([&]() { return latest_node->get_statistics().messages_dropped == 3; })) {
+        cerr << "Latest input dropped " << latest_node->get_statistics().messages_dropped << " messages" << endl;
+        return -1;
+    }
+
+    busy = false;
+
+    if (!wait_for([&]() { std::lock_guard<std::mutex> lock(mutex); return latest.size() == 2; }) || latest[0] != 0 || latest[1] != 4) {
+        cerr << "Latest input did not keep the latest message" << endl;
+        return -1;
+    }
+
+    // Nodes on the executor wait for room in a blocking input instead of dropping messages
+    SharedClient pipeline_client = router.connect("pipeline");
+
+    std::atomic<int> consumed(0);
+
+    SharedNode consumer = make_shared<Node>("consumer");
+
+    consumer->add_input<Dictionary>(pipeline_client, "blocking", [&](shared_ptr<Dictionary> value) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        if (value->get<int>("value", -1) == consumed) consumed++;
+    }, 1, NODE_QUEUE_BLOCK);
+
+    SharedNode producer = make_shared<Node>("producer");
+
+    SharedTypedPublisher<Dictionary> blocking = producer->add_output<Dictionary>(pipeline_client, "blocking");
+
+    producer->add_input<Dictionary>(pipeline_client, "start", [&](shared_ptr<Dictionary>) {
+        for (int i = 0; i < MESSAGES; i++)
+            blocking->send(make_value(i));
+    });
+
+    // Pushing into its own full queue drops a message instead of waiting for itself
+    std::atomic<int> echoed(0);
+
+    SharedNode echo = make_shared<Node>("echo");
+
+    SharedTypedPublisher<Dictionary> echo_output = echo->add_output<Dictionary>(pipeline_client, "echo");
+
+    echo->add_input<Dictionary>(pipeline_client, "echo", [&](shared_ptr<Dictionary> value) {
+        echoed++;
+        if (value->get<int>("value", -1) > 0) {
+            echo_output->send(make_value(value->get<int>("value", -1) - 1));
+            echo_output->send(make_value(value->get<int>("value", -1) - 1));
+        }
+    }, 1, NODE_QUEUE_BLOCK);
+
+    executor->add(consumer);
+    executor->add(producer);
+    executor->add(echo);
+
+    TypedPublisher<Dictionary> start(publisher_client, "start");
+    TypedPublisher<Dictionary> echo_start(publisher_client, "echo");
+
+    if (!wait_for([&]() { return start.get_subscribers() > 0 && echo_start.get_subscribers() > 0 && blocking->get_subscribers() > 0; })) {
+        cerr << "Blocking inputs not connected" << endl;
+        return -1;
+    }
+
+    start.send(make_value(0));
+    echo_start.send(make_value(3));
+
+    if (!wait_for([&]() { return consumed == MESSAGES; }) || consumer->get_statistics().messages_dropped != 0) {
+        cerr << "Blocking input processed " << consumed << " messages in order" << endl;
+        return -1;
+    }
+
+    if (!wait_for([&]() { return echoed == 4 && echo->get_statistics().messages_dropped == 3; })) {
+        cerr << "Node waiting for its own queue" << endl;
+        return -1;
+    }
+
+    executor->stop();
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstring>
+
+#include <routio/array.h>
+
+using namespace std;
+using namespace routio;
+
+uint32_t float_bits(float value) {
+
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(float));
+    return bits;
+
+}
+
+float bits_float(uint32_t bits) {
+
+    float value;
+    memcpy(&value, &bits, sizeof(float));
+    return value;
+
+}
+
+// Converts the values at once, using vector instructions if available, and one by one, which
+// uses the scalar conversion, both results have to be identical
+bool check_encode(const vector<float>& values) {
+
+    vector<uint16_t> half(values.size()), bfloat(values.size());
+
+    float32_to_float16(values.data(), half.data(), values.size());
+    float32_to_bfloat16(values.data(), bfloat.data(), values.size());
+
+    for (size_t i = 0; i < values.size(); i++) {
+        uint16_t single_half, single_bfloat;
+        float32_to_float16(&values[i], &single_half, 1);
+        float32_to_bfloat16(&values[i], &single_bfloat, 1);
+
+        if (single_half != half[i] || single_bfloat != bfloat[i]) {
+            cerr << "Conversion of " << hex << float_bits(values[i]) << " differs: " << half[i] << " " << single_half << ", " << bfloat[i] << " " << single_bfloat << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+
+    // Special values, padded so that the vector conversion handles all of them
+    vector<float> special = {0.0f, -0.0f, 1.0f, -2.5f, 65504.0f, 65519.0f, 65520.0f, 1e6f,
+        INFINITY, -INFINITY, NAN, -NAN, bits_float(0x7F800001), bits_float(0xFFC12345),
+        6.1035156e-05f, 5.9604645e-08f, 2.9802322e-08f, 4.4703484e-08f, 1e-10f, bits_float(0x00000001),
+        bits_float(0x3F808000), bits_float(0x3F818000), bits_float(0x7F7FFFFF), bits_float(0x007FFFFF)};
+
+    special.resize(((special.size() + 7) / 8) * 8, 0.0f);
+
+    if (!check_encode(special))
+        return -1;
+
+    // Expected half precision values, including rounding of the largest value to infinity
+    vector<pair<float, uint16_t>> expected_half = {{65504.0f, 0x7BFF}, {65519.0f, 0x7BFF}, {65520.0f, 0x7C00},
+        {INFINITY, 0x7C00}, {-INFINITY, 0xFC00}, {-0.0f, 0x8000}, {6.1035156e-05f, 0x0400},
+        {5.9604645e-08f, 0x0001}, {2.9802322e-08f, 0x0000}, {4.4703484e-08f, 0x0001}, {1e-10f, 0x0000}};
+
+    for (auto e : expected_half) {
+        uint16_t half;
+        float32_to_float16(&e.first, &half, 1);
+        if (half != e.second) {
+            cerr << "Half precision value of " << e.first << " is " << hex << half << endl;
+            return -1;
+        }
+    }
+
+    vector<pair<float, uint16_t>> expected_bfloat = {{1.0f, 0x3F80}, {bits_float(0x3F808000), 0x3F80},
+        {bits_float(0x3F818000), 0x3F82}, {bits_float(0x7F7FFFFF), 0x7F80}, {-INFINITY, 0xFF80}};
+
+    for (auto e : expected_bfloat) {
+        uint16_t bfloat;
+        float32_to_bfloat16(&e.first, &bfloat, 1);
+        if (bfloat != e.second) {
+            cerr << "Bfloat16 value of " << e.first << " is " << hex << bfloat << endl;
+            return -1;
+        }
+    }
+
+    // NaN stays NaN in both formats
+    uint16_t half, bfloat;
+    float32_to_float16(&special[10], &half, 1);
+    float32_to_bfloat16(&special[12], &bfloat, 1);
+
+    if ((half & 0x7C00) != 0x7C00 || !(half & 0x3FF) || (bfloat & 0x7F80) != 0x7F80 || !(bfloat & 0x7F)) {
+        cerr << "NaN not preserved" << endl;
+        return -1;
+    }
+
+    // Random values of all magnitudes
+    mt19937 generator(1);
+    vector<float> values(1 << 16);
+
+    for (auto& value : values)
+        value = bits_float(generator());
+
+    if (!check_encode(values))
+        return -1;
+
+    // All 16 bit values decode the same way in both conversions
+    vector<uint16_t> all(1 << 16);
+    for (size_t i = 0; i < all.size(); i++) all[i] = (uint16_t) i;
+
+    vector<float> decoded_half(all.size()), decoded_bfloat(all.size());
+    float16_to_float32(all.data(), decoded_half.data(), all.size());
+    bfloat16_to_float32(all.data(), decoded_bfloat.data(), all.size());
+
+    for (size_t i = 0; i < all.size(); i++) {
+        float single_half, single_bfloat;
+        float16_to_float32(&all[i], &single_half, 1);
+        bfloat16_to_float32(&all[i], &single_bfloat, 1);
+
+        if (float_bits(single_half) != float_bits(decoded_half[i]) || float_bits(single_bfloat) != float_bits(decoded_bfloat[i]) || float_bits(single_bfloat) != i << 16) {
+            cerr << "Decoding of " << hex << i << " differs" << endl;
+            return -1;
+        }
+
+        // Values that are not NaN survive a round trip
+        if (!std::isnan(single_half)) {
+            float32_to_float16(&single_half, &half, 1);
+            if (half != all[i]) {
+                cerr << "Round trip of " << hex << i << " gives " << half << endl;
+                return -1;
+            }
+        }
+    }
+
+    if (float_bits(decoded_half[0x0001]) != float_bits(5.9604645e-08f) || decoded_half[0x7C00] != INFINITY || float_bits(decoded_half[0x8000]) != 0x80000000) {
+        cerr << "Special half precision values not decoded" << endl;
+        return -1;
+    }
+
+    return 0;
+}
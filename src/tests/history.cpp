@@ -0,0 +1,69 @@
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <routio/client.h>
+#include <routio/datatypes.h>
+#include <routio/routing.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+#define MESSAGES 10
+
+Dictionary make_value(int value) {
+
+    Dictionary dictionary;
+    dictionary.set<int>("value", value);
+    return dictionary;
+
+}
+
+int main(int argc, char** argv) {
+
+    EmbeddedRouter router;
+
+    SharedClient publisher_client = router.connect("publisher");
+    SharedClient first_client = router.connect("first");
+    SharedClient second_client = router.connect("second");
+
+    TypedPublisher<Dictionary> history(publisher_client, "history");
+    history.set_history(5);
+
+    if (!wait_for([&]() { return history.send(make_value(0)); })) {
+        cerr << "Publisher not ready" << endl;
+        return -1;
+    }
+
+    for (int i = 1; i < MESSAGES; i++)
+        history.send(make_value(i));
+
+    wait_for([]() { return false; }, 200);
+
+    // History is replayed in order, either the last messages or those after a sequence number,
+    // requests are made before the channel lookup completes and the subscribers subscribe
+    vector<int> last, since;
+
+    TypedSubscriber<Dictionary> last_history(first_client, "history", [&](shared_ptr<Dictionary> value) {
+        last.push_back(value->get<int>("value", -1));
+    });
+
+    TypedSubscriber<Dictionary> since_history(second_client, "history", [&](shared_ptr<Dictionary> value) {
+        since.push_back(value->get<int>("value", -1));
+    });
+
+    last_history.request_history(3);
+    since_history.request_history_since(5);
+
+    wait_for([&]() { return last.size() >= 3 && since.size() >= 4; });
+    wait_for([]() { return false; }, 200);
+
+    if (last != vector<int>{7, 8, 9} || since != vector<int>{6, 7, 8, 9}) {
+        cerr << "History not replayed" << endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <routio/client.h>
+#include <routio/helpers.h>
+#include <routio/array.h>
+#include <routio/pipeline.h>
+#include <routio/routing.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+// Large enough to be sent in chunks
+#define LATCHED_SIZE 1000 * 1000 * 3
+
+int main(int argc, char** argv) {
+
+    EmbeddedRouter router;
+
+    SharedClient publisher_client = router.connect("publisher");
+    SharedClient first_client = router.connect("first");
+    SharedClient second_client = router.connect("second");
+
+    // Latched message is delivered once to every subscriber that joins later
+    SharedTensor value = make_shared<Tensor>(initializer_list<size_t>{LATCHED_SIZE}, UINT8);
+    value->get_data()[LATCHED_SIZE - 1] = 42;
+
+    StaticPublisher<SharedTensor> latched(publisher_client, "latched", value);
+
+    vector<int> latched_received(3, 0);
+
+    auto latched_callback = [&](int index) {
+        return [&latched_received, index](shared_ptr<SharedTensor> tensor) {
+            if ((*tensor)->get_size() == LATCHED_SIZE && (*tensor)->get_const_data()[LATCHED_SIZE - 1] == 42)
+                latched_received[index]++;
+        };
+    };
+
+    TypedSubscriber<SharedTensor> first_latched(first_client, "latched", latched_callback(0));
+    TypedSubscriber<SharedTensor> second_latched(second_client, "latched", latched_callback(1));
+
+    if (!wait_for([&]() { return latched_received[0] > 0 && latched_received[1] > 0; })) {
+        cerr << "Latched message not delivered" << endl;
+        return -1;
+    }
+
+    // Another subscriber on a client that is already subscribed
+    TypedSubscriber<SharedTensor> third_latched(first_client, "latched", latched_callback(2));
+
+    if (!wait_for([&]() { return latched_received[2] > 0; })) {
+        cerr << "Latched message not delivered to a local subscriber" << endl;
+        return -1;
+    }
+
+    wait_for([]() { return false; }, 200);
+
+    if (latched_received != vector<int>{1, 1, 1}) {
+        cerr << "Latched message delivered more than once" << endl;
+        return -1;
+    }
+
+    // The local replay is delivered on the executor like received messages
+    SharedClient executor_client = router.connect("executor");
+    // The latched message arrives in more chunks than the default mailbox holds
+    executor_client->set_executor(make_shared<Executor>(1), 64);
+
+    std::atomic<int> executed(0);
+    std::atomic<bool> replayed_on_caller(false);
+    std::thread::id caller = std::this_thread::get_id();
+
+    auto executor_callback = [&](shared_ptr<SharedTensor> tensor) {
+        if (std::this_thread::get_id() == caller) replayed_on_caller = true;
+        executed++;
+    };
+
+    TypedSubscriber<SharedTensor> first_executed(executor_client, "latched", executor_callback);
+
+    if (!wait_for([&]() { return executed == 1; })) {
+        cerr << "Latched message not delivered on the executor" << endl;
+        return -1;
+    }
+
+    TypedSubscriber<SharedTensor> second_executed(executor_client, "latched", executor_callback);
+
+    if (!wait_for([&]() { return executed == 2; }) || replayed_on_caller) {
+        cerr << "Latched message not replayed on the executor" << endl;
+        return -1;
+    }
+
+    return 0;
+}
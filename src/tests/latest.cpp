@@ -0,0 +1,118 @@
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <atomic>
+
+#include <routio/client.h>
+#include <routio/datatypes.h>
+#include <routio/routing.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+#define MESSAGES 2000
+
+typedef struct Pose {
+    int64_t index;
+    double x, y, theta;
+} Pose;
+
+namespace routio {
+
+template <> inline string get_type_identifier<Pose>() { return string("pose"); }
+
+template<> inline shared_ptr<Message> Message::pack<Pose>(const Pose &data) {
+    MessageWriter writer(sizeof(Pose));
+
+    writer.write_buffer((const uchar *) &data, sizeof(Pose));
+
+    return make_shared<BufferedMessage>(writer);
+}
+
+template<> inline shared_ptr<Pose> Message::unpack<Pose>(SharedMessage message) {
+    MessageReader reader(message);
+
+    shared_ptr<Pose> pose = make_shared<Pose>();
+    reader.copy_data((uchar *) pose.get(), sizeof(Pose));
+
+    return pose;
+}
+
+}
+
+Pose make_pose(int64_t index) {
+
+    return Pose{index, (double) index, 2.0 * index, 3.0 * index};
+
+}
+
+int main(int argc, char** argv) {
+
+    EmbeddedRouter router;
+
+    SharedClient publisher_client = router.connect("publisher");
+    SharedClient subscriber_client = router.connect("subscriber");
+
+    TypedPublisher<Pose> publisher(publisher_client, "poses");
+
+    TypedLatestSubscriber<Pose> latest(subscriber_client, "poses");
+    LatestSubscriber messages(subscriber_client, "poses", get_type_identifier<Pose>());
+
+    Pose pose;
+
+    if (latest.read(pose) || latest.get_latest() || messages.get_latest()) {
+        cerr << "Value available before anything was received" << endl;
+        return -1;
+    }
+
+    if (!wait_for([&]() { return publisher.get_subscribers() > 0; })) {
+        cerr << "Subscribers not connected" << endl;
+        return -1;
+    }
+
+    // Readers on another thread only ever see complete values, in order
+    std::atomic<bool> done(false);
+    std::atomic<bool> torn(false);
+
+    std::thread reader([&]() {
+        int64_t last = -1;
+        while (!done) {
+            Pose current;
+            if (!latest.read(current))
+                continue;
+            if (current.x != current.index || current.y != 2.0 * current.index || current.theta != 3.0 * current.index || current.index < last)
+                torn = true;
+            last = current.index;
+        }
+    });
+
+    for (int64_t i = 0; i < MESSAGES; i++) {
+        publisher.send(make_pose(i));
+        if (i % 100 == 0) routio::wait(1);
+    }
+
+    bool received = wait_for([&]() { return latest.get_received() == MESSAGES && messages.get_received() == MESSAGES; });
+
+    done = true;
+    reader.join();
+
+    if (!received) {
+        cerr << "Received " << latest.get_received() << " and " << messages.get_received() << " messages" << endl;
+        return -1;
+    }
+
+    if (torn) {
+        cerr << "Reader saw a partially written value" << endl;
+        return -1;
+    }
+
+    if (!latest.read(pose) || pose.index != MESSAGES - 1 || latest.get_latest()->index != MESSAGES - 1 ||
+        Message::unpack<Pose>(messages.get_latest())->index != MESSAGES - 1) {
+        cerr << "Latest value not kept" << endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <routio/client.h>
+#include <routio/routing.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+#define CHUNK_SIZE 1024 * 16
+#define LIMIT 1024 * 64
+
+int main(int argc, char** argv) {
+
+    EmbeddedRouter router;
+
+    SharedClient publisher_client = router.connect("publisher");
+    SharedClient subscriber_client = router.connect("subscriber");
+
+    Publisher publisher(publisher_client, "data", "", -1, CHUNK_SIZE);
+
+    vector<size_t> received;
+
+    Subscriber subscriber(subscriber_client, "data", "", create_data_callback([&](SharedMessage message) {
+        received.push_back(message->get_length());
+    }));
+
+    subscriber.set_message_limit(LIMIT);
+
+    if (!wait_for([&]() { return publisher.get_subscribers() > 0; })) {
+        cerr << "Subscriber not connected" << endl;
+        return -1;
+    }
+
+    // Messages take over the data
+    publisher.send_message((uchar *) calloc(LIMIT + 1, 1), LIMIT + 1);
+    publisher.send_message((uchar *) calloc(LIMIT, 1), LIMIT);
+
+    if (!wait_for([&]() { return !received.empty(); })) {
+        cerr << "Message within the limit not received" << endl;
+        return -1;
+    }
+
+    // Chunks of the dropped message must not be mistaken for another message
+    wait_for([]() { return false; }, 200);
+
+    if (received.size() != 1 || received[0] != LIMIT || subscriber.get_statistics().messages_dropped != 1) {
+        cerr << "Message over the limit not dropped" << endl;
+        return -1;
+    }
+
+    // Chunks of a released publisher are still sent and reported afterwards
+    unique_ptr<Publisher> released(new Publisher(publisher_client, "data", "", -1, CHUNK_SIZE));
+
+    if (!wait_for([&]() { return released->get_subscribers() > 0; })) {
+        cerr << "Subscriber not connected" << endl;
+        return -1;
+    }
+
+    released->send_message((uchar *) calloc(LIMIT, 1), LIMIT);
+    released.reset();
+
+    if (!wait_for([&]() { return received.size() == 2; }) || received[1] != LIMIT) {
+        cerr << "Message of a released publisher not received" << endl;
+        return -1;
+    }
+
+    // Chunk buffers expire on the loop of the client, not the default loop
+    SharedIOLoop loop = make_shared<IOLoop>();
+    SharedClient looped = router.connect("looped", loop);
+
+    if (looped->get_loop() != loop || publisher_client->get_loop() != default_loop()) {
+        cerr << "Client not handled by its loop" << endl;
+        return -1;
+    }
+
+    return 0;
+}
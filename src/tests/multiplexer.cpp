@@ -0,0 +1,116 @@
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <routio/client.h>
+#include <routio/datatypes.h>
+#include <routio/routing.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+#define LOGICAL_CLIENTS 20
+#define MESSAGES 5
+
+Dictionary make_value(int value) {
+
+    Dictionary dictionary;
+    dictionary.set<int>("value", value);
+    return dictionary;
+
+}
+
+int main(int argc, char** argv) {
+
+    string address = "/tmp/routio_multiplexer_" + to_string(getpid()) + ".sock";
+
+    EmbeddedRouter router(address);
+
+    SharedClient client = routio::connect(address, "socket");
+    SharedMultiplexer multiplexer = routio::multiplex(address);
+
+    // Logical clients share a single connection but subscribe independently
+    vector<SharedClient> logical;
+    vector<shared_ptr<TypedSubscriber<Dictionary>>> subscribers;
+    vector<int> received(LOGICAL_CLIENTS, 0);
+
+    for (int i = 0; i < LOGICAL_CLIENTS; i++) {
+        logical.push_back(multiplexer->connect("logical" + to_string(i)));
+        subscribers.push_back(make_shared<TypedSubscriber<Dictionary>>(logical.back(), "forward", [&received, i](shared_ptr<Dictionary> value) {
+            if (value->get<int>("value", -1) == received[i]) received[i]++;
+        }));
+    }
+
+    TypedPublisher<Dictionary> forward(client, "forward");
+
+    // Messages from a logical client reach a socket client
+    TypedPublisher<Dictionary> backward(logical[3], "backward");
+    int returned = 0;
+
+    TypedSubscriber<Dictionary> backward_subscriber(client, "backward", [&](shared_ptr<Dictionary> value) {
+        returned++;
+    });
+
+    if (!wait_for([&]() { return forward.get_subscribers() == LOGICAL_CLIENTS && backward.get_subscribers() == 1; })) {
+        cerr << "Logical clients not subscribed" << endl;
+        return -1;
+    }
+
+    for (int i = 0; i < MESSAGES; i++) {
+        forward.send(make_value(i));
+        backward.send(make_value(i));
+    }
+
+    if (!wait_for([&]() { for (int r : received) if (r != MESSAGES) return false; return returned == MESSAGES; })) {
+        cerr << "Messages not delivered through the multiplexer" << endl;
+        return -1;
+    }
+
+    // Released logical clients are disconnected while others remain
+    subscribers.resize(LOGICAL_CLIENTS / 2);
+    logical.resize(LOGICAL_CLIENTS / 2);
+
+    if (!wait_for([&]() { return forward.get_subscribers() == LOGICAL_CLIENTS / 2; })) {
+        cerr << "Released logical clients still subscribed" << endl;
+        return -1;
+    }
+
+    // A logical frame without the logical client is rejected without stopping the router
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    struct sockaddr_un remote;
+    remote.sun_family = AF_UNIX;
+    strncpy(remote.sun_path, address.c_str(), sizeof(remote.sun_path) - 1);
+
+    if (fd < 0 || ::connect(fd, (struct sockaddr *) &remote, sizeof(remote)) < 0) {
+        cerr << "Unable to connect to the router" << endl;
+        return -1;
+    }
+
+    StreamWriter writer(fd);
+    writer.add_message(make_shared<MultiBufferMessage>(std::initializer_list<SharedBuffer>{PrimitiveBuffer<int>::wrap(ROUTIO_LOGICAL_FRAME)}), 0);
+
+    char byte;
+
+    if (!wait_for([&]() { return recv(fd, &byte, 1, MSG_DONTWAIT) == 0; })) {
+        cerr << "Connection with a truncated frame not closed" << endl;
+        return -1;
+    }
+
+    close(fd);
+
+    for (int i = 0; i < MESSAGES; i++)
+        forward.send(make_value(MESSAGES + i));
+
+    if (!wait_for([&]() { for (int i = 0; i < LOGICAL_CLIENTS / 2; i++) if (received[i] != 2 * MESSAGES) return false; return true; })) {
+        cerr << "Router stopped after a truncated frame" << endl;
+        return -1;
+    }
+
+    return 0;
+}
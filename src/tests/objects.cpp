@@ -0,0 +1,131 @@
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include <routio/client.h>
+#include <routio/datatypes.h>
+#include <routio/pipeline.h>
+#include <routio/routing.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+namespace routio {
+
+template <> inline string get_type_identifier<string>() { return string("string"); }
+
+template<> inline shared_ptr<Message> Message::pack<string>(const string &data) {
+    MessageWriter writer(data.size() + 4);
+
+    writer.write_string(data);
+
+    return make_shared<BufferedMessage>(writer);
+}
+
+template<> inline shared_ptr<string> Message::unpack<string>(SharedMessage message) {
+    MessageReader reader(message);
+
+    return make_shared<string>(reader.read_string());
+}
+
+}
+
+int main(int argc, char** argv) {
+
+    EmbeddedRouter router;
+
+    SharedClient client = router.connect("objects");
+
+    shared_ptr<const string> value = make_shared<const string>("object");
+
+    std::atomic<bool> shared_received(false);
+    std::atomic<bool> copied_received(false);
+    std::atomic<bool> modifiable(false);
+    std::atomic<bool> on_executor(false);
+
+    std::thread::id main_thread = std::this_thread::get_id();
+
+    // Mailboxes hold all messages sent below at once, a full mailbox would drop them
+    client->set_executor(make_shared<Executor>(2), 64);
+
+    // Messages that pass the router before subscriptions are known locally are decoded copies
+    TypedSubscriber<string> shared(client, "objects", [&](shared_ptr<const string> object) {
+        on_executor = std::this_thread::get_id() != main_thread;
+        if (object.get() == value.get())
+            shared_received = true;
+    });
+
+    TypedSubscriber<string> copied(client, "objects", [&](shared_ptr<string> object) {
+        if (object.get() == value.get())
+            modifiable = true;
+        else if (*object == *value)
+            copied_received = true;
+    });
+
+    TypedPublisher<string> publisher(client, "objects");
+
+    bool received = wait_for([&]() {
+        publisher.send(value);
+        return shared_received && copied_received;
+    });
+
+    if (!received) {
+        cerr << "Object not shared with subscribers of the same client" << endl;
+        return -1;
+    }
+
+    if (modifiable) {
+        cerr << "Shared object passed to a mutable callback" << endl;
+        return -1;
+    }
+
+    if (!on_executor) {
+        cerr << "Object not delivered on executor" << endl;
+        return -1;
+    }
+
+    // Messages of this client that are forwarded to others keep the channel sequence of local subscribers intact
+    SharedClient remote = router.connect("remote");
+
+    TypedPublisher<string> remote_publisher(remote, "objects");
+    std::atomic<int> remote_received(0);
+
+    TypedSubscriber<string> remote_subscriber(remote, "objects", [&](shared_ptr<string> object) {
+        remote_received++;
+    });
+
+    std::atomic<int> counted(0);
+
+    Subscriber counter(client, "objects", get_type_identifier<string>(), create_data_callback([&](SharedMessage message) {
+        counted++;
+    }));
+
+    if (!wait_for([&]() { return remote_publisher.get_subscribers() == 2; }) ||
+        !wait_for([&]() { publisher.send(value); return remote_received > 0 && counted > 0; })) {
+        cerr << "Subscribers of other clients not ready" << endl;
+        return -1;
+    }
+
+    routio::wait(100);
+
+    int base = counted;
+
+    for (int i = 0; i < 10; i++) {
+        publisher.send(value);
+        remote_publisher.send(value);
+    }
+
+    if (!wait_for([&]() { return counted == base + 20; })) {
+        cerr << "Messages not delivered to local subscriber" << endl;
+        return -1;
+    }
+
+    if (counter.get_statistics().messages_lost > 0 || counter.get_statistics().gaps > 0) {
+        cerr << "Forwarded messages reported as lost" << endl;
+        return -1;
+    }
+
+    return 0;
+}
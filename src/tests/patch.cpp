@@ -0,0 +1,70 @@
+#include <iostream>
+#include <memory>
+#include <limits>
+
+#include <routio/helpers.h>
+
+using namespace std;
+using namespace routio;
+
+bool apply(MessageWriter &writer, vector<uchar> &buffer) {
+
+    MessageReader reader(make_shared<BufferedMessage>(writer));
+
+    return read_patch(reader, buffer);
+
+}
+
+int main(int argc, char** argv) {
+
+    vector<uchar> previous(1000, 1);
+    vector<uchar> current = previous;
+
+    current[10] = 2;
+    current[500] = 3;
+
+    MessageWriter valid;
+    write_patch(valid, previous, current);
+
+    vector<uchar> buffer = previous;
+
+    if (!apply(valid, buffer) || buffer != current) {
+        cerr << "Patch not applied" << endl;
+        return -1;
+    }
+
+    // Result larger than the buffer and the patch together
+    MessageWriter large;
+    large.write_long(numeric_limits<int64_t>::max());
+    large.write_integer(0);
+
+    // Range that wraps around
+    MessageWriter wrapping;
+    wrapping.write_long(previous.size());
+    wrapping.write_integer(1);
+    wrapping.write_long(10);
+    wrapping.write_long(-5);
+    wrapping.write_long(0);
+
+    // Inserted data that is not in the patch
+    MessageWriter truncated;
+    truncated.write_long(previous.size() + 100);
+    truncated.write_integer(1);
+    truncated.write_long(0);
+    truncated.write_long(0);
+    truncated.write_long(100);
+
+    MessageWriter negative;
+    negative.write_long(previous.size());
+    negative.write_integer(-1);
+
+    for (MessageWriter *writer : {&large, &wrapping, &truncated, &negative}) {
+        buffer = previous;
+        if (apply(*writer, buffer) || buffer != previous) {
+            cerr << "Malformed patch applied" << endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
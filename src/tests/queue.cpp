@@ -0,0 +1,62 @@
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <routio/message.h>
+
+using namespace std;
+using namespace routio;
+
+SharedMessage make_frame(int channel) {
+
+    MessageWriter writer;
+    writer.write_integer(channel);
+    return make_shared<BufferedMessage>(writer);
+
+}
+
+int main(int argc, char** argv) {
+
+    MessageQueue queue(2);
+
+    vector<pair<int, int>> reports;
+
+    auto callback = [&](int index) {
+        return [&reports, index](const SharedMessage message, int state) { reports.push_back(make_pair(index, state)); };
+    };
+
+    queue.push(make_frame(ROUTIO_CONTROL_CHANNEL), callback(0));
+    queue.push(make_frame(1), callback(1));
+
+    if (!reports.empty()) {
+        cerr << "Messages reported before they were taken from the queue" << endl;
+        return -1;
+    }
+
+    // The data message makes room, the control message stays in the queue
+    if (queue.push(make_frame(2), callback(2)) || reports.size() != 1 || reports[0] != make_pair(1, (int) MESSAGE_CALLBACK_DROPPED)) {
+        cerr << "Oldest data message not dropped" << endl;
+        return -1;
+    }
+
+    queue.pop();
+    queue.pop();
+
+    if (reports.size() != 3 || reports[1] != make_pair(0, (int) MESSAGE_CALLBACK_SENT) || reports[2] != make_pair(2, (int) MESSAGE_CALLBACK_SENT)) {
+        cerr << "Messages not reported as sent when taken from the queue" << endl;
+        return -1;
+    }
+
+    // Control messages are kept even if the queue is full of them
+    queue.push(make_frame(ROUTIO_CONTROL_CHANNEL), callback(3));
+    queue.push(make_frame(ROUTIO_CONTROL_CHANNEL), callback(4));
+    queue.push(make_frame(ROUTIO_CONTROL_CHANNEL), callback(5));
+    queue.push(make_frame(3), callback(6));
+
+    if (queue.get_size() != 3 || reports.size() != 4 || reports[3] != make_pair(6, (int) MESSAGE_CALLBACK_DROPPED)) {
+        cerr << "Control messages dropped" << endl;
+        return -1;
+    }
+
+    return 0;
+}
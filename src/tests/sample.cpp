@@ -0,0 +1,75 @@
+#include <iostream>
+#include <memory>
+
+#include <routio/client.h>
+#include <routio/datatypes.h>
+#include <routio/routing.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+#define MESSAGES 30
+#define INTERVAL 3
+
+Dictionary make_value(int value) {
+
+    Dictionary dictionary;
+    dictionary.set<int>("value", value);
+    return dictionary;
+
+}
+
+int main(int argc, char** argv) {
+
+    EmbeddedRouter router;
+
+    SharedClient publisher_client = router.connect("publisher");
+    SharedClient monitor_client = router.connect("monitor");
+
+    TypedPublisher<Dictionary> publisher(publisher_client, "sampled");
+
+    int sampled_received = 0, plain_received = 0, ignored_received = 0;
+
+    Subscriber sampled(monitor_client, "sampled", "", create_data_callback([&](SharedMessage message) {
+        sampled_received++;
+    }));
+
+    sampled.request_sampled(INTERVAL);
+
+    if (!wait_for([&]() { return publisher.get_subscribers() == 1; })) {
+        cerr << "Subscriber not connected" << endl;
+        return -1;
+    }
+
+    // Later subscriptions of the same connection get the messages sampled by the router, whatever they request
+    Subscriber plain(monitor_client, "sampled", "", create_data_callback([&](SharedMessage message) {
+        plain_received++;
+    }));
+
+    Subscriber ignored(monitor_client, "sampled", "", create_data_callback([&](SharedMessage message) {
+        ignored_received++;
+    }));
+
+    ignored.request_sampled(2);
+
+    wait_for([]() { return false; }, 100);
+
+    for (int i = 0; i < MESSAGES; i++)
+        publisher.send(make_value(i));
+
+    if (!wait_for([&]() { return sampled_received == MESSAGES / INTERVAL && plain_received == MESSAGES / INTERVAL && ignored_received == MESSAGES / INTERVAL; })) {
+        cerr << "Received " << sampled_received << " " << plain_received << " " << ignored_received << " sampled messages" << endl;
+        return -1;
+    }
+
+    for (Subscriber *subscriber : {&sampled, &plain, &ignored}) {
+        if (subscriber->get_statistics().messages_lost > 0) {
+            cerr << "Sampled messages reported as lost" << endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include <routio/client.h>
+#include <routio/datatypes.h>
+#include <routio/routing.h>
+#include <routio/service.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+SharedMessage pack_value(int value) {
+
+    MessageWriter writer;
+    writer.write_integer(value);
+    return make_shared<BufferedMessage>(writer);
+
+}
+
+int unpack_value(SharedMessage message) {
+
+    MessageReader reader(message);
+    return reader.read_integer();
+
+}
+
+int main(int argc, char** argv) {
+
+    EmbeddedRouter router;
+
+    SharedClient client = router.connect("service");
+    SharedClient other = router.connect("other");
+
+    // Provider and callers on the same client
+    Service service(client, "double", [](SharedServiceRequest request) {
+        return pack_value(unpack_value(request->get_message()) * 2);
+    });
+
+    ServiceClient first(client, "double");
+    ServiceClient second(client, "double");
+
+    int a = -1, b = -1, calls = 0;
+
+    first.call(pack_value(10), [&](int status, SharedMessage reply) {
+        calls++;
+        if (status == SERVICE_OK) a = unpack_value(reply);
+    }, 2000);
+
+    second.call(pack_value(21), [&](int status, SharedMessage reply) {
+        calls++;
+        if (status == SERVICE_OK) b = unpack_value(reply);
+    }, 2000);
+
+    // Each caller only receives its own reply
+    if (!wait_for([&]() { return calls == 2; }) || a != 20 || b != 42) {
+        cerr << "Same client calls failed: " << a << " " << b << endl;
+        return -1;
+    }
+
+    // Caller on another client
+    ServiceClient remote(other, "double");
+
+    int c = -1;
+
+    remote.call(pack_value(5), [&](int status, SharedMessage reply) {
+        if (status == SERVICE_OK) c = unpack_value(reply);
+    }, 2000);
+
+    if (!wait_for([&]() { return c == 10; })) {
+        cerr << "Remote call failed" << endl;
+        return -1;
+    }
+
+    // Calls without providers are returned
+    ServiceClient missing(other, "missing");
+
+    int status = -1;
+
+    missing.call(pack_value(1), [&](int s, SharedMessage reply) { status = s; }, 2000);
+
+    if (!wait_for([&]() { return status >= 0; }) || status != SERVICE_UNAVAILABLE) {
+        cerr << "Call without providers returned " << status << endl;
+        return -1;
+    }
+
+    // Calls that are still pending when the caller is released are cancelled
+    std::atomic<bool> started(false), release(false);
+
+    Service slow(client, "slow", [&](SharedServiceRequest request) {
+        started = true;
+        while (!release) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return pack_value(0);
+    }, make_shared<Executor>(1));
+
+    status = -1;
+
+    {
+        ServiceClient pending(other, "slow");
+
+        pending.call(pack_value(1), [&](int s, SharedMessage reply) { status = s; });
+
+        if (!wait_for([&]() { return started.load(); })) {
+            cerr << "Slow call not started" << endl;
+            return -1;
+        }
+    }
+
+    release = true;
+
+    if (status != SERVICE_CANCELLED) {
+        cerr << "Pending call completed with " << status << " when the caller was released" << endl;
+        return -1;
+    }
+
+    slow.stop();
+
+    // Services and callers released before the router answers their lookup
+    for (int i = 0; i < 10; i++) {
+        Service released(client, "released" + to_string(i), [](SharedServiceRequest request) { return pack_value(0); });
+        ServiceClient caller(other, "released" + to_string(i));
+    }
+
+    wait_for([]() { return false; }, 100);
+
+    // Stopping a busy service waits for its workers, also when requests are queued
+    std::atomic<int> handled(0);
+
+    unique_ptr<Service> busy(new Service(client, "busy", [&](SharedServiceRequest request) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        handled++;
+        return pack_value(0);
+    }, make_shared<Executor>(2), 2, 64));
+
+    ServiceClient busy_caller(other, "busy");
+
+    for (int i = 0; i < 50; i++)
+        busy_caller.call(pack_value(i), [](int s, SharedMessage reply) {}, 2000);
+
+    if (!wait_for([&]() { return handled > 5; })) {
+        cerr << "Busy service not handling requests" << endl;
+        return -1;
+    }
+
+    busy.reset();
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <memory>
+#include <chrono>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <routio/state.h>
+#include <routio/routing.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+typedef struct Pose {
+    int64_t x;
+    double y;
+} Pose;
+
+int main(int argc, char** argv) {
+
+    EmbeddedRouter router;
+
+    SharedClient writer_client = router.connect("writer");
+    SharedClient reader_client = router.connect("reader");
+
+    // Released before the lookup response arrives
+    unique_ptr<StateReader> released(new StateReader(reader_client, "pose", sizeof(Pose)));
+    released.reset();
+
+    TypedStateWriter<Pose> writer(writer_client, "pose");
+    TypedStateReader<Pose> reader(reader_client, "pose");
+
+    if (!wait_for([&]() { return writer.is_ready() && reader.is_ready(); })) {
+        cerr << "State channels not ready" << endl;
+        return -1;
+    }
+
+    Pose pose{0, 0};
+
+    if (reader.read(pose) != 0) {
+        cerr << "Value read before it was written" << endl;
+        return -1;
+    }
+
+    for (int64_t i = 1; i <= 10; i++) {
+        Pose value{i, (double) -i};
+        writer.write(value);
+    }
+
+    if (reader.read(pose) != 10 || pose.x != 10 || pose.y != -10) {
+        cerr << "Latest value not read" << endl;
+        return -1;
+    }
+
+    // Segment of a writer that stopped in the middle of a write
+    string name = "/routio_test_" + std::to_string(getpid());
+    StateSegment::remove(name);
+
+    StateSegment segment(name, sizeof(Pose), true);
+
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    StateSegmentHeader *header = (StateSegmentHeader *) mmap(NULL, ROUTIO_STATE_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    StateSegment::remove(name);
+
+    if (header == MAP_FAILED) {
+        cerr << "Unable to map state segment" << endl;
+        return -1;
+    }
+
+    header->sequence.store(1);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t length = sizeof(Pose);
+
+    if (segment.read(&pose, sizeof(Pose), length) != 0 || length != 0) {
+        cerr << "Unfinished write not detected" << endl;
+        return -1;
+    }
+
+    if (std::chrono::steady_clock::now() - start > std::chrono::seconds(2)) {
+        cerr << "Waiting for an unfinished write is not bounded" << endl;
+        return -1;
+    }
+
+    start = std::chrono::steady_clock::now();
+
+    if (segment.read(&pose, sizeof(Pose), length) != 0 || std::chrono::steady_clock::now() - start > std::chrono::microseconds(ROUTIO_STATE_TIMEOUT / 2)) {
+        cerr << "Waiting again for the same unfinished write" << endl;
+        return -1;
+    }
+
+    Pose recovered{7, 7};
+
+    if (!segment.write(&recovered, sizeof(Pose)) || segment.read(&pose, sizeof(Pose), length) != 2 || pose.x != 7) {
+        cerr << "Unfinished write not taken over" << endl;
+        return -1;
+    }
+
+    // Sizes in the shared header are not trusted
+    header->capacity = 1 << 30;
+    header->length.store(1 << 30);
+
+    Pose larger[2];
+
+    if (segment.write(larger, sizeof(larger)) || segment.read(larger, sizeof(larger), length) == 0 || length != sizeof(Pose)) {
+        cerr << "State segment bounds taken from the shared header" << endl;
+        return -1;
+    }
+
+    munmap(header, ROUTIO_STATE_HEADER_SIZE);
+
+    // Segments larger than the limit of the router are not created
+    router.get_router()->set_state_limit(1024);
+
+    StateReader large(reader_client, "large", 4096);
+    StateReader small(reader_client, "small", 512);
+
+    if (!wait_for([&]() { return small.is_ready(); }) || large.is_ready()) {
+        cerr << "State segment limit not enforced" << endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <iostream>
+#include <vector>
+#include <memory>
+
+#include <routio/client.h>
+#include <routio/routing.h>
+
+using namespace std;
+using namespace routio;
+
+#define STREAM_LENGTH 1000003
+#define WRITE_SIZE 7777
+
+size_t received = 0;
+
+void handle_chunk(SharedMessage chunk, size_t offset, size_t length) {
+
+    if (offset != received || length != STREAM_LENGTH)
+        exit(-1);
+
+    vector<uchar> data(chunk->get_length());
+    chunk->copy_data(0, data.data(), data.size());
+
+    for (size_t i = 0; i < data.size(); i++) {
+        if (data[i] != (uchar) ((offset + i) % 251))
+            exit(-1);
+    }
+
+    received += data.size();
+
+    if (received == STREAM_LENGTH)
+        exit(0);
+
+}
+
+int main(int argc, char** argv) {
+
+    EmbeddedRouter router;
+
+    SharedClient client = router.connect("stream");
+
+    vector<uchar> data(STREAM_LENGTH);
+
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = i % 251;
+    }
+
+    Publisher publisher(client, "stream");
+    publisher.set_stream_window(2);
+    StreamSubscriber subscriber(client, "stream", "", create_stream_callback(handle_chunk));
+
+    while (true) {
+
+        if (received == 0 && !publisher.is_streaming() && publisher.begin_stream(data.size())) {
+
+            size_t position = 0;
+
+            while (position < data.size()) {
+                size_t written = publisher.write(span<const uchar>(data.data() + position, min((size_t) WRITE_SIZE, data.size() - position)));
+
+                if (publisher.is_stream_dropped())
+                    exit(-4);
+
+                // Chunks are still waiting to be sent, let the loop write them
+                if (written == 0 && !routio::wait(10))
+                    exit(-3);
+
+                position += written;
+            }
+
+            publisher.end();
+        }
+
+        if (!routio::wait(100)) break;
+    }
+
+    exit(-2);
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <memory>
+
+#include <routio/client.h>
+#include <routio/array.h>
+#include <routio/routing.h>
+
+#include "common.h"
+
+using namespace std;
+using namespace routio;
+
+int main(int argc, char** argv) {
+
+    EmbeddedRouter router;
+
+    SharedClient publisher_client = router.connect("publisher");
+    SharedClient subscriber_client = router.connect("subscriber");
+
+    // Sends packed messages directly to control when the tensor is released
+    Publisher publisher(publisher_client, "tensors", get_type_identifier<SharedTensor>());
+
+    std::atomic<int> received(0);
+
+    TypedSubscriber<SharedTensor> subscriber(subscriber_client, "tensors", [&](shared_ptr<SharedTensor> tensor) {
+        if ((*tensor)->get_size() == 64 * 64 * 3) received++;
+    });
+
+    if (!wait_for([&]() { return publisher.get_subscribers() > 0; })) {
+        cerr << "Subscriber not connected" << endl;
+        return -1;
+    }
+
+    TensorPool pool(2);
+
+    SharedTensor tensor = pool.allocate({64, 64, 3}, UINT8);
+    const uchar* buffer = tensor->get_const_data();
+
+    // The message that waits to be sent still references the buffer
+    SharedMessage message = Message::pack<SharedTensor>(tensor);
+    tensor.reset();
+
+    if (pool.get_available() != 0) {
+        cerr << "Buffer returned to the pool while referenced by a message" << endl;
+        return -1;
+    }
+
+    SharedTensor other = pool.allocate({64, 64, 3}, UINT8);
+
+    if (other->get_const_data() == buffer) {
+        cerr << "Buffer of a message in flight handed out again" << endl;
+        return -1;
+    }
+
+    other.reset();
+
+    if (pool.get_available() != 1) {
+        cerr << "Released buffer not kept in the pool" << endl;
+        return -1;
+    }
+
+    if (!publisher.send_lazy([message]() { return message; })) {
+        cerr << "Message not sent" << endl;
+        return -1;
+    }
+
+    message.reset();
+
+    // The buffer is returned once the message was written and received
+    if (!wait_for([&]() { return received == 1 && pool.get_available() == 2; })) {
+        cerr << "Buffer not returned after sending, " << pool.get_available() << " available" << endl;
+        return -1;
+    }
+
+    tensor = pool.allocate({64, 64, 3}, UINT8);
+
+    if (pool.get_available() != 1) {
+        cerr << "Buffer not reused" << endl;
+        return -1;
+    }
+
+    // Buffers of other shapes are not mixed up
+    SharedTensor different = pool.allocate({32, 32}, FLOAT32);
+
+    if (pool.get_available() != 1 || different->get_const_data() == buffer || different->get_const_data() == tensor->get_const_data()) {
+        cerr << "Buffer of a different shape reused" << endl;
+        return -1;
+    }
+
+    return 0;
+}